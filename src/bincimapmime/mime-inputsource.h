@@ -60,8 +60,14 @@ namespace Binc {
 
     inline unsigned int getOffset(void) const;
 
+    inline void setRawDataSink(MimeRawDataSink *sink);
+
   private:
     int fd;
+    MimeRawDataSink *rawsink;
+    // Raw offset of the next fillRaw(), and how far we already fed the sink
+    unsigned int rawoffset;
+    unsigned int sinkoffset;
     char data[16384];
     unsigned int offset;
     unsigned int tail;
@@ -74,6 +80,8 @@ namespace Binc {
   {
     this->fd = fd;
     this->start = start;
+    rawsink = 0;
+    rawoffset = sinkoffset = 0;
     offset = 0;
     tail = 0;
     head = 0;
@@ -101,6 +109,13 @@ namespace Binc {
       return false;
     }
 
+    if (rawsink && rawoffset + nbytes > sinkoffset) {
+      unsigned int skip = sinkoffset - rawoffset;
+      rawsink->rawData(raw + skip, nbytes - skip);
+      sinkoffset = rawoffset + nbytes;
+    }
+    rawoffset += nbytes;
+
     for (ssize_t i = 0; i < nbytes; ++i) {
       const char c = raw[i];
       if (c == '\r') {
@@ -129,6 +144,7 @@ namespace Binc {
   inline void MimeInputSource::reset(void)
   {
     offset = head = tail = 0;
+    rawoffset = 0;
     lastChar = '\0';
 
     if (fd != -1)
@@ -175,6 +191,11 @@ namespace Binc {
     return offset;
   }
 
+  inline void MimeInputSource::setRawDataSink(MimeRawDataSink *sink)
+  {
+    rawsink = sink;
+  }
+
     ///////////////////////////////////
     class MimeInputSourceStream : public MimeInputSource {
   public:
@@ -51,7 +51,7 @@ using namespace ::std;
 #endif
 
 //------------------------------------------------------------------------
-void Binc::MimeDocument::parseFull(int fd)
+void Binc::MimeDocument::parseFull(int fd, MimeRawDataSink *sink)
 {
   if (allIsParsed)
     return;
@@ -60,6 +60,7 @@ void Binc::MimeDocument::parseFull(int fd)
 
   delete doc_mimeSource;
   doc_mimeSource = new MimeInputSource(fd);
+  doc_mimeSource->setRawDataSink(sink);
 
   headerstartoffsetcrlf = 0;
   headerlength = 0;
@@ -77,6 +78,9 @@ void Binc::MimeDocument::parseFull(int fd)
   char c;
   while (doc_mimeSource->getChar(&c));
 
+  // The sink is only meant to see the parsing pass, later body reads
+  // happen after the caller is done with it.
+  doc_mimeSource->setRawDataSink(0);
   size = doc_mimeSource->getOffset();
 }
 
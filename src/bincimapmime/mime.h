@@ -34,6 +34,15 @@ namespace Binc {
 
   class MimeInputSource;
 
+  // Optional receiver for the raw input data, e.g. for computing a
+  // checksum while parsing. Each raw byte is passed exactly once, in
+  // order, even if the source is reset and data is read again.
+  class MimeRawDataSink {
+  public:
+    virtual ~MimeRawDataSink(void) {}
+    virtual void rawData(const char *data, size_t cnt) = 0;
+  };
+
 
   //---------------------------------------------------------------------- 
   class HeaderItem {
@@ -161,7 +170,7 @@ namespace Binc {
     ~MimeDocument(void);
 
     void parseOnlyHeader(int fd);
-    void parseFull(int fd);
+    void parseFull(int fd, MimeRawDataSink *sink = 0);
     void parseOnlyHeader(std::istream& s);
     void parseFull(std::istream& s);
 
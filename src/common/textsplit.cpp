@@ -25,6 +25,11 @@
 #include <algorithm>
 #include <cstring>
 #include <unordered_set>
+#include <map>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "textsplit.h"
 #include "log.h"
@@ -69,14 +74,18 @@ enum CharClass {LETTER=256, SPACE=257, DIGIT=258, WILD=259,
                 A_ULETTER=260, A_LLETTER=261, SKIP=262};
 static int charclasses[charclasses_size];
 
-// Non-ascii UTF-8 characters are handled with sets holding all
+// Non-ascii UTF-8 characters are classified from sets holding all
 // characters with interesting properties. This is far from full-blown
 // management of Unicode properties, but seems to do the job well
-// enough in most common cases
-static vector<unsigned int> vpuncblocks;
-static std::unordered_set<unsigned int> spunc;
+// enough in most common cases. The sets are used once to build a
+// two-level table with pages of 256 classes. Most pages are
+// identical and shared, so that the table is small, and the lookup
+// is constant time.
+enum UniClass {UC_LETTER, UC_SPACE, UC_SKIP, UC_ASIS};
+static const unsigned int uniclasses_max = 0x110000;
+static vector<unsigned short> uniclasspages;
+static vector<unsigned char> uniclasses;
 static std::unordered_set<unsigned int> visiblewhite;
-static std::unordered_set<unsigned int> sskip;
 
 class CharClassInit {
 public:
@@ -117,22 +126,43 @@ public:
         for (i = 0; i  < strlen(special); i++)
             charclasses[int(special[i])] = special[i];
 
+        // Non-ascii classes. Characters are letters by default, the
+        // punctuation blocks (pairs of inclusive limits) and single
+        // punctuation characters are spaces, skip has precedence.
+        vector<unsigned char> flat(uniclasses_max, UC_LETTER);
+        assert((sizeof(unipuncblocks) / sizeof(int)) % 2 == 0);
+        for (i = 0; i < sizeof(unipuncblocks) / sizeof(int); i += 2) {
+            for (unsigned int c = unipuncblocks[i];
+                 c <= unipuncblocks[i+1] && c < uniclasses_max; c++) {
+                flat[c] = UC_SPACE;
+            }
+        }
         for (i = 0; i < sizeof(unipunc) / sizeof(int); i++) {
-            spunc.insert(unipunc[i]);
+            if (unipunc[i] < uniclasses_max)
+                flat[unipunc[i]] = UC_SPACE;
         }
-        spunc.insert((unsigned int)-1);
-
-        for (i = 0; i < sizeof(unipuncblocks) / sizeof(int); i++) {
-            vpuncblocks.push_back(unipuncblocks[i]);
+        for (i = 0; i < sizeof(uniskip) / sizeof(int); i++) {
+            if (uniskip[i] < uniclasses_max)
+                flat[uniskip[i]] = UC_SKIP;
+        }
+        // Characters processed as their ascii equivalent, see whatcc()
+        flat[0x2010] = flat[0x2019] = flat[0x275c] = flat[0x02bc] = UC_ASIS;
+
+        std::map<string, unsigned short> pages;
+        for (unsigned int page = 0; page < uniclasses_max / 256; page++) {
+            string data((const char *)&flat[page * 256], 256);
+            auto it = pages.find(data);
+            if (it == pages.end()) {
+                unsigned short idx = (unsigned short)pages.size();
+                it = pages.insert({data, idx}).first;
+                uniclasses.insert(uniclasses.end(), data.begin(), data.end());
+            }
+            uniclasspages.push_back(it->second);
         }
-        assert((vpuncblocks.size() % 2) == 0);
 
         for (i = 0; i < sizeof(avsbwht) / sizeof(int); i++) {
             visiblewhite.insert(avsbwht[i]);
         }
-        for (i = 0; i < sizeof(uniskip) / sizeof(int); i++) {
-            sskip.insert(uniskip[i]);
-        }
     }
 };
 static const CharClassInit charClassInitInstance;
@@ -141,36 +171,26 @@ static inline int whatcc(unsigned int c, char *asciirep = nullptr)
 {
     if (c <= 127) {
         return charclasses[c]; 
-    } else {
-        if (c == 0x2010) {
-            // Special treatment for hyphen: handle as ascii minus. See
-            // doc/notes/minus-hyphen-dash.txt
-            if (asciirep)
-                *asciirep = '-';
-            return c;
-        } else if (c == 0x2019 || c == 0x275c || c == 0x02bc) {
-            // Things sometimes replacing a single quote. Use single
-            // quote so that span processing works ok
-            if (asciirep)
-                *asciirep = '\'';
-            return c;
-        } else if (sskip.find(c) != sskip.end()) {
-            return SKIP;
-        } else if (spunc.find(c) != spunc.end()) {
-            return SPACE;
-        } else {
-            vector<unsigned int>::iterator it = 
-                lower_bound(vpuncblocks.begin(), vpuncblocks.end(), c);
-                if (it == vpuncblocks.end())
-                        return LETTER;
-            if (c == *it)
-                return SPACE;
-            if ((it - vpuncblocks.begin()) % 2 == 1) {
-                return SPACE;
-            } else {
-                return LETTER;
-            }
-        } 
+    } else if (c >= uniclasses_max) {
+        // Possibly the -1 lookahead value at the end of the string
+        return c == (unsigned int)-1 ? SPACE : LETTER;
+    }
+    switch (uniclasses[(uniclasspages[c >> 8] << 8) + (c & 0xff)]) {
+    case UC_LETTER:
+        return LETTER;
+    case UC_SPACE:
+        return SPACE;
+    case UC_SKIP:
+        return SKIP;
+    default:
+        if (asciirep) {
+            // Special treatment for hyphen: handle as ascii
+            // minus. See doc/notes/minus-hyphen-dash.txt. The others
+            // are things sometimes replacing a single quote. Use
+            // single quote so that span processing works ok
+            *asciirep = c == 0x2010 ? '-' : '\'';
+        }
+        return c;
     }
 }
 
@@ -404,9 +424,9 @@ bool TextSplit::words_from_span(size_t bp)
         unsigned int l0 = m_words_in_span[0].second - m_words_in_span[0].first;
         unsigned int s1 = m_words_in_span[1].first;
         unsigned int l1 = m_words_in_span[1].second - m_words_in_span[1].first;
-        string word = m_span.substr(s0, l0) + m_span.substr(s1, l1);
+        m_word.assign(m_span, s0, l0).append(m_span, s1, l1);
         if (l0 && l1) 
-            emitterm(false, word,
+            emitterm(false, m_word,
                      m_spanpos, spboffs, spboffs + m_words_in_span[1].second);
     }
 
@@ -425,8 +445,9 @@ bool TextSplit::words_from_span(size_t bp)
             //" fin " << fin << endl;
             if (fin - deb > int(m_span.size()))
                 break;
-            string word(m_span.substr(deb, fin-deb));
-            if (!emitterm(j != i+1, word, pos, spboffs+deb, spboffs+fin))
+            // Reuse the member buffer to avoid an allocation per term
+            m_word.assign(m_span, deb, fin-deb);
+            if (!emitterm(j != i+1, m_word, pos, spboffs+deb, spboffs+fin))
                 return false;
         }
         if (!noposinc)
@@ -542,9 +563,47 @@ static inline bool isdigit(int what, unsigned int flgs)
 
 #ifdef TEXTSPLIT_STATS
 #define STATS_INC_WORDCHARS ++m_wordChars
+#define STATS_ADD_WORDCHARS(N) m_wordChars += (N)
 #else
 #define STATS_INC_WORDCHARS
+#define STATS_ADD_WORDCHARS(N)
+#endif
+
+// Return the length of the run of ascii letters and digits at the
+// start of cp. Most of the text in common documents is made of such
+// runs, which need no per-character processing once we are inside a
+// word. Look at 16 bytes at a time if possible.
+static inline size_t asciialnumrun(const char *cp, size_t len)
+{
+    size_t n = 0;
+#if defined(__SSE2__) && defined(__GNUC__)
+    const __m128i zero = _mm_set1_epi8('0' - 1);
+    const __m128i nine = _mm_set1_epi8('9' + 1);
+    const __m128i a = _mm_set1_epi8('a' - 1);
+    const __m128i z = _mm_set1_epi8('z' + 1);
+    const __m128i lowerbit = _mm_set1_epi8(0x20);
+    while (len - n >= 16) {
+        // Signed comparisons: non-ascii bytes are negative and fail.
+        __m128i v = _mm_loadu_si128((const __m128i *)(cp + n));
+        __m128i d = _mm_and_si128(_mm_cmpgt_epi8(v, zero),
+                                  _mm_cmplt_epi8(v, nine));
+        __m128i l = _mm_or_si128(v, lowerbit);
+        l = _mm_and_si128(_mm_cmpgt_epi8(l, a), _mm_cmplt_epi8(l, z));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(d, l));
+        if (mask != 0xffff) {
+            return n + __builtin_ctz(~mask);
+        }
+        n += 16;
+    }
 #endif
+    for (; n < len; n++) {
+        int cc = charclasses[(unsigned char)cp[n]];
+        if (cc != A_LLETTER && cc != A_ULETTER && cc != DIGIT)
+            break;
+    }
+    return n;
+}
+
 
 vector<CharFlags> splitFlags{
     {TextSplit::TXTS_NOSPANS, "nospans"},
@@ -654,6 +713,7 @@ bool TextSplit::text_to_words(const string &in)
                 m_inNumber = true;
             m_wordLen += it.appendchartostring(m_span);
             STATS_INC_WORDCHARS;
+            ascii_run(&it);
             break;
 
         case SPACE:
@@ -900,6 +960,9 @@ bool TextSplit::text_to_words(const string &in)
             }
             m_wordLen += it.appendchartostring(m_span);
             STATS_INC_WORDCHARS;
+            if (cc == A_LLETTER || cc == A_ULETTER || cc == LETTER) {
+                ascii_run(&it);
+            }
             break;
         }
         softhyphenpending = false;
@@ -911,6 +974,37 @@ bool TextSplit::text_to_words(const string &in)
     return true;
 }
 
+// After processing a letter or digit inside a word, take the
+// following ascii letters and digits in one go. The state changes
+// are the same as if they had been processed one by one in the main
+// loop: only m_inNumber needs a look at the characters.
+void TextSplit::ascii_run(Utf8Iter *itp)
+{
+#if !defined(RCL_SPLIT_CAMELCASE) && !defined(KATAKANA_AS_WORDS)
+    Utf8Iter &it = *itp;
+    const string& in = it.buffer();
+    size_t bpos = it.getBpos() + it.getBlen();
+    size_t n = asciialnumrun(in.c_str() + bpos, in.size() - bpos);
+    if (n == 0)
+        return;
+    if (m_inNumber) {
+        for (size_t i = bpos; i < bpos + n; i++) {
+            if (charclasses[(unsigned char)in[i]] != DIGIT &&
+                in[i] != 'e' && in[i] != 'E') {
+                m_inNumber = false;
+                break;
+            }
+        }
+    }
+    m_span.append(in.c_str() + bpos, n);
+    m_wordLen += (unsigned int)n;
+    STATS_ADD_WORDCHARS(n);
+    // Position on the last character of the run, the caller's loop
+    // increments.
+    it.skipascii(n);
+#endif
+}
+
 // Using an utf8iter pointer just to avoid needing its definition in
 // textsplit.h
 //
@@ -164,6 +164,8 @@ private:
 
     // Current span. Might be jf.dockes@wanadoo.f
     std::string        m_span; 
+    // Buffer for the words extracted from the span
+    std::string        m_word;
 
     std::vector <std::pair<int, int> > m_words_in_span;
 
@@ -203,6 +205,8 @@ private:
 
     // This processes cjk text:
     bool cjk_to_words(Utf8Iter *it, unsigned int *cp);
+    // Fast path for ascii letters and digits inside a word
+    void ascii_run(Utf8Iter *it);
 
     bool emitterm(bool isspan, std::string &term, int pos, size_t bs,size_t be);
     bool doemit(bool spanerase, size_t bp);
@@ -15,9 +15,12 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include "autoconfig.h"
+
 #include <stdio.h>
 #include <cstdlib>
 #include <errno.h>
+#include <string.h>
 
 #include <string>
 
@@ -29,6 +32,19 @@
 bool unacmaybefold(const string &in, string &out, 
                    const char *encoding, UnacOp what)
 {
+    // UTF-8 is what we nearly always get: use the native code, which
+    // does not use iconv or lock, and writes directly into out.
+    if (!strcasecmp(encoding, "UTF-8") || !strcasecmp(encoding, "UTF8")) {
+        int uwhat = what == UNACOP_UNAC ? 0 : what == UNACOP_UNACFOLD ? 1 : 2;
+        if (unacmaybefold_string_utf8(in.c_str(), in.size(), out, uwhat) < 0) {
+            char cerrno[20];
+            sprintf(cerrno, "%d", errno);
+            out = string("unac_string failed, errno : ") + cerrno;
+            return false;
+        }
+        return true;
+    }
+
     char *cout = 0;
     size_t out_len;
     int status = -1;
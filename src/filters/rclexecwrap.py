@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+#################################
+# Copyright (C) 2020 J.F.Dockes
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the
+#   Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+########################################################
+
+# Generic execm wrapper for the single-shot "exec" filters (the ones
+# which process one file and exit, like rclps or rcltex). Usage in
+# mimeconf:
+#     application/postscript = execm rclexecwrap.py rclps
+#
+# The wrapper process is permanent, so that it is managed by the
+# indexer like the other execm filters (kept in the handler cache,
+# recycled after filtermaxfiles files, or when growing beyond
+# filtermaxrssmbytes, number of instances limited by
+# filtermaxinstances). The indexer does not need to fork itself for
+# each file: the wrapped filter is executed from here instead.
+#
+# The output of the wrapped filter is returned as is, and is html by
+# default, as for an exec filter.
+
+from __future__ import print_function
+
+import sys
+import rclexecm
+import rclexec1
+
+# Pass the filter output through. If the filter reports that it is
+# missing a helper program, say it the way a native execm filter
+# would: this disables us for the rest of the indexing pass.
+class WrapProcessData:
+    def __init__(self, em):
+        self.em = em
+        self.out = []
+        self.first = True
+
+    def takeLine(self, line):
+        if self.first:
+            self.first = False
+            if line.startswith(b'RECFILTERROR HELPERNOTFOUND'):
+                print(line.decode('UTF-8', 'replace'))
+                sys.stdout.flush()
+                sys.exit(1)
+        self.out.append(line)
+
+    def wrapData(self):
+        return b'\n'.join(self.out)
+
+class WrapFilter:
+    def __init__(self, em, cmd):
+        self.em = em
+        self.cmd = cmd
+        self.ntry = 0
+
+    def reset(self):
+        self.ntry = 0
+
+    def getCmd(self, fn):
+        if self.ntry:
+            return ([], None)
+        self.ntry = 1
+        return (self.cmd, WrapProcessData(self.em))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print("Usage: rclexecwrap.py <filter> [args]", file=sys.stderr)
+        sys.exit(1)
+    cmd = rclexecm.which(sys.argv[1])
+    if not cmd:
+        print("RECFILTERROR HELPERNOTFOUND %s" % sys.argv[1])
+        sys.exit(1)
+    cmd = [cmd] + sys.argv[2:]
+    # rclexecm.main() runs the protocol loop when it gets no arguments
+    sys.argv = sys.argv[:1]
+    proto = rclexecm.RclExecM()
+    filter = WrapFilter(proto, cmd)
+    extract = rclexec1.Executor(proto, filter)
+    rclexecm.main(proto, extract)
@@ -26,6 +26,7 @@
 #include <iostream>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 
 #include "cstr.h"
@@ -44,6 +45,7 @@
 #include "chrono.h"
 #include "wipedir.h"
 #include "fileudi.h"
+#include "mimetype.h"
 #include "cancelcheck.h"
 #include "rclinit.h"
 #include "extrameta.h"
@@ -188,10 +190,22 @@ bool FsIndexer::index(int flags)
 	m_updater->status.dbtotdocs = m_db->docCnt();
     }
 
+    // Possibly load the up to date check data in memory. Not for
+    // the quick first pass, which only looks at a few files.
+    bool preload = false;
+    if (!quickshallow && m_config->getConfParam("idxpreloadsigs", &preload) &&
+        preload) {
+        m_db->preloadUpdateData();
+    }
+
     m_walker.setSkippedPaths(m_config->getSkippedPaths());
     if (quickshallow) {
 	m_walker.setOpts(m_walker.getOpts() | FsTreeWalker::FtwSkipDotFiles);
 	m_walker.setMaxDepth(2);
+    } else {
+        int walkthreads = 0;
+        m_config->getConfParam("idxwalkthreads", &walkthreads);
+        m_walker.setWalkThreads(walkthreads);
     }
 
     for (const auto& topdir : m_tdl) {
@@ -249,6 +263,7 @@ bool FsIndexer::index(int flags)
 	}
 	m_config->storeMissingHelperDesc(missing);
     }
+    mimetypeSaveCache();
     LOGINFO("fsindexer index time:  " << chron.millis() << " mS\n");
     return true;
 }
@@ -328,6 +343,50 @@ goodpath:
     return false;
 }
 
+// Same as matchesSkipped(), but remembering the decisions for the
+// parent directories: indexFiles() is often called with many files in
+// the same directory, and the ancestors tests are the costly part.
+static bool matchesSkippedCached(const vector<string>& tdl,
+                                 FsTreeWalker& walker,
+                                 const string& path,
+                                 unordered_map<string, bool>& dircache)
+{
+    string canonpath = path_canon(path);
+    string father = path_getfather(canonpath);
+    if (!path_isroot(father) && father[father.size()-1] == '/')
+        father.erase(father.size()-1);
+    if (path_isroot(canonpath) || father.length() >= canonpath.length())
+        return matchesSkipped(tdl, walker, path);
+
+    // The file itself: this replicates the first steps of the loops
+    // in matchesSkipped().
+    string fn = path_getsimple(canonpath);
+    if (find(tdl.begin(), tdl.end(), canonpath) != tdl.end()) {
+        return walker.inSkippedNames(fn);
+    }
+    if (walker.inSkippedPaths(canonpath, false)) {
+        LOGDEB("FsIndexer::indexFiles: skipping [" << path << "] (skpp)\n");
+        return true;
+    }
+
+    bool dirskipped;
+    auto it = dircache.find(father);
+    if (it != dircache.end()) {
+        dirskipped = it->second;
+    } else {
+        dirskipped = matchesSkipped(tdl, walker, father);
+        dircache[father] = dirskipped;
+    }
+    if (dirskipped) {
+        return true;
+    }
+    if (walker.inSkippedNames(fn)) {
+        LOGDEB("FsIndexer::indexFiles: skipping [" << path << "] (skpn)\n");
+        return true;
+    }
+    return false;
+}
+
 /** 
  * Index individual files, out of a full tree run. No database purging
  */
@@ -349,6 +408,10 @@ bool FsIndexer::indexFiles(list<string>& files, int flags)
     // We use an FsTreeWalker just for handling the skipped path/name lists
     FsTreeWalker walker;
     walker.setSkippedPaths(m_config->getSkippedPaths());
+    // Skip decisions for the parent directories. The skippedNames
+    // only depend on the parent directory, so that the cache stays
+    // valid.
+    unordered_map<string, bool> skipcache;
 
     for (list<string>::iterator it = files.begin(); it != files.end(); ) {
         LOGDEB2("FsIndexer::indexFiles: [" << it << "]\n");
@@ -363,7 +426,7 @@ bool FsIndexer::indexFiles(list<string>& files, int flags)
         walker.setSkippedNames(m_config->getSkippedNames());
 	// Check path against indexed areas and skipped names/paths
         if (!(flags & ConfIndexer::IxFIgnoreSkip) && 
-	    matchesSkipped(m_tdl, walker, *it)) {
+	    matchesSkippedCached(m_tdl, walker, *it, skipcache)) {
             it++; 
 	    continue;
         }
@@ -409,6 +472,7 @@ out:
 #endif // IDX_THREADS
     }
 
+    mimetypeSaveCache();
     LOGDEB("FsIndexer::indexFiles: done\n");
     return ret;
 }
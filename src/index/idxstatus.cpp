@@ -36,4 +36,14 @@ void readIdxStatus(RclConfig *config, DbIxStatus &status)
     string shm("0");
     cs.get("hasmonitor", shm);
     status.hasmonitor = stringToBool(shm);
+    cs.get("commits", &status.commits);
+    string lat;
+    if (cs.get("commitlatency", lat)) {
+        vector<string> vlat;
+        stringToStrings(lat, vlat);
+        status.commitlatency.clear();
+        for (const auto& v : vlat) {
+            status.commitlatency.push_back(atoi(v.c_str()));
+        }
+    }
 }
@@ -19,6 +19,7 @@
 #define _IDXSTATUS_H_INCLUDED_
 
 #include <string>
+#include <vector>
 
 // Current status of an indexing operation. This is updated in
 // $RECOLL_CONFDIR/idxstatus.txt
@@ -41,6 +42,27 @@ class DbIxStatus {
     // telling if option -m was set, not about what we are currently
     // doing
     bool hasmonitor{false};
+    // Monitor writer session commits: count and latency histogram
+    // (see commitLatencyLimits() for the bucket bounds). These are
+    // not reset between indexing passes.
+    int commits{0};
+    std::vector<int> commitlatency;
+
+    // Upper bounds (mS) for the latency buckets, the last bucket
+    // holds everything above.
+    static const std::vector<int>& commitLatencyLimits() {
+        static const std::vector<int> limits{10, 100, 1000, 10000};
+        return limits;
+    }
+    void addCommitTime(int ms) {
+        const std::vector<int>& limits = commitLatencyLimits();
+        commitlatency.resize(limits.size() + 1);
+        unsigned int i = 0;
+        while (i < limits.size() && ms >= limits[i])
+            i++;
+        commitlatency[i]++;
+        commits++;
+    }
     
     void reset() {
 	phase = DBIXS_FILES;
@@ -32,6 +32,7 @@
 #include "mimehandler.h"
 #include "pathut.h"
 #include "idxstatus.h"
+#include "chrono.h"
 
 #ifdef RCL_USE_ASPELL
 #include "rclaspell.h"
@@ -111,8 +112,15 @@ bool ConfIndexer::firstFsIndexingSequence()
 
 bool ConfIndexer::index(bool resetbefore, ixType typestorun, int flags)
 {
+    sessionRelease();
     Rcl::Db::OpenMode mode = resetbefore ? Rcl::Db::DbTrunc : Rcl::Db::DbUpd;
-    if (!m_db.open(mode)) {
+    // The first indexing sequence wants to show results early, which
+    // can't be done with write shards
+    bool firstindexing = (typestorun & IxTFs) && runFirstIndexing();
+    m_db.setShardedWrite(!firstindexing);
+    bool opened = m_db.open(mode);
+    m_db.setShardedWrite(false);
+    if (!opened) {
 	LOGERR("ConfIndexer: error opening database " << m_config->getDbDir() <<
                " : " << m_db.getReason() << "\n");
         addIdxReason("indexer", m_db.getReason());
@@ -121,7 +129,7 @@ bool ConfIndexer::index(bool resetbefore, ixType typestorun, int flags)
 
     m_config->setKeyDir(cstr_null);
     if (typestorun & IxTFs) {
-	if (runFirstIndexing()) {
+	if (firstindexing) {
 	    firstFsIndexingSequence();
 	}
         deleteZ(m_fsindexer);
@@ -199,13 +207,14 @@ bool ConfIndexer::indexFiles(list<string>& ifiles, int flag)
     }
     myfiles.sort();
 
-    if (!m_db.open(Rcl::Db::DbUpd)) {
+    if (!openUpd()) {
 	LOGERR("ConfIndexer: indexFiles error opening database " <<
                m_config->getDbDir() << "\n");
 	return false;
     }
     m_config->setKeyDir(cstr_null);
     bool ret = false;
+    int cnt = int(myfiles.size());
     if (!m_fsindexer)
         m_fsindexer = new FsIndexer(m_config, &m_db, m_updater);
     if (m_fsindexer)
@@ -228,13 +237,14 @@ bool ConfIndexer::indexFiles(list<string>& ifiles, int flag)
         m_db.purge();
     }
     // The close would be done in our destructor, but we want status here
-    if (!m_db.close()) {
+    if (!closeUpd(cnt)) {
 	LOGERR("ConfIndexer::index: error closing database in " <<
                m_config->getDbDir() << "\n");
 	return false;
     }
     ifiles = myfiles;
-    clearMimeHandlerCache();
+    if (!m_session)
+        clearMimeHandlerCache();
     return ret;
 }
 
@@ -260,12 +270,13 @@ bool ConfIndexer::purgeFiles(list<string> &files, int flag)
     }
     myfiles.sort();
 
-    if (!m_db.open(Rcl::Db::DbUpd)) {
+    if (!openUpd()) {
 	LOGERR("ConfIndexer: purgeFiles error opening database " <<
                m_config->getDbDir() << "\n");
 	return false;
     }
     bool ret = false;
+    int cnt = int(myfiles.size());
     m_config->setKeyDir(cstr_null);
     if (!m_fsindexer)
         m_fsindexer = new FsIndexer(m_config, &m_db, m_updater);
@@ -285,7 +296,7 @@ bool ConfIndexer::purgeFiles(list<string> &files, int flag)
 #endif
 
     // The close would be done in our destructor, but we want status here
-    if (!m_db.close()) {
+    if (!closeUpd(cnt)) {
 	LOGERR("ConfIndexer::purgefiles: error closing database in " <<
                m_config->getDbDir() << "\n");
 	return false;
@@ -299,6 +310,7 @@ bool ConfIndexer::createStemmingDatabases()
 {
     string slangs;
     bool ret = true;
+    sessionRelease();
     if (m_config->getConfParam("indexstemminglanguages", slangs)) {
         if (!m_db.open(Rcl::Db::DbUpd)) {
             LOGERR("ConfIndexer::createStemmingDb: could not open db\n");
@@ -327,6 +339,7 @@ bool ConfIndexer::createStemmingDatabases()
 
 bool ConfIndexer::createStemDb(const string &lang)
 {
+    sessionRelease();
     if (!m_db.open(Rcl::Db::DbUpd))
 	return false;
     vector<string> langs;
@@ -352,6 +365,7 @@ bool ConfIndexer::createAspellDict()
     if (noaspell)
 	return true;
 
+    sessionRelease();
     if (!m_db.open(Rcl::Db::DbRO)) {
         LOGERR("ConfIndexer::createAspellDict: could not open db\n");
 	return false;
@@ -377,6 +391,88 @@ bool ConfIndexer::createAspellDict()
     return true;
 }
 
+void ConfIndexer::startSession()
+{
+    m_session = true;
+    m_config->getConfParam("moncommitinterval", &m_commitsecs);
+    m_config->getConfParam("moncommitfiles", &m_commitfiles);
+    // The Db would otherwise commit at the end of each batch
+    m_db.setIdleCommit(false);
+    LOGDEB("ConfIndexer::startSession: commit interval " << m_commitsecs <<
+           " S, max pending files " << m_commitfiles << "\n");
+}
+
+bool ConfIndexer::openUpd()
+{
+    if (m_sessionopen)
+        return true;
+    if (!m_db.open(Rcl::Db::DbUpd))
+        return false;
+    m_sessionopen = m_session;
+    return true;
+}
+
+bool ConfIndexer::closeUpd(int cnt)
+{
+    if (!m_sessionopen)
+        return m_db.close();
+    if (cnt > 0 && m_pendingfiles == 0)
+        m_firstpending = time(0);
+    m_pendingfiles += cnt;
+    return true;
+}
+
+bool ConfIndexer::sessionCommit(bool force)
+{
+    if (!m_sessionopen || m_pendingfiles == 0)
+        return true;
+    if (!force && m_pendingfiles < m_commitfiles &&
+        time(0) - m_firstpending < m_commitsecs)
+        return true;
+
+    Chrono chron;
+#ifdef IDX_THREADS
+    m_db.waitUpdIdle();
+#endif
+    bool ret = m_db.doFlush();
+    int ms = int(chron.millis());
+    LOGINF("ConfIndexer::sessionCommit: " << m_pendingfiles << " files, " <<
+           ms << " mS\n");
+    m_pendingfiles = 0;
+    if (m_updater) {
+#ifdef IDX_THREADS
+        std::unique_lock<std::mutex> lock(m_updater->m_mutex);
+#endif
+        m_updater->status.addCommitTime(ms);
+        m_updater->update();
+    }
+    return ret;
+}
+
+void ConfIndexer::sessionRelease()
+{
+    // The caller is going to reopen the index, commit now so that we
+    // get the stats.
+    if (m_sessionopen) {
+        sessionCommit(true);
+        m_sessionopen = false;
+    }
+}
+
+bool ConfIndexer::endSession()
+{
+    bool ret = sessionCommit(true);
+    if (m_sessionopen && !m_db.close()) {
+        LOGERR("ConfIndexer::endSession: error closing database in " <<
+               m_config->getDbDir() << "\n");
+        ret = false;
+    }
+    m_session = m_sessionopen = false;
+    m_db.setIdleCommit(true);
+    clearMimeHandlerCache();
+    return ret;
+}
+
 vector<string> ConfIndexer::getStemmerNames()
 {
     return Rcl::Db::getStemmerNames();
@@ -24,6 +24,8 @@
 #include <vector>
 #include <mutex>
 
+#include <time.h>
+
 #include "rcldb.h"
 #include "rcldoc.h"
 #include "idxstatus.h"
@@ -113,6 +115,19 @@ class ConfIndexer {
 
     /** Set in place reset mode */
     void setInPlaceReset() {m_db.setInPlaceReset();}
+
+    /** Start a long-lived writer session (real time monitor). The
+     * index is then kept open and the filter handlers cached between
+     * calls to indexFiles() and purgeFiles(), and the updates are
+     * committed by sessionCommit(), according to the moncommitXX
+     * configuration parameters. */
+    void startSession();
+    /** Commit the session updates if the commit interval or the
+     * count of pending files is reached, or always if force is set. */
+    bool sessionCommit(bool force = false);
+    /** Commit and close the index, and clear the handler cache. */
+    bool endSession();
+
  private:
     RclConfig *m_config;
     Rcl::Db    m_db;
@@ -122,6 +137,24 @@ class ConfIndexer {
     DbIxStatusUpdater  *m_updater;
     string              m_reason;
 
+    // Writer session state.
+    bool m_session{false};
+    // The index is currently open by the session
+    bool m_sessionopen{false};
+    // Commit policy
+    int m_commitsecs{60};
+    int m_commitfiles{500};
+    // Time of the first uncommitted update
+    time_t m_firstpending{0};
+    // Files indexed or purged since the last commit
+    int m_pendingfiles{0};
+    // Open the index for an update operation, or reuse the session one.
+    bool openUpd();
+    // Close after updating cnt files, unless in a session.
+    bool closeUpd(int cnt);
+    // Auxiliary operations need to reopen the index.
+    void sessionRelease();
+
     // The first time we index, we do things a bit differently to
     // avoid user frustration (make at least some results available
     // fast by using several passes, the first ones to index common
@@ -21,8 +21,16 @@
 #include "safesysstat.h"
 
 #include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include <string>
 #include <list>
+#include <mutex>
+#include <unordered_map>
 
 #include "mimetype.h"
 #include "log.h"
@@ -31,6 +39,7 @@
 #include "smallut.h"
 #include "idfile.h"
 #include "pxattr.h"
+#include "pathut.h"
 
 using namespace std;
 
@@ -48,7 +57,8 @@ using namespace std;
 /// As a last resort we execute 'file' or its configured replacement
 /// (except if forbidden by config)
 
-static string mimetypefromdata(RclConfig *cfg, const string &fn, bool usfc)
+static string mimetypefromdata(RclConfig *cfg, const string &fn, bool usfc,
+                               bool *execfailed = nullptr)
 {
     LOGDEB1("mimetypefromdata: fn [" << fn << "]\n");
     // First try the internal identifying routine
@@ -87,6 +97,8 @@ static string mimetypefromdata(RclConfig *cfg, const string &fn, bool usfc)
 	if (!ExecCmd::backtick(cmd, result)) {
 	    LOGERR("mimetypefromdata: exec " <<
                    stringsToString(cmd) << " failed\n");
+            if (execfailed)
+                *execfailed = true;
 	    return string();
 	}
 	trimstring(result, " \t\n\r");
@@ -137,6 +149,182 @@ static string mimetypefromdata(RclConfig *cfg, const string &fn, bool usfc)
     return mime;
 }
 
+#ifndef _WIN32
+/// Persistent cache for the results of mimetypefromdata(), which
+/// reads the file and may execute an external command. This is
+/// useful for files which get processed again without having been
+/// modified (retries of failed files, index resets). The file
+/// identity is the device, inode, modification time and size.
+///
+/// The data is stored as text lines in cachedir/mimecache, loaded on
+/// first use and written back by mimetypeSaveCache(). The number of
+/// entries is limited by the mimecachemaxentries configuration
+/// variable (0 disables the cache). When over the limit, the entries
+/// which were not used during this run are dropped first.
+static const string cstr_mimecachemagic("recoll-mimecache 1");
+// Stored value for an unsuccessful identification
+static const string cstr_mimecachenone("-");
+
+class MimeCache {
+public:
+    bool get(RclConfig *cfg, const struct stat *stp, string& mime) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (!m_initdone)
+            init(cfg);
+        if (m_maxentries <= 0)
+            return false;
+        auto it = m_entries.find(Key(stp));
+        if (it == m_entries.end()) {
+            m_misses++;
+            return false;
+        }
+        m_hits++;
+        it->second.used = true;
+        mime = it->second.mime;
+        return true;
+    }
+
+    void put(const struct stat *stp, const string& mime) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (m_maxentries <= 0)
+            return;
+        Entry& entry = m_entries[Key(stp)];
+        entry.mime = mime;
+        entry.used = true;
+        m_dirty = true;
+    }
+
+    void save() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (!m_initdone || m_maxentries <= 0)
+            return;
+        LOGINFO("mimetype: cache: " << m_hits << " hits, " << m_misses <<
+                " misses, " << m_entries.size() << " entries\n");
+        if (!m_dirty)
+            return;
+        if (int(m_entries.size()) > m_maxentries) {
+            for (auto it = m_entries.begin(); it != m_entries.end() &&
+                     int(m_entries.size()) > m_maxentries; ) {
+                if (!it->second.used) {
+                    it = m_entries.erase(it);
+                } else {
+                    it++;
+                }
+            }
+            // Still too big: the current run inserted more than the
+            // maximum. Just truncate.
+            while (int(m_entries.size()) > m_maxentries)
+                m_entries.erase(m_entries.begin());
+        }
+        string tmppath = m_path + ".tmp";
+        FILE *fp = fopen(tmppath.c_str(), "w");
+        if (nullptr == fp) {
+            LOGSYSERR("MimeCache::save", "fopen", tmppath);
+            return;
+        }
+        fprintf(fp, "%s\n", cstr_mimecachemagic.c_str());
+        for (const auto& ent : m_entries) {
+            fprintf(fp, "%llu %llu %lld %lld %s\n",
+                    (unsigned long long)ent.first.dev,
+                    (unsigned long long)ent.first.ino,
+                    (long long)ent.first.mtime, (long long)ent.first.size,
+                    ent.second.mime.empty() ? cstr_mimecachenone.c_str() :
+                    ent.second.mime.c_str());
+        }
+        if (fclose(fp) != 0 || rename(tmppath.c_str(), m_path.c_str()) != 0) {
+            LOGSYSERR("MimeCache::save", "write/rename", m_path);
+            unlink(tmppath.c_str());
+            return;
+        }
+        m_dirty = false;
+    }
+
+private:
+    struct Key {
+        Key(const struct stat *stp)
+            : dev(stp->st_dev), ino(stp->st_ino), mtime(stp->st_mtime),
+              size(stp->st_size) {}
+        Key(unsigned long long d, unsigned long long i, long long m,
+            long long s)
+            : dev(d), ino(i), mtime(m), size(s) {}
+        bool operator==(const Key& o) const {
+            return dev == o.dev && ino == o.ino && mtime == o.mtime &&
+                size == o.size;
+        }
+        unsigned long long dev;
+        unsigned long long ino;
+        long long mtime;
+        long long size;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            size_t h = std::hash<unsigned long long>()(k.ino);
+            h ^= std::hash<unsigned long long>()(k.dev) + 0x9e3779b9 +
+                (h << 6) + (h >> 2);
+            h ^= std::hash<long long>()(k.mtime) + 0x9e3779b9 +
+                (h << 6) + (h >> 2);
+            return h;
+        }
+    };
+    struct Entry {
+        string mime;
+        // Looked up or inserted during this run
+        bool used{false};
+    };
+    std::mutex m_mutex;
+    bool m_initdone{false};
+    bool m_dirty{false};
+    int m_maxentries{0};
+    string m_path;
+    int m_hits{0};
+    int m_misses{0};
+    std::unordered_map<Key, Entry, KeyHash> m_entries;
+
+    void init(RclConfig *cfg) {
+        m_initdone = true;
+        m_maxentries = 50000;
+        cfg->getConfParam("mimecachemaxentries", &m_maxentries);
+        if (m_maxentries <= 0)
+            return;
+        m_path = path_cat(cfg->getCacheDir(), "mimecache");
+        FILE *fp = fopen(m_path.c_str(), "r");
+        if (nullptr == fp)
+            return;
+        char line[1024];
+        if (nullptr == fgets(line, sizeof(line), fp) ||
+            strncmp(line, cstr_mimecachemagic.c_str(),
+                    cstr_mimecachemagic.size())) {
+            LOGINFO("MimeCache: ignoring bad cache file " << m_path << "\n");
+            fclose(fp);
+            return;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            unsigned long long dev, ino;
+            long long mtime, size;
+            char mime[1024];
+            if (sscanf(line, "%llu %llu %lld %lld %1023s", &dev, &ino, &mtime,
+                       &size, mime) != 5)
+                continue;
+            if (cstr_mimecachenone.compare(mime))
+                m_entries[Key(dev, ino, mtime, size)].mime = mime;
+            else
+                m_entries[Key(dev, ino, mtime, size)].mime.clear();
+        }
+        fclose(fp);
+        LOGDEB("MimeCache: loaded " << m_entries.size() << " entries\n");
+    }
+};
+
+static MimeCache o_mimecache;
+#endif // !_WIN32
+
+void mimetypeSaveCache()
+{
+#ifndef _WIN32
+    o_mimecache.save();
+#endif
+}
+
 /// Guess mime type, first from suffix, then from file data. We also
 /// have a list of suffixes that we don't touch at all.
 string mimetype(const string &fn, const struct stat *stp,
@@ -198,8 +386,22 @@ string mimetype(const string &fn, const struct stat *stp,
     // If type was not determined from suffix, examine file data. Can
     // only do this if we have an actual file (as opposed to a pure
     // name).
-    if (mtype.empty() && stp)
-	mtype = mimetypefromdata(cfg, fn, usfc);
+    if (mtype.empty() && stp) {
+#ifndef _WIN32
+        // Only cache complete identifications. An unsuccessful one
+        // with usfc false could later succeed with the file command.
+        if (usfc && o_mimecache.get(cfg, stp, mtype)) {
+            LOGDEB1("mimetype: from cache: [" << mtype << "]\n");
+            return mtype;
+        }
+#endif
+        bool execfailed = false;
+	mtype = mimetypefromdata(cfg, fn, usfc, &execfailed);
+#ifndef _WIN32
+        if (usfc && !execfailed)
+            o_mimecache.put(stp, mtype);
+#endif
+    }
 
     return mtype;
 }
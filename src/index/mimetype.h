@@ -35,5 +35,12 @@ class RclConfig;
 std::string mimetype(const std::string &filename, const struct stat *stp,
                      RclConfig *cfg, bool usfc);
 
+/**
+ * Write back the cache of file identifications from data (done when
+ * the suffix is unknown), and log the hit/miss counts. Called by the
+ * indexer at the end of a pass.
+ */
+void mimetypeSaveCache();
+
 
 #endif /* _MIMETYPE_H_INCLUDED_ */
@@ -46,8 +46,12 @@ using std::multimap;
  */
 class RclMonEvent {
  public: 
+    // RESCAN asks for checking a whole tree after events were
+    // lost. OVERFLOW is only used between the monitor interface and
+    // the receiver thread, which turns it into RESCAN events.
     enum EvType {RCLEVT_NONE= 0, RCLEVT_MODIFY=1, RCLEVT_DELETE=2, 
-		 RCLEVT_DIRCREATE=3, RCLEVT_ISDIR=0x10};
+		 RCLEVT_DIRCREATE=3, RCLEVT_RESCAN=4, RCLEVT_OVERFLOW=5,
+                 RCLEVT_ISDIR=0x10};
     string m_path;
     // Type and flags
     int  m_etyp;
@@ -62,12 +66,35 @@ class RclMonEvent {
 
     RclMonEvent() : m_etyp(RCLEVT_NONE),
 		    m_itvsecs(0), m_minclock(0), m_needidx(false) {}
-    EvType evtype() {return EvType(m_etyp & 0xf);}
-    int evflags() {return m_etyp & 0xf0;}
+    EvType evtype() const {return EvType(m_etyp & 0xf);}
+    int evflags() const {return m_etyp & 0xf0;}
 };
 
+/** Event queue counters, for diagnosis */
+struct RclMonQueueStats {
+    // Events received by pushEvent()
+    unsigned long long pushed{0};
+    // Events merged into a queued one for the same path
+    unsigned long long coalesced{0};
+    // Events matching a mondelaypatterns entry
+    unsigned long long delayed{0};
+    // Events returned for processing by pop()
+    unsigned long long popped{0};
+    // Delayed entries dropped because their file did not change again
+    unsigned long long expired{0};
+    // Monitor event losses (inotify queue overflows)
+    unsigned long long overflows{0};
+    // Tree rescans requested, and files checked by the rescans
+    unsigned long long rescans{0};
+    unsigned long long rescanned{0};
+    // Current queue sizes
+    size_t iqueuesize{0};
+    size_t dqueuesize{0};
+};
+
+// RCLMON_NOINITIAL: the initial indexing pass was skipped (-n)
 enum RclMonitorOption {RCLMON_NONE=0, RCLMON_NOFORK=1, RCLMON_NOX11=2,
-		       RCLMON_NOCONFCHECK=4};
+		       RCLMON_NOCONFCHECK=4, RCLMON_NOINITIAL=8};
 
 /**
  * Monitoring event queue. This is the shared object between the main thread 
@@ -89,11 +116,18 @@ class RclMonEventQueue {
     bool empty();
     RclMonEvent pop();
     void setopts(int opts);
+    int getopts();
 
     // Convenience function for initially communicating config to mon thr
     void setConfig(RclConfig *conf);
     RclConfig *getConfig();
 
+    /** Get the counters. Locks the queue. */
+    RclMonQueueStats getStats();
+    /** Update the counters for events lost / files rescanned */
+    void noteOverflow();
+    void noteRescanned(size_t files);
+
  private:
     RclEQData *m_data;
 };
@@ -33,13 +33,23 @@
 #include <cstdlib>
 #include <list>
 #include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <queue>
+#include <sstream>
+#include <functional>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <memory>
 
 using std::list;
 using std::vector;
+using std::map;
+using std::unordered_map;
 
 #include "log.h"
 #include "rclmon.h"
@@ -52,6 +62,7 @@ using std::vector;
 #include "x11mon.h"
 #endif
 #include "subtreelist.h"
+#include "fstreewalk.h"
 
 typedef unsigned long mttcast;
 
@@ -71,16 +82,16 @@ static RclMonEventQueue rclEQ;
 // A list of pattern/delays can be specified in the configuration so
 // that they don't get re-indexed before some timeout is elapsed. Such
 // events are kept on a separate queue (m_dqueue) with an auxiliary
-// list in time-to-reindex order, while the normal events are on
+// heap in time-to-reindex order, while the normal events are on
 // m_iqueue.
 
 // Queue management performance: on a typical recoll system there will
 // be only a few entries on the event queues and no significant time
-// will be needed to manage them. Even on a busy system, the time used
-// would most probably be negligible compared to the actual processing
-// of the indexing events. So this is just for reference. Let I be the
-// number of immediate events and D the number of delayed ones, N
-// stands for either.
+// will be needed to manage them. But a build tree or a busy log
+// directory can generate tens of thousands of events per second, and
+// the receiving thread must not stall, else the kernel queue
+// overflows. Let I be the number of immediate events and D the number
+// of delayed ones, N stands for either.
 //
 // Periodic timeout polling: the recollindex process periodically (2S)
 // wakes up to check for exit requests. At this time it also checks
@@ -88,26 +99,35 @@ static RclMonEventQueue rclEQ;
 // would normally wake up the consumer threads), or ready entries
 // among the delayed ones. At this time it calls the "empty()"
 // routine. This has constant time behaviour (checks for stl container
-// emptiness and the top entry of the delays list).
+// emptiness and the top entry of the delays heap).
 //
-// Adding a new event (pushEvent()): this performs a search for an
-// existing event with the same path (O(log(N)), then an insert on the
-// appropriate queue (O(log(N))) and an insert on the times list (O(D)). 
+// Adding a new event (pushEvent()): this looks up the delay patterns
+// (hash lookups, except for the patterns which need fnmatch()), then
+// searches for an existing event with the same path (O(1)), and
+// possibly inserts into the delays heap (O(log(D))).
 //  
-// Popping an event: this is constant time as it just looks at the
-// tops of the normal and delayed queues.
+// Popping an event: this is O(1) for immediate events and O(log(D))
+// for delayed ones.
 
 
 // Indexing event container: a map indexed by file path for fast
 // insertion of duplicate events to the same file
-typedef map<string, RclMonEvent> queue_type;
-
-// Entries for delayed events are duplicated (as iterators) on an
-// auxiliary, sorted by time-to-reindex list. We could get rid of
-// this, the price would be that the RclEQ.empty() call would have to
-// walk the whole queue instead of only looking at the first delays
-// entry.
-typedef list<queue_type::iterator> delays_type;
+typedef unordered_map<string, RclMonEvent> queue_type;
+
+// Entries for delayed events are duplicated (as path + time) on an
+// auxiliary heap, ordered by time-to-reindex. There is exactly one
+// heap entry for each m_dqueue element: it is pushed when the element
+// is created, and popped when it is reindexed (then pushed again
+// with the new time) or deleted.
+struct DelayEntry {
+    time_t minclock;
+    string path;
+    bool operator>(const DelayEntry& other) const {
+        return minclock > other.minclock;
+    }
+};
+typedef std::priority_queue<DelayEntry, vector<DelayEntry>,
+                            std::greater<DelayEntry> > delays_type;
 
 // DelayPat stores a path wildcard pattern and a minimum time between
 // reindexes, it is read from the recoll configuration
@@ -117,6 +137,71 @@ struct DelayPat {
     DelayPat() : seconds(0) {}
 };
 
+// The delay patterns, compiled for fast lookup: patterns without
+// wildcards and the "*suffix" ones (the common "*.log" case) are
+// looked up in hash maps, only the others are matched with
+// fnmatch(). The first matching pattern in configuration order is
+// returned, as with a linear search.
+class DelayPats {
+public:
+    void add(const DelayPat& dp);
+    DelayPat search(const string& path) const;
+    bool empty() const {
+        return m_pats.empty();
+    }
+private:
+    // All patterns, in configuration order. The maps store indexes
+    // into this.
+    vector<DelayPat> m_pats;
+    unordered_map<string, int> m_exact;
+    // Suffix patterns, by suffix length
+    map<string::size_type, unordered_map<string, int> > m_suffixes;
+    // Other patterns, in ascending index order
+    vector<int> m_others;
+};
+
+void DelayPats::add(const DelayPat& dp)
+{
+    int idx = int(m_pats.size());
+    m_pats.push_back(dp);
+    const string& pat = dp.pattern;
+    static const string wildcards("*?[\\");
+    if (pat.find_first_of(wildcards) == string::npos) {
+        // emplace() keeps the first (lowest index) entry
+        m_exact.emplace(pat, idx);
+    } else if (pat[0] == '*' &&
+               pat.find_first_of(wildcards, 1) == string::npos) {
+        string suff = pat.substr(1);
+        m_suffixes[suff.size()].emplace(suff, idx);
+    } else {
+        m_others.push_back(idx);
+    }
+}
+
+DelayPat DelayPats::search(const string& path) const
+{
+    int best = -1;
+    auto it = m_exact.find(path);
+    if (it != m_exact.end())
+        best = it->second;
+    for (const auto& ent : m_suffixes) {
+        if (ent.first > path.size())
+            break;
+        auto it1 = ent.second.find(path.substr(path.size() - ent.first));
+        if (it1 != ent.second.end() && (best < 0 || it1->second < best))
+            best = it1->second;
+    }
+    for (auto idx : m_others) {
+        if (best >= 0 && idx > best)
+            break;
+        if (fnmatch(m_pats[idx].pattern.c_str(), path.c_str(), 0) == 0) {
+            best = idx;
+            break;
+        }
+    }
+    return best >= 0 ? m_pats[best] : DelayPat();
+}
+
 /** Private part of RclEQ: things that we don't wish to exist in the interface
  *  include file.
  */
@@ -127,16 +212,17 @@ public:
     queue_type m_iqueue;
     // Queue for delayed reindex files
     queue_type m_dqueue;
-    // The delays list stores pointers (iterators) to elements on
-    // m_dqueue.  The list is kept in time-to-index order. Elements of
-    // m_dqueue which are also in m_delays can only be deleted while
-    // walking m_delays, so we are certain that the m_dqueue iterators
-    // stored in m_delays remain valid.
+    // The delays heap has one entry for each m_dqueue element, the
+    // top one is the next to be processed.
     delays_type m_delays;
+    // Tree rescan requests. These are kept apart from the events,
+    // which may be for the same (top directory) path.
+    std::set<string> m_rescans;
     // Configured intervals for path patterns, read from the configuration.
-    vector<DelayPat> m_delaypats;
+    DelayPats m_delaypats;
     RclConfig *m_config;
     bool       m_ok;
+    RclMonQueueStats m_stats;
 
     std::mutex m_mutex;
     std::condition_variable m_cond;
@@ -148,13 +234,9 @@ public:
     void readDelayPats(int dfltsecs);
     DelayPat searchDelayPats(const string& path)
     {
-	for (vector<DelayPat>::iterator it = m_delaypats.begin();
-	     it != m_delaypats.end(); it++) {
-	    if (fnmatch(it->pattern.c_str(), path.c_str(), 0) == 0) {
-		return *it;
-	    }
-	}
-	return DelayPat();
+        if (m_delaypats.empty())
+            return DelayPat();
+        return m_delaypats.search(path);
     }
     void delayInsert(const queue_type::iterator &qit);
 };
@@ -184,27 +266,19 @@ void RclEQData::readDelayPats(int dfltsecs)
 	} else {
 	    dp.seconds = dfltsecs;
 	}
-	m_delaypats.push_back(dp);
+	m_delaypats.add(dp);
 	LOGDEB2("rclmon::readDelayPats: add ["  << (dp.pattern) << "] "  << (dp.seconds) << "\n" );
     }
 }
 
-// Insert event (as queue iterator) into delays list, in time order,
-// We DO NOT take care of duplicate qits. erase should be called first
-// when necessary.
+// Insert event into the delays heap, according to its minclock.
+// We DO NOT take care of duplicates: this must only be called for a
+// new m_dqueue entry, or after popping the previous heap entry.
 void RclEQData::delayInsert(const queue_type::iterator &qit)
 {
     MONDEB("RclEQData::delayInsert: minclock " << qit->second.m_minclock <<
            std::endl);
-    for (delays_type::iterator dit = m_delays.begin(); 
-	 dit != m_delays.end(); dit++) {
-	queue_type::iterator qit1 = *dit;
-	if ((*qit1).second.m_minclock > qit->second.m_minclock) {
-	    m_delays.insert(dit, qit);
-	    return;
-	}
-    }
-    m_delays.push_back(qit);
+    m_delays.push(DelayEntry{qit->second.m_minclock, qit->first});
 }
 
 RclMonEventQueue::RclMonEventQueue()
@@ -223,6 +297,11 @@ void RclMonEventQueue::setopts(int opts)
 	m_data->m_opts = opts;
 }
 
+int RclMonEventQueue::getopts()
+{
+    return m_data ? m_data->m_opts : 0;
+}
+
 /** Wait until there is something to process on the queue, or timeout.
  *  returns a queue lock
  */
@@ -266,6 +345,27 @@ RclConfig *RclMonEventQueue::getConfig()
     return m_data->m_config;
 }
 
+void RclMonEventQueue::noteOverflow()
+{
+    std::unique_lock<std::mutex> lock(m_data->m_mutex);
+    m_data->m_stats.overflows++;
+}
+
+void RclMonEventQueue::noteRescanned(size_t files)
+{
+    std::unique_lock<std::mutex> lock(m_data->m_mutex);
+    m_data->m_stats.rescanned += files;
+}
+
+RclMonQueueStats RclMonEventQueue::getStats()
+{
+    std::unique_lock<std::mutex> lock(m_data->m_mutex);
+    RclMonQueueStats stats = m_data->m_stats;
+    stats.iqueuesize = m_data->m_iqueue.size();
+    stats.dqueuesize = m_data->m_dqueue.size();
+    return stats;
+}
+
 bool RclMonEventQueue::ok()
 {
     if (m_data == 0) {
@@ -298,9 +398,9 @@ bool RclMonEventQueue::empty()
 	MONDEB("RclMonEventQueue::empty(): true (m_data==0)\n");
 	return true;
     }
-    if (!m_data->m_iqueue.empty()) {
+    if (!m_data->m_iqueue.empty() || !m_data->m_rescans.empty()) {
 	MONDEB("RclMonEventQueue::empty(): false (m_iqueue not empty)\n");
-	return true;
+	return false;
     }
     if (m_data->m_dqueue.empty()) {
 	MONDEB("RclMonEventQueue::empty(): true (m_Xqueue both empty)\n");
@@ -308,10 +408,9 @@ bool RclMonEventQueue::empty()
     }
     // Only dqueue has events. Have to check the delays (only the
     // first, earliest one):
-    queue_type::iterator qit = *(m_data->m_delays.begin());
-    if (qit->second.m_minclock > time(0)) {
+    if (m_data->m_delays.top().minclock > time(0)) {
 	MONDEB("RclMonEventQueue::empty(): true (no delay ready " << 
-               qit->second.m_minclock << ")\n");
+               m_data->m_delays.top().minclock << ")\n");
 	return true;
     }
     MONDEB("RclMonEventQueue::empty(): returning false (delay expired)\n");
@@ -329,28 +428,42 @@ RclMonEvent RclMonEventQueue::pop()
     // Look at the delayed events, get rid of the expired/unactive
     // ones, possibly return an expired/needidx one.
     while (!m_data->m_delays.empty()) {
-	delays_type::iterator dit = m_data->m_delays.begin();
-	queue_type::iterator qit = *dit;
+	const DelayEntry& top = m_data->m_delays.top();
 	MONDEB("RclMonEventQueue::pop(): in delays: evt minclock " << 
-		qit->second.m_minclock << std::endl);
-	if (qit->second.m_minclock <= now) {
-	    if (qit->second.m_needidx) {
-		RclMonEvent ev = qit->second;
-		qit->second.m_minclock = time(0) + qit->second.m_itvsecs;
-		qit->second.m_needidx = false;
-		m_data->m_delays.erase(dit);
-		m_data->delayInsert(qit);
-		return ev;
-	    } else {
-		// Delay elapsed without new update, get rid of event.
-		m_data->m_dqueue.erase(qit);
-		m_data->m_delays.erase(dit);
-	    }
-	} else {
+		top.minclock << std::endl);
+	if (top.minclock > now) {
 	    // This and following events are for later processing, we
 	    // are done with the delayed event list.
 	    break;
-	}
+        }
+        queue_type::iterator qit = m_data->m_dqueue.find(top.path);
+        m_data->m_delays.pop();
+        if (qit == m_data->m_dqueue.end()) {
+            LOGERR("RclMonEventQueue::pop: delayed entry not in queue\n");
+            continue;
+        }
+        if (qit->second.m_needidx) {
+            RclMonEvent ev = qit->second;
+            qit->second.m_minclock = time(0) + qit->second.m_itvsecs;
+            qit->second.m_needidx = false;
+            m_data->delayInsert(qit);
+            m_data->m_stats.popped++;
+            return ev;
+        } else {
+            // Delay elapsed without new update, get rid of event.
+            m_data->m_dqueue.erase(qit);
+            m_data->m_stats.expired++;
+        }
+    }
+
+    // Rescan requests
+    if (!m_data->m_rescans.empty()) {
+        RclMonEvent ev;
+        ev.m_path = *m_data->m_rescans.begin();
+        ev.m_etyp = RclMonEvent::RCLEVT_RESCAN;
+        m_data->m_rescans.erase(m_data->m_rescans.begin());
+        m_data->m_stats.popped++;
+        return ev;
     }
 
     // Look for non-delayed event 
@@ -358,6 +471,7 @@ RclMonEvent RclMonEventQueue::pop()
 	queue_type::iterator qit = m_data->m_iqueue.begin();
 	RclMonEvent ev = qit->second;
 	m_data->m_iqueue.erase(qit);
+        m_data->m_stats.popped++;
 	return ev;
     }
 
@@ -372,12 +486,24 @@ RclMonEvent RclMonEventQueue::pop()
 bool RclMonEventQueue::pushEvent(const RclMonEvent &ev)
 {
     MONDEB("RclMonEventQueue::pushEvent for " << ev.m_path << std::endl);
-    std::unique_lock<std::mutex> lock(m_data->m_mutex);
-
+    if (ev.evtype() == RclMonEvent::RCLEVT_RESCAN) {
+        std::unique_lock<std::mutex> lock(m_data->m_mutex);
+        m_data->m_stats.pushed++;
+        m_data->m_stats.rescans++;
+        if (!m_data->m_rescans.insert(ev.m_path).second)
+            m_data->m_stats.coalesced++;
+        m_data->m_cond.notify_all();
+        return true;
+    }
+    // Look up the patterns before locking, this does not use the queue
     DelayPat pat = m_data->searchDelayPats(ev.m_path);
+
+    std::unique_lock<std::mutex> lock(m_data->m_mutex);
+    m_data->m_stats.pushed++;
     if (pat.seconds != 0) {
 	// Using delayed reindex queue. Need to take care of minclock and also
-	// insert into the in-minclock-order list
+	// insert into the in-minclock-order heap
+	m_data->m_stats.delayed++;
 	queue_type::iterator qit = m_data->m_dqueue.find(ev.m_path);
 	if (qit == m_data->m_dqueue.end()) {
 	    // Not there yet, insert new
@@ -385,7 +511,7 @@ bool RclMonEventQueue::pushEvent(const RclMonEvent &ev)
 		m_data->m_dqueue.insert(queue_type::value_type(ev.m_path, ev)).first;
 	    // Set the time to next index to "now" as it has not been
 	    // indexed recently (otherwise it would still be in the
-	    // queue), and add the iterator to the delay queue.
+	    // queue), and add the entry to the delays heap.
 	    qit->second.m_minclock = time(0);
 	    qit->second.m_needidx = true;
 	    qit->second.m_itvsecs = pat.seconds;
@@ -393,21 +519,187 @@ bool RclMonEventQueue::pushEvent(const RclMonEvent &ev)
 	} else {
 	    // Already in queue. Possibly update type but save minclock
 	    // (so no need to touch m_delays). Flag as needing indexing
+	    if (qit->second.m_needidx)
+                m_data->m_stats.coalesced++;
 	    time_t saved_clock = qit->second.m_minclock;
+	    int saved_itv = qit->second.m_itvsecs;
 	    qit->second = ev;
 	    qit->second.m_minclock = saved_clock;
+	    qit->second.m_itvsecs = saved_itv;
 	    qit->second.m_needidx = true;
 	}
     } else {
 	// Immediate event: just insert it, erasing any previously
 	// existing entry
-	m_data->m_iqueue[ev.m_path] = ev;
+        auto ret = m_data->m_iqueue.insert(queue_type::value_type(ev.m_path, ev));
+        if (!ret.second) {
+            ret.first->second = ev;
+            m_data->m_stats.coalesced++;
+        }
     }
 
     m_data->m_cond.notify_all();
     return true;
 }
 
+// Subtree rescans, requested after monitor events were lost. The
+// tree is processed in steps, so that the normal events are not
+// delayed too much: each step reads directories until it has a batch
+// of files, which it passes to indexfiles() (the index up to date
+// check (Db::needUpdate()) makes this cheap for the unchanged files),
+// and walks a chunk of the index entries for the tree, to purge the
+// files which do not exist any more.
+
+// Maximum files per batch and minimum seconds between batches
+static const unsigned int rescanbatch = 1000;
+static const int rescaninterval = 2;
+
+// Read one directory: list its files, and queue its subdirectories
+class RescanWalkCB : public FsTreeWalkerCB {
+public:
+    RescanWalkCB(RclConfig *conf, FsTreeWalker& walker,
+                 list<string>& files, vector<string>& dirs)
+        : m_config(conf), m_walker(walker), m_files(files), m_dirs(dirs) {}
+    virtual FsTreeWalker::Status 
+    processone(const string &fn, const struct stat *, 
+               FsTreeWalker::CbFlag flg) {
+        if (flg == FsTreeWalker::FtwDirEnter) {
+            // The first call is for the directory being read
+            if (m_first) {
+                m_first = false;
+                m_config->setKeyDir(fn);
+                m_walker.setSkippedNames(m_config->getSkippedNames());
+                m_files.push_back(fn);
+            } else {
+                m_dirs.push_back(fn);
+            }
+        } else if (flg == FsTreeWalker::FtwRegular) {
+            m_files.push_back(fn);
+        }
+        return stopindexing ? FsTreeWalker::FtwStop : FsTreeWalker::FtwOk;
+    }
+private:
+    RclConfig *m_config;
+    FsTreeWalker& m_walker;
+    list<string>& m_files;
+    vector<string>& m_dirs;
+    bool m_first{true};
+};
+
+class RescanQueue {
+public:
+    void add(const string& top) {
+        m_pending.insert(top);
+    }
+    bool empty() const {
+        return m_pending.empty() && m_dirs.empty() && !m_purging;
+    }
+    // Process the next step. Returns false for an indexing error.
+    bool processBatch(RclConfig *conf);
+private:
+    // Trees waiting to be processed. A new request for the tree being
+    // processed is queued, because events may have been lost for
+    // files we already checked.
+    std::set<string> m_pending;
+    // Current tree
+    string m_top;
+    // Walker, kept for the whole tree (it remembers the directories
+    // seen when following symbolic links)
+    std::unique_ptr<FsTreeWalker> m_walker;
+    // Directories still to be read
+    vector<string> m_dirs;
+    // Index walk for the purge: still running, and position
+    bool m_purging{false};
+    string m_resume;
+    bool startTree(RclConfig *conf, const string& top);
+    bool purgeChunk(RclConfig *conf);
+};
+
+bool RescanQueue::startTree(RclConfig *conf, const string& top)
+{
+    LOGINFO("Monitor: rescanning " << top << "\n");
+    // The purge lists the index entries through a separate read-only
+    // Db, which only sees the committed documents: commit the session
+    // first.
+    if (!commitIdxSession(conf, true))
+        return false;
+    m_top = top;
+    m_walker = std::unique_ptr<FsTreeWalker>(new FsTreeWalker);
+    m_walker->setSkippedPaths(conf->getDaemSkippedPaths());
+    bool follow = false;
+    conf->setKeyDir(top);
+    conf->getConfParam("followLinks", &follow);
+    m_walker->setOpts((follow ? FsTreeWalker::FtwFollow :
+                       FsTreeWalker::FtwOptNone) | FsTreeWalker::FtwNoRecurse);
+    m_dirs.push_back(top);
+    m_purging = true;
+    m_resume.clear();
+    return true;
+}
+
+// Purge the index entries for files which disappeared, for the next
+// chunk of the tree index entries.
+bool RescanQueue::purgeChunk(RclConfig *conf)
+{
+    vector<string> indexed;
+    bool atend;
+    if (!subtreelist(conf, m_top, m_resume, rescanbatch, indexed, &atend)) {
+        m_purging = false;
+        return true;
+    }
+    if (atend)
+        m_purging = false;
+    list<string> deleted;
+    for (const auto& path : indexed) {
+        if (!path_exists(path))
+            deleted.push_back(path);
+    }
+    if (!deleted.empty()) {
+        LOGDEB("Monitor: rescan: purging " << deleted.size() << " files\n");
+        return purgefiles(conf, deleted);
+    }
+    return true;
+}
+
+bool RescanQueue::processBatch(RclConfig *conf)
+{
+    if (m_dirs.empty() && !m_purging) {
+        if (m_pending.empty())
+            return true;
+        string top = *m_pending.begin();
+        m_pending.erase(m_pending.begin());
+        if (!startTree(conf, top))
+            return false;
+    }
+
+    // Read directories until we have a batch of files. The last
+    // directory read may make it a bit bigger.
+    list<string> batch;
+    while (!m_dirs.empty() && batch.size() < rescanbatch && !stopindexing) {
+        string dir = m_dirs.back();
+        m_dirs.pop_back();
+        RescanWalkCB cb(conf, *m_walker, batch, m_dirs);
+        m_walker->walk(dir, cb);
+    }
+    if (m_dirs.empty() && m_walker) {
+        if (m_walker->getErrCnt() > 0) {
+            LOGINFO("Monitor: rescan walker errors: " <<
+                    m_walker->getReason() << "\n");
+        }
+        m_walker.reset();
+    }
+    if (!batch.empty()) {
+        size_t cnt = batch.size();
+        if (!indexfiles(conf, batch))
+            return false;
+        rclEQ.noteRescanned(cnt);
+    }
+
+    if (m_purging)
+        return purgeChunk(conf);
+    return true;
+}
+
 static bool checkfileanddelete(const string& fname)
 {
     bool ret;
@@ -446,6 +738,23 @@ static bool expeditedIndexingRequested(RclConfig *conf)
     return found;
 }
 
+static void logQueueStats(bool atexit)
+{
+    RclMonQueueStats st = rclEQ.getStats();
+    std::ostringstream msg;
+    msg << "Monitor: queue stats: pushed " << st.pushed << " coalesced " <<
+        st.coalesced << " delayed " << st.delayed << " popped " <<
+        st.popped << " expired " << st.expired << " overflows " <<
+        st.overflows << " rescans " << st.rescans << " rescanned files " <<
+        st.rescanned << " queued " <<
+        st.iqueuesize << " + " << st.dqueuesize << " delayed\n";
+    if (atexit) {
+        LOGINFO(msg.str());
+    } else {
+        LOGDEB0(msg.str());
+    }
+}
+
 bool startMonitor(RclConfig *conf, int opts)
 {
     if (!conf->getConfParam("monauxinterval", &auxinterval))
@@ -456,6 +765,10 @@ bool startMonitor(RclConfig *conf, int opts)
     rclEQ.setConfig(conf);
     rclEQ.setopts(opts);
 
+    // Keep the index open and the filters warm between batches. The
+    // index is committed according to the moncommitXX parameters.
+    startIdxSession(conf);
+
     std::thread treceive(rclMonRcvRun, &rclEQ);
     treceive.detach();
     
@@ -468,6 +781,10 @@ bool startMonitor(RclConfig *conf, int opts)
     bool didsomething = false;
     list<string> modified;
     list<string> deleted;
+    // Deleted directories, the subtree entries are listed at purge time
+    list<string> deldirs;
+    RescanQueue rescans;
+    time_t lastrescantime = 0;
 
     while (true) {
         time_t now = time(0);
@@ -507,23 +824,22 @@ bool startMonitor(RclConfig *conf, int opts)
                     LOGDEB0("Monitor: Modify/Check on "  << ev.m_path << "\n");
                     modified.push_back(ev.m_path);
                     break;
+                case RclMonEvent::RCLEVT_RESCAN:
+                    LOGDEB0("Monitor: Rescan on "  << ev.m_path << "\n");
+                    rescans.add(ev.m_path);
+                    break;
                 case RclMonEvent::RCLEVT_DELETE:
                     LOGDEB0("Monitor: Delete on "  << (ev.m_path) << "\n" );
                     // If this is for a directory (which the caller should
                     // tell us because he knows), we should purge the db
                     // of all the subtree, because on a directory rename,
                     // inotify will only generate one event for the
-                    // renamed top, not the subentries. This is relatively
-                    // complicated to do though, and we currently do not
-                    // do it, and just wait for a restart to do a full run and
-                    // purge.
+                    // renamed top, not the subentries. The subtree is
+                    // listed from the index when purging (not here, we
+                    // hold the queue lock).
                     deleted.push_back(ev.m_path);
                     if (ev.evflags() & RclMonEvent::RCLEVT_ISDIR) {
-                        vector<string> paths;
-                        if (subtreelist(conf, ev.m_path, paths)) {
-                            deleted.insert(deleted.end(),
-                                           paths.begin(), paths.end());
-                        }
+                        deldirs.push_back(ev.m_path);
                     }
                     break;
                 default:
@@ -535,12 +851,29 @@ bool startMonitor(RclConfig *conf, int opts)
         now = time(0);
 	// Process. We don't do this every time but let the lists accumulate
         // a little, this saves processing. Start at once if list is big.
-        if (expeditedIndexingRequested(conf) ||
+        bool expedite = expeditedIndexingRequested(conf);
+        if (expedite ||
 	    (now - lastixtime > ixinterval) || 
 	    (deleted.size() + modified.size() > 20)) {
             lastixtime = now;
 	    // Used to do the modified list first, but it does seem
 	    // smarter to make room first...
+            if (!deldirs.empty()) {
+                // subtreelist() uses its own read-only Db, which only
+                // sees the committed documents: commit the session
+                // first, else the files indexed since the last commit
+                // would not be purged.
+                if (!commitIdxSession(conf, true))
+                    break;
+                for (const auto& dir : deldirs) {
+                    vector<string> paths;
+                    if (subtreelist(conf, dir, paths)) {
+                        deleted.insert(deleted.end(),
+                                       paths.begin(), paths.end());
+                    }
+                }
+                deldirs.clear();
+            }
             if (!deleted.empty()) {
                 deleted.sort();
                 deleted.unique();
@@ -557,7 +890,19 @@ bool startMonitor(RclConfig *conf, int opts)
                 modified.clear();
                 didsomething = true;
             }
+            logQueueStats(false);
+        }
+        // Advance the rescans, if any, after the normal events.
+        if (!rescans.empty() && now - lastrescantime >= rescaninterval) {
+            lastrescantime = now;
+            if (!rescans.processBatch(conf))
+                break;
+            didsomething = true;
         }
+        // Commit if the policy says so, or at once if the user is
+        // waiting for the result.
+        if (!commitIdxSession(conf, expedite))
+            break;
 
 	// Recreate the auxiliary dbs every hour at most.
         now = time(0);
@@ -579,11 +924,14 @@ bool startMonitor(RclConfig *conf, int opts)
 	    // change. -n was added by the reexec after the initial
 	    // pass even if it was not given on the command line
 	    o_reexec->removeArg("-n");
+            endIdxSession(conf);
 	    o_reexec->reexec();
 	}
     }
     LOGDEB("Rclmonprc: calling queue setTerminate\n" );
     rclEQ.setTerminate();
+    endIdxSession(conf);
+    logQueueStats(true);
 
     // We used to wait for the receiver thread here before returning,
     // but this is not useful and may waste time / risk problems
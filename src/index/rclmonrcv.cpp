@@ -21,14 +21,27 @@
 #include <errno.h>
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include "safesysstat.h"
 #include "safeunistd.h"
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
 
 #include "log.h"
 #include "rclmon.h"
 #include "rclinit.h"
 #include "fstreewalk.h"
 #include "pathut.h"
+#include "smallut.h"
+#include "md5.h"
 
 /**
  * Recoll real time monitor event receiver. This file has code to interface 
@@ -57,6 +70,190 @@ public:
 // need for a 'kind' parameter
 static RclMonitor *makeMonitor();
 
+/**
+ * Persisted list of the watched directories.
+ *
+ * Walking the trees to set the watches at startup is slow for big
+ * trees, so we save the list of watched directories with their
+ * device, inode and modification time. On restart, the directories
+ * with unchanged properties just get their watch, and only the
+ * modified ones are read again (to find new subdirectories and
+ * files).
+ *
+ * The recorded mtime is the one seen before the directory was read,
+ * so that an out of date snapshot can only cause more re-reading,
+ * not missed directories. The snapshot is only used if the
+ * configuration did not change.
+ */
+struct DirSig {
+    unsigned long long dev;
+    unsigned long long ino;
+    long long mtime;
+};
+
+class WatchSnapshot {
+public:
+    WatchSnapshot(RclConfig *conf);
+    bool enabled() const {
+        return m_enabled;
+    }
+    /** Record a watched directory */
+    void add(const string& path, const struct stat *st);
+    /** Forget a deleted or moved directory and its descendants */
+    void eraseSubTree(const string& top);
+    /** Read the saved list. False if there is none or if it was
+     * made with a different configuration. @param savedtime is set
+     * to the time the list was saved. */
+    bool load(vector<std::pair<string, DirSig> >& entries,
+              time_t *savedtime);
+    /** Save the current list, if it changed */
+    bool save();
+    time_t lastSave() const {
+        return m_lastsave;
+    }
+    bool dirty() const {
+        return m_dirty;
+    }
+private:
+    bool m_enabled{true};
+    string m_path;
+    string m_confsig;
+    std::map<string, DirSig> m_dirs;
+    bool m_dirty{false};
+    time_t m_lastsave{0};
+};
+
+static const string cstr_snaphdr("recollmonwatches 1 ");
+
+WatchSnapshot::WatchSnapshot(RclConfig *conf)
+{
+    conf->getConfParam("monwatchsnapshot", &m_enabled);
+    m_path = path_cat(conf->getCacheDir(), "monwatches.txt");
+
+    // The configuration signature: the watched trees and the
+    // recoll.conf files properties, including the system default
+    // one. Any change means walking again.
+    string sig;
+    vector<string> tdl = conf->getTopdirs(true);
+    for (const auto& dir : tdl) {
+        sig += dir + "\n";
+    }
+    vector<string> cdirs{conf->getConfDir()};
+    const char *cp;
+    if ((cp = getenv("RECOLL_CONFTOP")))
+        cdirs.push_back(cp);
+    if ((cp = getenv("RECOLL_CONFMID")))
+        cdirs.push_back(cp);
+    cdirs.push_back(path_cat(conf->getDatadir(), "examples"));
+    for (const auto& dir : cdirs) {
+        string fn = path_cat(dir, "recoll.conf");
+        struct stat st;
+        if (path_fileprops(fn, &st) == 0) {
+            sig += fn + " " + lltodecstr(st.st_mtime) + " " +
+                lltodecstr(st.st_size) + "\n";
+        }
+    }
+    string digest;
+    MD5String(sig, digest);
+    MD5HexPrint(digest, m_confsig);
+}
+
+void WatchSnapshot::add(const string& path, const struct stat *st)
+{
+    if (!m_enabled || nullptr == st)
+        return;
+    DirSig& sig = m_dirs[path];
+    sig.dev = st->st_dev;
+    sig.ino = st->st_ino;
+    sig.mtime = st->st_mtime;
+    m_dirty = true;
+}
+
+void WatchSnapshot::eraseSubTree(const string& top)
+{
+    auto it = m_dirs.lower_bound(top);
+    while (it != m_dirs.end() && it->first.compare(0, top.size(), top) == 0) {
+        if (it->first.size() == top.size() || it->first[top.size()] == '/') {
+            it = m_dirs.erase(it);
+            m_dirty = true;
+        } else {
+            it++;
+        }
+    }
+}
+
+bool WatchSnapshot::load(vector<std::pair<string, DirSig> >& entries,
+                         time_t *savedtime)
+{
+    if (!m_enabled)
+        return false;
+    struct stat st;
+    if (path_fileprops(m_path, &st) != 0)
+        return false;
+    *savedtime = st.st_mtime;
+    std::ifstream input(m_path.c_str(), std::ios::in);
+    if (!input.is_open())
+        return false;
+    string line;
+    if (!std::getline(input, line) || line != cstr_snaphdr + m_confsig) {
+        LOGINFO("rclMonRcvRun: watch snapshot absent or from different "
+                "configuration, not used\n");
+        return false;
+    }
+    while (std::getline(input, line)) {
+        // dev ino mtime path
+        const char *cp = line.c_str();
+        char *ep;
+        DirSig sig;
+        sig.dev = strtoull(cp, &ep, 10);
+        sig.ino = strtoull(ep, &ep, 10);
+        sig.mtime = strtoll(ep, &ep, 10);
+        if (*ep != ' ' || ep[1] != '/') {
+            LOGERR("rclMonRcvRun: bad line in watch snapshot: " << line <<
+                   "\n");
+            entries.clear();
+            return false;
+        }
+        entries.push_back({string(ep+1), sig});
+    }
+    return true;
+}
+
+bool WatchSnapshot::save()
+{
+    if (!m_enabled || !m_dirty)
+        return true;
+    string tmp = m_path + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::out | std::ios::trunc);
+        if (!out.is_open()) {
+            LOGSYSERR("WatchSnapshot::save", "open", tmp);
+            return false;
+        }
+        out << cstr_snaphdr << m_confsig << "\n";
+        for (const auto& ent : m_dirs) {
+            if (ent.first.find('\n') != string::npos)
+                continue;
+            out << ent.second.dev << " " << ent.second.ino << " " <<
+                ent.second.mtime << " " << ent.first << "\n";
+        }
+        out.close();
+        if (!out) {
+            LOGERR("WatchSnapshot::save: write failed for " << tmp << "\n");
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp.c_str(), m_path.c_str()) != 0) {
+        LOGSYSERR("WatchSnapshot::save", "rename", tmp);
+        unlink(tmp.c_str());
+        return false;
+    }
+    m_dirty = false;
+    m_lastsave = time(0);
+    return true;
+}
+
 /** 
  * Create directory watches during the initial file system tree walk.
  *
@@ -68,11 +265,42 @@ static RclMonitor *makeMonitor();
 class WalkCB : public FsTreeWalkerCB {
 public:
     WalkCB(RclConfig *conf, RclMonitor *mon, RclMonEventQueue *queue,
-           FsTreeWalker& walker)
-        : m_config(conf), m_mon(mon), m_queue(queue), m_walker(walker)
+           FsTreeWalker& walker, WatchSnapshot *snap = nullptr)
+        : m_config(conf), m_mon(mon), m_queue(queue), m_walker(walker),
+          m_snap(snap)
         {}
     virtual ~WalkCB() {}
 
+    // Only set the watches, don't generate events for the files
+    void setWatchOnly(bool onoff) {
+        m_watchonly = onoff;
+    }
+    // Check and reset the flag telling that the monitor lost events
+    // while we were flushing.
+    bool takeOverflow() {
+        bool ret = m_overflow;
+        m_overflow = false;
+        return ret;
+    }
+
+    // Transfer the pending monitor events to the queue. Returns false
+    // if the monitor is not usable any more.
+    bool flushEvents() {
+        while (m_queue->ok() && m_mon->ok()) {
+            RclMonEvent ev;
+            if (m_mon->getEvent(ev, 0)) {
+                if (ev.evtype() == RclMonEvent::RCLEVT_OVERFLOW)
+                    m_overflow = true;
+                else if (ev.m_etyp !=  RclMonEvent::RCLEVT_NONE)
+                    m_queue->pushEvent(ev);
+            } else {
+                MONDEB("rclMonRcvRun: no event pending\n");
+                break;
+            }
+        }
+        return m_mon && m_mon->ok();
+    }
+
     virtual FsTreeWalker::Status 
     processone(const string &fn, const struct stat *st, 
                FsTreeWalker::CbFlag flg) {
@@ -89,25 +317,17 @@ public:
         if (flg == FsTreeWalker::FtwDirEnter) {
             // Create watch when entering directory, but first empty
             // whatever events we may already have on queue
-            while (m_queue->ok() && m_mon->ok()) {
-                RclMonEvent ev;
-                if (m_mon->getEvent(ev, 0)) {
-                    if (ev.m_etyp !=  RclMonEvent::RCLEVT_NONE)
-                        m_queue->pushEvent(ev);
-                } else {
-                    MONDEB("rclMonRcvRun: no event pending\n");
-                    break;
-                }
-            }
-            if (!m_mon || !m_mon->ok())
+            if (!flushEvents())
                 return FsTreeWalker::FtwError;
             // We do nothing special if addWatch fails for a reasonable reason
             if (!m_mon->addWatch(fn, true)) {
                 if (m_mon->saved_errno != EACCES && 
                     m_mon->saved_errno != ENOENT)
                     return FsTreeWalker::FtwError;
+            } else if (m_snap) {
+                m_snap->add(fn, st);
             }
-        } else if (!m_mon->generatesExist() && 
+        } else if (!m_watchonly && !m_mon->generatesExist() && 
                    flg == FsTreeWalker::FtwRegular) {
             // Have to synthetize events for regular files existence
             // at startup because the monitor does not do it
@@ -134,8 +354,240 @@ private:
     RclMonitor        *m_mon;
     RclMonEventQueue  *m_queue;
     FsTreeWalker&      m_walker;
+    WatchSnapshot     *m_snap;
+    bool               m_watchonly{false};
+    bool               m_overflow{false};
+};
+
+/**
+ * Callback for re-reading a directory which was modified since the
+ * snapshot was saved (non-recursive walk). Subdirectories which are
+ * not in the snapshot are collected for a full walk, and events are
+ * generated for the files if the monitor does not do it.
+ */
+class RewalkCB : public FsTreeWalkerCB {
+public:
+    RewalkCB(RclMonitor *mon, RclMonEventQueue *queue,
+             const std::unordered_set<string>& known, vector<string>& newdirs)
+        : m_mon(mon), m_queue(queue), m_known(known), m_newdirs(newdirs)
+        {}
+    virtual FsTreeWalker::Status 
+    processone(const string &fn, const struct stat *, 
+               FsTreeWalker::CbFlag flg) {
+        if (flg == FsTreeWalker::FtwDirEnter) {
+            // This is also called for the top directory, which is known
+            if (m_known.find(fn) == m_known.end())
+                m_newdirs.push_back(fn);
+        } else if (flg == FsTreeWalker::FtwRegular &&
+                   !m_mon->generatesExist()) {
+            RclMonEvent ev;
+            ev.m_path = fn;
+            ev.m_etyp = RclMonEvent::RCLEVT_MODIFY;
+            m_queue->pushEvent(ev);
+        }
+        return FsTreeWalker::FtwOk;
+    }
+private:
+    RclMonitor *m_mon;
+    RclMonEventQueue *m_queue;
+    const std::unordered_set<string>& m_known;
+    vector<string>& m_newdirs;
 };
 
+static void setWalkerFollow(RclConfig& lconfig, FsTreeWalker& walker,
+                            int extraopts = 0)
+{
+    bool follow = false;
+    lconfig.getConfParam("followLinks", &follow);
+    walker.setOpts((follow ? FsTreeWalker::FtwFollow :
+                    FsTreeWalker::FtwOptNone) | extraopts);
+}
+
+// List the regular files in dir which were modified or changed
+// (e.g. extended attributes) at or after time since.
+static void changedFiles(const string& dir, time_t since, vector<string>& out)
+{
+    DIR *d = opendir(dir.c_str());
+    if (nullptr == d)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr) {
+        const char *name = ent->d_name;
+        if (name[0] == '.' &&
+            (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN)
+            continue;
+#endif
+        struct stat st;
+        if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+            S_ISREG(st.st_mode) &&
+            (st.st_mtime >= since || st.st_ctime >= since)) {
+            out.push_back(path_cat(dir, name));
+        }
+    }
+    closedir(d);
+}
+
+// Set the watches from the saved snapshot. The directories are
+// checked in parallel, which is where the time goes for big trees
+// (stat I/O), then the watches are set, and the modified directories
+// read again. Directories restored are added to @param known, the
+// trees under them are not walked.
+//
+// If the initial indexing pass was skipped (-n), the files inside
+// the unchanged directories are also checked, for modifications in
+// place since the snapshot was saved (while we were not running).
+// Else the indexing pass has just checked them: no need to stat them
+// all again.
+static bool restoreWatches(RclConfig& lconfig, RclMonitor *mon,
+                           RclMonEventQueue *queue, FsTreeWalker& walker,
+                           WalkCB& walkcb, WatchSnapshot& snap,
+                           std::unordered_set<string>& known)
+{
+    vector<std::pair<string, DirSig> > entries;
+    time_t savedtime;
+    if (!snap.load(entries, &savedtime) || entries.empty())
+        return true;
+    LOGINFO("rclMonRcvRun: restoring " << entries.size() <<
+            " watches from snapshot\n");
+
+    // States: 0 gone or replaced, 1 unchanged, 2 modified
+    vector<char> states(entries.size());
+    vector<struct stat> stats(entries.size());
+    int nthreads = std::thread::hardware_concurrency();
+    nthreads = std::max(1, std::min(nthreads, 16));
+    // Files changed inside unchanged directories, per thread
+    bool checkfiles = !mon->generatesExist() &&
+        (queue->getopts() & RCLMON_NOINITIAL);
+    vector<vector<string> > changed(nthreads);
+    std::atomic<size_t> next(0);
+    auto checker = [&] (int thr) {
+        for (size_t i = next++; i < entries.size(); i = next++) {
+            struct stat& st = stats[i];
+            const DirSig& sig = entries[i].second;
+            if (path_fileprops(entries[i].first, &st, true) != 0 ||
+                !S_ISDIR(st.st_mode) || (unsigned long long)st.st_dev !=
+                sig.dev || (unsigned long long)st.st_ino != sig.ino) {
+                states[i] = 0;
+            } else {
+                states[i] = st.st_mtime == sig.mtime ? 1 : 2;
+                if (states[i] == 1 && checkfiles)
+                    changedFiles(entries[i].first, savedtime, changed[thr]);
+            }
+        }
+    };
+    vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.push_back(std::thread(checker, i));
+    }
+    for (auto& thr : threads) {
+        thr.join();
+    }
+
+    // Set the watches. The monitor interface is not thread-safe, but
+    // the inodes are now cached, so this is fast.
+    vector<string> modified;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (states[i] == 0)
+            continue;
+        const string& dir = entries[i].first;
+        if (!walkcb.flushEvents())
+            return false;
+        if (!mon->addWatch(dir, true)) {
+            if (mon->saved_errno != EACCES && mon->saved_errno != ENOENT)
+                return false;
+            continue;
+        }
+        known.insert(dir);
+        snap.add(dir, &stats[i]);
+        if (states[i] == 2)
+            modified.push_back(dir);
+    }
+    size_t changedcnt = 0;
+    for (const auto& files : changed) {
+        for (const auto& fn : files) {
+            RclMonEvent ev;
+            ev.m_path = fn;
+            ev.m_etyp = RclMonEvent::RCLEVT_MODIFY;
+            queue->pushEvent(ev);
+        }
+        changedcnt += files.size();
+    }
+
+    // Read the modified directories again
+    vector<string> newdirs;
+    RewalkCB rewalkcb(mon, queue, known, newdirs);
+    FsTreeWalker shallow;
+    shallow.setSkippedPaths(lconfig.getDaemSkippedPaths());
+    for (const auto& dir : modified) {
+        lconfig.setKeyDir(dir);
+        setWalkerFollow(lconfig, shallow, FsTreeWalker::FtwNoRecurse);
+        shallow.setSkippedNames(lconfig.getSkippedNames());
+        if (shallow.walk(dir, rewalkcb) != FsTreeWalker::FtwOk) {
+            LOGERR("rclMonRcvRun: reading " << dir << " : " <<
+                   shallow.getReason() << "\n");
+        }
+    }
+    // And walk the new subdirectories
+    for (const auto& dir : newdirs) {
+        lconfig.setKeyDir(dir);
+        setWalkerFollow(lconfig, walker);
+        if (walker.walk(dir, walkcb) != FsTreeWalker::FtwOk) {
+            LOGERR("rclMonRcvRun: tree walk failed for " << dir << "\n");
+            return false;
+        }
+    }
+    LOGINFO("rclMonRcvRun: restored " << known.size() << " watches, " <<
+            modified.size() << " directories modified, " << newdirs.size() <<
+            " new, " << changedcnt << " files changed in place\n");
+    return true;
+}
+
+// Recover from a monitor events loss (inotify queue overflow). We
+// don't know what was affected. Directories created in the meantime
+// have no watch, so walk the trees again to set them (this is cheap
+// for the directories already watched, which keep their watch), then
+// ask for a rescan of the files. The processing side throttles this,
+// and merges repeated requests.
+static bool recoverOverflow(RclConfig& lconfig, RclMonEventQueue *queue,
+                            FsTreeWalker& walker, WalkCB& walkcb,
+                            const vector<string>& tdl)
+{
+    LOGINFO("rclMonRcvRun: events lost, restoring the watches and "
+            "requesting a rescan of the monitored trees\n");
+    queue->noteOverflow();
+    vector<string> dirs;
+    for (const auto& dir : tdl) {
+        if (path_isdir(dir))
+            dirs.push_back(dir);
+    }
+    bool ok = true;
+    walkcb.setWatchOnly(true);
+    for (const auto& dir : dirs) {
+        lconfig.setKeyDir(dir);
+        setWalkerFollow(lconfig, walker);
+        if (walker.walk(dir, walkcb) != FsTreeWalker::FtwOk) {
+            LOGERR("rclMonRcvRun: tree walk failed for " << dir << " : " <<
+                   walker.getReason() << "\n");
+            ok = false;
+            break;
+        }
+    }
+    walkcb.setWatchOnly(false);
+    for (const auto& dir : dirs) {
+        RclMonEvent rev;
+        rev.m_path = dir;
+        rev.m_etyp = RclMonEvent::RCLEVT_RESCAN;
+        queue->pushEvent(rev);
+    }
+    return ok;
+}
+
+// Seconds between saves of the watch snapshot, if it changed
+static const int snapsaveinterval = 600;
+
 // Main thread routine: create watches, then forever wait for and queue events
 void *rclMonRcvRun(void *q)
 {
@@ -169,7 +621,15 @@ void *rclMonRcvRun(void *q)
     // Walk the directory trees to add watches
     FsTreeWalker walker;
     walker.setSkippedPaths(lconfig.getDaemSkippedPaths());
-    WalkCB walkcb(&lconfig, mon, queue, walker);
+    WatchSnapshot snap(&lconfig);
+    WalkCB walkcb(&lconfig, mon, queue, walker, &snap);
+    // Directories for which the watch was set from the snapshot
+    std::unordered_set<string> known;
+    if (snap.enabled() && !restoreWatches(lconfig, mon, queue, walker, walkcb,
+                                          snap, known)) {
+        LOGERR("rclMonRcvRun: setting watches from snapshot failed\n");
+        goto terminate;
+    }
     for (auto it = tdl.begin(); it != tdl.end(); it++) {
         lconfig.setKeyDir(*it);
         // Adjust the follow symlinks options
@@ -188,6 +648,10 @@ void *rclMonRcvRun(void *q)
             continue;
         }
         if (S_ISDIR(st.st_mode)) {
+            if (known.find(*it) != known.end()) {
+                LOGDEB("rclMonRcvRun: " << *it << " restored from snapshot\n");
+                continue;
+            }
             LOGDEB("rclMonRcvRun: walking "  << *it << "\n");
             if (walker.walk(*it, walkcb) != FsTreeWalker::FtwOk) {
                 LOGERR("rclMonRcvRun: tree walk failed\n");
@@ -218,17 +682,36 @@ void *rclMonRcvRun(void *q)
         }
     }
 
+    snap.save();
+
     // Forever wait for monitoring events and add them to queue:
     MONDEB("rclMonRcvRun: waiting for events. q->ok(): " << queue->ok() <<
            std::endl);
     while (queue->ok() && mon->ok()) {
+        // Save the watch list from time to time: we may not get a
+        // chance to do it when exiting.
+        if (snap.dirty() && time(0) - snap.lastSave() > snapsaveinterval) {
+            snap.save();
+        }
         RclMonEvent ev;
         // Note: I could find no way to get the select
         // call to return when a signal is delivered to the process
         // (it goes to the main thread, from which I tried to close or
         // write to the select fd, with no effect). So set a 
         // timeout so that an intr will be detected
+        // Events may also have been lost while we were walking
+        // trees and flushing the monitor queue.
+        if (walkcb.takeOverflow()) {
+            if (!recoverOverflow(lconfig, queue, walker, walkcb, tdl))
+                goto terminate;
+            continue;
+        }
         if (mon->getEvent(ev, 2000)) {
+            if (ev.evtype() == RclMonEvent::RCLEVT_OVERFLOW) {
+                if (!recoverOverflow(lconfig, queue, walker, walkcb, tdl))
+                    goto terminate;
+                continue;
+            }
             // Don't push events for skipped files. This would get
             // filtered on the processing side anyway, but causes
             // unnecessary wakeups and messages. Do not test
@@ -260,20 +743,36 @@ void *rclMonRcvRun(void *q)
                 }
             }
 
+            if (ev.evtype() == RclMonEvent::RCLEVT_DELETE &&
+                (ev.evflags() & RclMonEvent::RCLEVT_ISDIR)) {
+                snap.eraseSubTree(ev.m_path);
+            }
+
             if (ev.m_etyp !=  RclMonEvent::RCLEVT_NONE)
                 queue->pushEvent(ev);
         }
     }
 
 terminate:
+    snap.save();
     queue->setTerminate();
     LOGINFO("rclMonRcvRun: monrcv thread routine returning\n");
     return 0;
 }
 
-// Utility routine used by both the fam/gamin and inotify versions to get 
-// rid of the id-path translation for a moved dir
-bool eraseWatchSubTree(map<int, string>& idtopath, const string& top)
+// We dont compile both the inotify and the fam interface and inotify
+// has preference
+#ifndef RCL_USE_INOTIFY
+#ifdef RCL_USE_FAM
+//////////////////////////////////////////////////////////////////////////
+/** Fam/gamin -based monitor class */
+#include <fam.h>
+#include <sys/select.h>
+#include <setjmp.h>
+#include <signal.h>
+
+// Get rid of the id-path translation for a moved dir
+static bool eraseWatchSubTree(map<int, string>& idtopath, const string& top)
 {
     bool found = false;
     MONDEB("Clearing map for [" << top << "]\n");
@@ -289,17 +788,6 @@ bool eraseWatchSubTree(map<int, string>& idtopath, const string& top)
     return found;
 }
 
-// We dont compile both the inotify and the fam interface and inotify
-// has preference
-#ifndef RCL_USE_INOTIFY
-#ifdef RCL_USE_FAM
-//////////////////////////////////////////////////////////////////////////
-/** Fam/gamin -based monitor class */
-#include <fam.h>
-#include <sys/select.h>
-#include <setjmp.h>
-#include <signal.h>
-
 /** FAM based monitor class. We have to keep a record of FAM watch
     request numbers to directory names as the event only contain the
     request number and file name, not the full path */
@@ -524,6 +1012,183 @@ bool RclFAM::getEvent(RclMonEvent& ev, int msecs)
 #include <sys/inotify.h>
 #include <sys/select.h>
 
+/** Watch descriptor to directory path translation for inotify. The
+ *  directory nodes only store their name and parent, and the paths
+ *  are computed when an event needs one. This way, erasing or moving
+ *  a directory only touches its subtree instead of scanning all the
+ *  watches, which matters with hundreds of thousands of them. */
+class WatchTable {
+public:
+    /** Record the watch for path. inotify returns the same wd when a
+     *  directory is watched again after being moved: the node is
+     *  then relinked under its new parent and its subtree follows. */
+    void add(int wd, const string& path);
+    /** Compute the path for wd. Returns false if wd is unknown */
+    bool path(int wd, string& out) const;
+    /** Forget wd and all the directories below it */
+    bool eraseSubTree(int wd);
+    /** Same, for the directory designated by path */
+    bool eraseSubTree(const string& path);
+    size_t size() const {
+        return m_wdtonode.size();
+    }
+private:
+    struct Node {
+        int wd{-1};
+        int parent{-1};
+        // Simple name, or full path for a node with no watched parent
+        string name;
+        // Simple name to node. Hashed: directories can be very wide.
+        std::unordered_map<string, int> children;
+    };
+    vector<Node> m_nodes;
+    vector<int> m_free;
+    std::unordered_map<int, int> m_wdtonode;
+    // Full path to node for the top nodes
+    std::unordered_map<string, int> m_roots;
+
+    int find(const string& path) const;
+    int child(int parent, const string& name) const;
+    void unlink(int node);
+    void eraseNodes(int node);
+};
+
+int WatchTable::child(int parent, const string& name) const
+{
+    const auto& children = m_nodes[parent].children;
+    auto it = children.find(name);
+    return it == children.end() ? -1 : it->second;
+}
+
+int WatchTable::find(const string& path) const
+{
+    auto it = m_roots.find(path);
+    if (it != m_roots.end())
+        return it->second;
+    string::size_type pos = path.find_last_of('/');
+    if (pos == string::npos || pos == path.size() - 1)
+        return -1;
+    int parent = find(pos == 0 ? string("/") : path.substr(0, pos));
+    if (parent < 0)
+        return -1;
+    return child(parent, path.substr(pos + 1));
+}
+
+void WatchTable::unlink(int node)
+{
+    Node& n = m_nodes[node];
+    if (n.parent >= 0) {
+        auto& siblings = m_nodes[n.parent].children;
+        auto it = siblings.find(n.name);
+        if (it != siblings.end() && it->second == node)
+            siblings.erase(it);
+        n.parent = -1;
+    } else {
+        auto it = m_roots.find(n.name);
+        if (it != m_roots.end() && it->second == node)
+            m_roots.erase(it);
+    }
+}
+
+void WatchTable::add(int wd, const string& path)
+{
+    int node;
+    auto it = m_wdtonode.find(wd);
+    if (it != m_wdtonode.end()) {
+        node = it->second;
+        unlink(node);
+    } else {
+        if (m_free.empty()) {
+            node = int(m_nodes.size());
+            m_nodes.emplace_back();
+        } else {
+            node = m_free.back();
+            m_free.pop_back();
+        }
+        m_nodes[node].wd = wd;
+        m_wdtonode[wd] = node;
+    }
+
+    // A different watch for the same path means that the directory
+    // was replaced: the old subtree is stale.
+    int old = find(path);
+    if (old >= 0 && old != node) {
+        unlink(old);
+        eraseNodes(old);
+    }
+
+    string::size_type pos = path.find_last_of('/');
+    int parent = -1;
+    if (pos != string::npos && pos != path.size() - 1) {
+        parent = find(pos == 0 ? string("/") : path.substr(0, pos));
+    }
+    Node& n = m_nodes[node];
+    n.parent = parent;
+    if (parent >= 0) {
+        n.name = path.substr(pos + 1);
+        m_nodes[parent].children[n.name] = node;
+    } else {
+        n.name = path;
+        m_roots[path] = node;
+    }
+}
+
+bool WatchTable::path(int wd, string& out) const
+{
+    auto it = m_wdtonode.find(wd);
+    if (it == m_wdtonode.end())
+        return false;
+    vector<int> chain;
+    for (int node = it->second; node >= 0; node = m_nodes[node].parent) {
+        chain.push_back(node);
+    }
+    out = m_nodes[chain.back()].name;
+    for (auto rit = chain.rbegin() + 1; rit != chain.rend(); rit++) {
+        path_catslash(out);
+        out += m_nodes[*rit].name;
+    }
+    return true;
+}
+
+// Free the node and its descendants. The top node must be unlinked already
+void WatchTable::eraseNodes(int top)
+{
+    vector<int> todo{top};
+    while (!todo.empty()) {
+        int node = todo.back();
+        todo.pop_back();
+        Node& n = m_nodes[node];
+        for (const auto& entry : n.children) {
+            todo.push_back(entry.second);
+        }
+        m_wdtonode.erase(n.wd);
+        n = Node();
+        m_free.push_back(node);
+    }
+}
+
+bool WatchTable::eraseSubTree(int wd)
+{
+    auto it = m_wdtonode.find(wd);
+    if (it == m_wdtonode.end())
+        return false;
+    int node = it->second;
+    unlink(node);
+    eraseNodes(node);
+    return true;
+}
+
+bool WatchTable::eraseSubTree(const string& path)
+{
+    MONDEB("WatchTable: clearing [" << path << "]\n");
+    int node = find(path);
+    if (node < 0)
+        return false;
+    unlink(node);
+    eraseNodes(node);
+    return true;
+}
+
 class RclIntf : public RclMonitor {
 public:
     RclIntf()
@@ -548,9 +1213,11 @@ public:
 private:
     bool m_ok;
     int m_fd;
-    map<int,string> m_idtopath; // Watch descriptor to name
-#define EVBUFSIZE (32*1024)
-    char m_evbuf[EVBUFSIZE]; // Event buffer
+    WatchTable m_watches; // Watch descriptor to name
+    // Event buffer. A big one lets us drain a burst of events with
+    // few reads. Must be aligned for accessing the event structures.
+#define EVBUFSIZE (256*1024)
+    alignas(struct inotify_event) char m_evbuf[EVBUFSIZE];
     char *m_evp; // Pointer to next event or 0
     char *m_ep;  // Pointer to end of events
     const char *event_name(int code);
@@ -622,7 +1289,7 @@ bool RclIntf::addWatch(const string& path, bool)
         }
         return false;
     }
-    m_idtopath[wd] = path;
+    m_watches.add(wd, path);
     return true;
 }
 
@@ -678,12 +1345,18 @@ bool RclIntf::getEvent(RclMonEvent& ev, int msecs)
     if (m_evp >= m_ep)
         m_evp = m_ep = 0;
     
-    map<int,string>::const_iterator it;
-    if ((it = m_idtopath.find(evp->wd)) == m_idtopath.end()) {
+    if (evp->mask & IN_Q_OVERFLOW) {
+        // The kernel queue overflowed, events were lost. There is no
+        // watch descriptor, we can't know what was affected.
+        LOGERR("RclIntf::getEvent: inotify queue overflow\n");
+        ev.m_etyp = RclMonEvent::RCLEVT_OVERFLOW;
+        return true;
+    }
+
+    if (!m_watches.path(evp->wd, ev.m_path)) {
         LOGERR("RclIntf::getEvent: unknown wd " << evp->wd << "\n");
         return true;
     }
-    ev.m_path = it->second;
 
     if (evp->len > 0) {
         ev.m_path = path_cat(ev.m_path, evp->name);
@@ -694,12 +1367,12 @@ bool RclIntf::getEvent(RclMonEvent& ev, int msecs)
 
     if ((evp->mask & IN_MOVED_FROM) && (evp->mask & IN_ISDIR)) {
         // We get this when a directory is renamed. Erase the subtree
-        // entries in the map. The subsequent MOVED_TO will recreate
+        // entries in the table. The subsequent MOVED_TO will recreate
         // them. This is probably not needed because the watches
         // actually still exist in the kernel, so that the wds
         // returned by future addwatches will be the old ones, and the
-        // map will be updated in place. But still, this feels safer
-        eraseWatchSubTree(m_idtopath, ev.m_path);
+        // nodes would just be relinked. But still, this feels safer
+        m_watches.eraseSubTree(ev.m_path);
     }
 
     // IN_ATTRIB used to be not needed, but now it is
@@ -719,10 +1392,8 @@ bool RclIntf::getEvent(RclMonEvent& ev, int msecs)
             ev.m_etyp = RclMonEvent::RCLEVT_MODIFY;
         }
     } else if (evp->mask & (IN_IGNORED)) {
-        if (!m_idtopath.erase(evp->wd)) {
+        if (!m_watches.eraseSubTree(evp->wd)) {
             LOGDEB0("Got IGNORE event for unknown watch\n");
-        } else {
-            eraseWatchSubTree(m_idtopath, ev.m_path);
         }
     } else {
         LOGDEB("RclIntf::getEvent: unhandled event " << event_name(evp->mask) <<
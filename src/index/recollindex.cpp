@@ -122,14 +122,16 @@ class MyUpdater : public DbIxStatusUpdater {
     virtual bool update() 
     {
 	// Update the status file. Avoid doing it too often. Always do
-	// it at the end (status DONE)
+	// it at the end (status DONE) and after a monitor commit.
 	if (status.phase == DbIxStatus::DBIXS_DONE || 
-            status.phase != m_prevphase || m_chron.millis() > 300) {
+            status.phase != m_prevphase || status.commits != m_prevcommits ||
+            m_chron.millis() > 300) {
             if (status.totfiles < status.filesdone ||
                 status.phase == DbIxStatus::DBIXS_DONE) {
                 status.totfiles = status.filesdone;
             }
 	    m_prevphase = status.phase;
+	    m_prevcommits = status.commits;
 	    m_chron.restart();
             m_file.holdWrites(true);
             m_file.set("phase", int(status.phase));
@@ -140,6 +142,16 @@ class MyUpdater : public DbIxStatusUpdater {
 	    m_file.set("totfiles", status.totfiles);
 	    m_file.set("fn", status.fn);
             m_file.set("hasmonitor", status.hasmonitor);
+            if (status.commits) {
+                m_file.set("commits", status.commits);
+                string lat;
+                for (auto cnt : status.commitlatency) {
+                    if (!lat.empty())
+                        lat += " ";
+                    lat += lltodecstr(cnt);
+                }
+                m_file.set("commitlatency", lat);
+            }
             m_file.holdWrites(false);
 	}
         if (path_exists(m_stopfilename)) {
@@ -171,6 +183,7 @@ private:
     string m_stopfilename;
     Chrono m_chron;
     DbIxStatus::Phase m_prevphase;
+    int m_prevcommits{0};
 };
 static MyUpdater *updater;
 
@@ -307,8 +320,11 @@ bool recursive_index(RclConfig *config, const string& top,
 //
 // This is called either from the command line or from the monitor. In
 // this case we're called repeatedly in the same process, and the
-// confindexer is only created once by makeIndexerOrExit (but the db closed and
-// flushed every time)
+// confindexer is only created once by makeIndexerOrExit. The monitor
+// runs an indexing session (startIdxSession()): the db then stays open
+// between calls, and is only committed by commitIdxSession(), according
+// to the moncommitXX parameters. Otherwise the db is closed and flushed
+// every time.
 bool indexfiles(RclConfig *config, list<string> &filenames)
 {
     if (filenames.empty())
@@ -349,6 +365,24 @@ bool createAuxDbs(RclConfig *config)
     return true;
 }
 
+void startIdxSession(RclConfig *config)
+{
+    makeIndexerOrExit(config, (op_flags & OPT_Z) != 0);
+    confindexer->startSession();
+}
+
+bool commitIdxSession(RclConfig *config, bool force)
+{
+    makeIndexerOrExit(config, (op_flags & OPT_Z) != 0);
+    return confindexer->sessionCommit(force);
+}
+
+bool endIdxSession(RclConfig *config)
+{
+    makeIndexerOrExit(config, (op_flags & OPT_Z) != 0);
+    return confindexer->endSession();
+}
+
 // Create additional stem database 
 static bool createstemdb(RclConfig *config, const string &lang)
 {
@@ -872,6 +906,9 @@ int main(int argc, char **argv)
 	    deleteZ(confindexer);
 #ifndef _WIN32
 	    o_reexec->insertArgs(vector<string>(1, "-n"));
+	    // Let the monitor know that this -n is not from the user:
+	    // the files were just checked.
+	    setenv("RECOLL_MONINITIALDONE", "1", 1);
 	    LOGINFO("recollindex: reexecuting with -n after initial full "
                     "pass\n");
 	    // Note that -n will be inside the reexec when we come
@@ -888,6 +925,11 @@ int main(int argc, char **argv)
 	    updater->update();
 	}
 	int opts = RCLMON_NONE;
+	if ((op_flags & OPT_n) && !getenv("RECOLL_MONINITIALDONE"))
+	    opts |= RCLMON_NOINITIAL;
+#ifndef _WIN32
+	unsetenv("RECOLL_MONINITIALDONE");
+#endif
 	if (op_flags & OPT_D)
 	    opts |= RCLMON_NOFORK;
 	if (op_flags & OPT_C)
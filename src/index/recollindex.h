@@ -26,6 +26,14 @@ extern bool indexfiles(RclConfig *config, std::list<std::string> &filenames);
 extern bool purgefiles(RclConfig *config, std::list<std::string> &filenames);
 extern bool createAuxDbs(RclConfig *config);
 
+/** Long-lived writer session used by the monitor: the index stays open
+ * between indexfiles()/purgefiles() calls, and is committed by
+ * commitIdxSession() according to the configured policy (or always if
+ * force is set). */
+extern void startIdxSession(RclConfig *config);
+extern bool commitIdxSession(RclConfig *config, bool force = false);
+extern bool endIdxSession(RclConfig *config);
+
 /** 
  * Helper method for executing the recoll-we (new WebExtensions plugin) helper
  * script. This moves files from the browser download directory (only
@@ -57,6 +57,53 @@ bool subtreelist(RclConfig *config, const string& top,
     return true;
 }
 
+bool subtreelist(RclConfig *config, const string& top, string& resume,
+                 size_t max, vector<string>& paths, bool *atend)
+{
+    LOGDEB("subtreelist: top: [" << top << "] resume [" << resume << "]\n");
+    *atend = false;
+    Rcl::Db rcldb(config);
+    if (!rcldb.open(Rcl::Db::DbRO)) {
+	LOGERR("subtreelist: can't open database in [" <<
+               config->getDbDir() << "]: " << rcldb.getReason() << "\n");
+	return false;
+    }
+
+    // The file UDIs are the path followed by "|" and the ipath (empty
+    // for the file itself), hashed if too long. Walking the UDI terms
+    // lists the subtree in index order, in limited steps.
+    string pfx(top);
+    path_catslash(pfx);
+    string last(resume);
+    vector<string> udis;
+    if (!rcldb.udiTreeList(pfx, resume, max, udis))
+        return false;
+    if (udis.empty()) {
+        *atend = true;
+        return true;
+    }
+    for (const auto& udi : udis) {
+        if (udi.back() == '|') {
+            paths.push_back(udi.substr(0, udi.size() - 1));
+            last = udi;
+            continue;
+        }
+        // Subdocument of the previous file ?
+        if (!last.empty() && last.back() == '|' &&
+            !udi.compare(0, last.size(), last))
+            continue;
+        // Hashed UDI for a long path (or orphan subdocument): get the
+        // path from the document.
+        Rcl::Doc doc;
+        if (rcldb.getDoc(udi, string(), doc) && doc.pc != -1) {
+            string path = fileurltolocalpath(doc.url);
+            if (!path.empty() && (paths.empty() || paths.back() != path))
+                paths.push_back(path);
+        }
+    }
+    return true;
+}
+
 #else // TEST
 
 
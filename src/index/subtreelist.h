@@ -30,4 +30,12 @@ class RclConfig;
 extern bool subtreelist(RclConfig *config, const string& top, 
 			std::vector<std::string>& paths); 
 
+// Same, but walking the index by chunks of at most max entries, for
+// processing big trees by steps. resume is the position in the index
+// (empty at the start), it is updated. atend is set when there are no
+// more entries. Each file is listed once, not once per subdocument.
+extern bool subtreelist(RclConfig *config, const std::string& top,
+                        std::string& resume, size_t max,
+                        std::vector<std::string>& paths, bool *atend);
+
 #endif /* _SUBTREELIST_H_INCLUDED_ */
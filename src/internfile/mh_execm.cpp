@@ -32,8 +32,18 @@ using namespace std;
 #include "idfile.h"
 
 #include <sys/types.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 #include "safesyswait.h"
 
+MimeHandlerExecMultiple::MimeHandlerExecMultiple(RclConfig *cnf,
+                                                 const std::string& id)
+    : MimeHandlerExec(cnf, id)
+{
+    m_config->getConfParam("filtermaxinstances", &m_maxinstances);
+}
+
 bool MimeHandlerExecMultiple::startCmd()
 {
     LOGDEB("MimeHandlerExecMultiple::startCmd\n");
@@ -61,6 +71,12 @@ bool MimeHandlerExecMultiple::startCmd()
     m_adv.setmaxsecs(m_filtermaxseconds);
     m_cmd.setAdvise(&m_adv);
 
+    m_filesdone = 0;
+    m_maxfiles = 0;
+    m_config->getConfParam("filtermaxfiles", &m_maxfiles);
+    m_maxrssmbs = 0;
+    m_config->getConfParam("filtermaxrssmbytes", &m_maxrssmbs);
+
     // Build parameter list: delete cmd name
     vector<string>myparams(params.begin() + 1, params.end());
 
@@ -72,6 +88,45 @@ bool MimeHandlerExecMultiple::startCmd()
     return true;
 }
 
+// Resident size of process in kbytes, or -1 if we can't know
+static int64_t processRssKb(pid_t pid)
+{
+#ifdef __linux__
+    string path = string("/proc/") + lltodecstr(pid) + "/statm";
+    FILE *fp = fopen(path.c_str(), "r");
+    if (nullptr == fp)
+        return -1;
+    long long size, rss;
+    int ret = fscanf(fp, "%lld %lld", &size, &rss);
+    fclose(fp);
+    if (ret != 2)
+        return -1;
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return -1;
+#endif
+}
+
+// Check if the filter process should be restarted before processing
+// a new file
+bool MimeHandlerExecMultiple::needRecycle()
+{
+    if (m_maxfiles > 0 && m_filesdone >= m_maxfiles) {
+        LOGDEB("MHExecMultiple: " << params.front() << " did " <<
+               m_filesdone << " files, restarting it\n");
+        return true;
+    }
+    if (m_maxrssmbs > 0) {
+        int64_t rsskb = processRssKb(m_cmd.getChildPid());
+        if (rsskb / 1024 > m_maxrssmbs) {
+            LOGDEB("MHExecMultiple: " << params.front() << " rss " <<
+                   rsskb / 1024 << " mbytes, restarting it\n");
+            return true;
+        }
+    }
+    return false;
+}
+
 // Note: data is not used if this is the "document:" field: it goes
 // directly to m_metaData[cstr_dj_keycontent] to avoid an extra copy
 // 
@@ -163,6 +218,9 @@ bool MimeHandlerExecMultiple::next_document()
 	return false;
     }
 
+    if (m_filefirst && m_cmd.getChildPid() > 0 && needRecycle()) {
+        m_cmd.zapChild();
+    }
     if (m_cmd.getChildPid() <= 0 && !startCmd()) {
         return false;
     }
@@ -190,6 +248,7 @@ bool MimeHandlerExecMultiple::next_document()
         obuf << "FileName: " << m_fn.length() << "\n" << m_fn;
         // m_filefirst is set to true by set_document_file()
         m_filefirst = false;
+        m_filesdone++;
     } else {
         obuf << "Filename: " << 0 << "\n";
     }
@@ -94,6 +94,11 @@ text/plainData: 10
  *   - Eofnext: empty field: file ends after the doc returned by this message.
  *   - SubdocError: no subdoc returned by this request, but file goes on.
  *   - FileError: error, stop for this file.
+ *
+ * Filter process recycling: the filter process is restarted, between
+ * files, after it has processed filtermaxfiles files, or if its
+ * resident size has grown beyond filtermaxrssmbytes (where this can
+ * be checked). This limits the effects of leaks in long-lived filters.
  */
 class MimeHandlerExecMultiple : public MimeHandlerExec {
     /////////
@@ -102,14 +107,18 @@ class MimeHandlerExecMultiple : public MimeHandlerExec {
     /////// End un-cleared stuff.
 
  public:
-    MimeHandlerExecMultiple(RclConfig *cnf, const std::string& id) 
-        : MimeHandlerExec(cnf, id) {
-    }
+    MimeHandlerExecMultiple(RclConfig *cnf, const std::string& id);
     // No resources to clean up, the ExecCmd destructor does it.
     virtual ~MimeHandlerExecMultiple() {}
 
     virtual bool next_document() override;
 
+    /** Maximum number of idle instances to keep in the handler cache
+     * (each has a running process). 0 for no limit. */
+    int maxIdleInstances() const {
+        return m_maxinstances;
+    }
+
     // skip_to and clear inherited from MimeHandlerExec
 
 protected:
@@ -122,9 +131,15 @@ protected:
 
 private:
     bool startCmd();
+    bool needRecycle();
     bool readDataElement(std::string& name, std::string& data);
     bool m_filefirst;
     int  m_maxmemberkb;
+    // Files processed by the current filter process, and recycling limits
+    int  m_filesdone{0};
+    int  m_maxfiles{0};
+    int  m_maxrssmbs{0};
+    int  m_maxinstances{0};
     MEAdv m_adv;
 };
 
@@ -48,6 +48,21 @@ using namespace std;
 static const int maxdepth = 20;
 static const string cstr_mail_charset("charset");
 
+// Compute the message md5 while the mime parser reads the file, so
+// that we only read it once.
+class MD5RawSink : public Binc::MimeRawDataSink {
+public:
+    MD5RawSink() {
+        MD5Init(&m_ctx);
+    }
+    virtual void rawData(const char *data, size_t cnt) {
+        MD5Update(&m_ctx, (const unsigned char*)data, cnt);
+        m_cnt += cnt;
+    }
+    MD5_CTX m_ctx;
+    int64_t m_cnt{0};
+};
+
 MimeHandlerMail::MimeHandlerMail(RclConfig *cnf, const string &id) 
     : RecollFilter(cnf, id), m_bincdoc(0), m_fd(-1), m_stream(0), m_idx(-1)
 {
@@ -93,16 +108,6 @@ bool MimeHandlerMail::set_document_file_impl(const string& mt, const string &fn)
         m_fd = -1;
     }
 
-    if (!m_forPreview) {
-        // Yes, we read the file twice. It would be possible in theory
-        // to add the md5 computation to the mime analysis, but ...
-        string md5, xmd5, reason;
-        if (MD5File(fn, md5, &reason)) {
-            m_metaData[cstr_dj_keymd5] = MD5HexPrint(md5, xmd5);
-        } else {
-            LOGERR("MimeHandlerMail: md5 [" << fn << "]: " << reason << "\n");
-        }
-    }
     m_fd = open(fn.c_str(), 0);
     if (m_fd < 0) {
         LOGERR("MimeHandlerMail::set_document_file: open(" << fn <<
@@ -116,11 +121,27 @@ bool MimeHandlerMail::set_document_file_impl(const string& mt, const string &fn)
 #endif
     delete m_bincdoc;
     m_bincdoc = new Binc::MimeDocument;
-    m_bincdoc->parseFull(m_fd);
+    MD5RawSink md5sink;
+    m_bincdoc->parseFull(m_fd, m_forPreview ? 0 : &md5sink);
     if (!m_bincdoc->isHeaderParsed() && !m_bincdoc->isAllParsed()) {
         LOGERR("MimeHandlerMail::mkDoc: mime parse error for " << fn << "\n");
         return false;
     }
+    if (!m_forPreview) {
+        // The parser reads the whole file, so we normally have the
+        // md5. Check this and fall back to reading the file again if
+        // there was a short read for some reason.
+        string md5, xmd5, reason;
+        struct stat st;
+        if (fstat(m_fd, &st) == 0 && md5sink.m_cnt == (int64_t)st.st_size) {
+            MD5Final(md5, &md5sink.m_ctx);
+            m_metaData[cstr_dj_keymd5] = MD5HexPrint(md5, xmd5);
+        } else if (MD5File(fn, md5, &reason)) {
+            m_metaData[cstr_dj_keymd5] = MD5HexPrint(md5, xmd5);
+        } else {
+            LOGERR("MimeHandlerMail: md5 [" << fn << "]: " << reason << "\n");
+        }
+    }
     m_havedoc = true;
     return true;
 }
@@ -19,13 +19,20 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include "safesysstat.h"
+#include "safeunistd.h"
 #include <time.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include <cstring>
+#include <algorithm>
 #include <map>
 #include <mutex>
+#include <unordered_map>
 
 #include "cstr.h"
 #include "mimehandler.h"
@@ -35,48 +42,45 @@
 #include "smallut.h"
 #include "rclconfig.h"
 #include "md5ut.h"
-#include "conftree.h"
+#include "pathut.h"
 
 using namespace std;
 
 // Define maximum message size for safety. 100MB would seem reasonable
 static const unsigned int max_mbox_member_size = 100 * 1024 * 1024;
 
-class FpKeeper { 
-public:
-    FpKeeper(FILE **fpp) : m_fpp(fpp) {}
-    ~FpKeeper() 
-    {
-        if (m_fpp && *m_fpp) {
-            fclose(*m_fpp);
-            *m_fpp = 0;
-        }
-    }
-private: FILE **m_fpp;
-};
-
 static std::mutex o_mcache_mutex;
 
 /**
  * Handles a cache for message numbers to offset translations. Permits direct
  * accesses inside big folders instead of having to scan up to the right place
  *
- * Message offsets are saved to files stored under cfg(mboxcachedir), default
- * confdir/mboxcache. Mbox files smaller than cfg(mboxcacheminmbs) are not
- * cached.
- * Cache files are named as the md5 of the file UDI, which is kept in
- * the first block for possible collision detection. The 64 bits
- * offsets for all message "From_" lines follow. The format is purely
- * binary, values are not even byte-swapped to be proc-idependant.
+ * The offsets for all folders are stored in a single file named
+ * 'mboxoffsets', under cfg(mboxcachedir), default confdir/mboxcache. Mbox
+ * files smaller than cfg(mboxcacheminmbs) are not cached.
+ *
+ * The file is only appended to: a new record for a folder supersedes the
+ * previous ones, and the file is rewritten when too much space is
+ * wasted. Readers map the file and keep an index from udi to record in
+ * memory, so that looking up an offset needs no file system access,
+ * except when the folder is not found or has changed. The files from
+ * the old one-file-per-folder format are deleted when the cache is
+ * first used.
+ *
+ * Record format. Values are in native byte order, like the old
+ * per-folder files, the cache is not meant to be portable:
+ *  - uint32 record length, including this field.
+ *  - 16 bytes: MD5 of the rest of the record.
+ *  - uint32 udi length, then the udi.
+ *  - int64 folder size. Records for another size are stale.
+ *  - uint32 offsets count.
+ *  - For each block of o_blksize offsets: the int64 offset of the first
+ *    message in the block and the uint32 position of the following
+ *    ones in the deltas area.
+ *  - Deltas area: the differences between successive offsets inside
+ *    each block, as varints.
  */
 
-#ifdef _WIN32
-// vc++ does not let define an array of size o_b1size because non-const??
-#define M_o_b1size 1024
-#else
-#define M_o_b1size o_b1size
-#endif
-
 class MboxCache {
 public:
     typedef MimeHandlerMbox::mbhoff_type mbhoff_type;
@@ -87,46 +91,33 @@ public:
         // have to make sure it's initialized.
     }
 
-    ~MboxCache() {}
-    mbhoff_type get_offset(RclConfig *config, const string& udi, int msgnum)
+    ~MboxCache() {
+        unmap();
+    }
+
+    mbhoff_type get_offset(RclConfig *config, const string& udi,
+                           mbhoff_type fsize, int msgnum)
     {
-        LOGDEB0("MboxCache::get_offsets: udi [" << (udi) << "] msgnum " << (msgnum) << "\n");
+        LOGDEB0("MboxCache::get_offset: udi [" << udi << "] msgnum " <<
+                msgnum << "\n");
         if (!ok(config)) {
-            LOGDEB0("MboxCache::get_offsets: init failed\n");
+            LOGDEB0("MboxCache::get_offset: init failed\n");
             return -1;
         }
         std::unique_lock<std::mutex> locker(o_mcache_mutex);
-        string fn = makefilename(udi);
-        FILE *fp = 0;
-        if ((fp = fopen(fn.c_str(), "r")) == 0) {
-            LOGDEB("MboxCache::get_offsets: open failed, errno " << (errno) << "\n");
-            return -1;
-        }
-        FpKeeper keeper(&fp);
-
-        char blk1[M_o_b1size];
-        if (fread(blk1, 1, o_b1size, fp) != o_b1size) {
-            LOGDEB0("MboxCache::get_offsets: read blk1 errno " << (errno) << "\n");
-            return -1;
-        }
-        ConfSimple cf(string(blk1, o_b1size));
-        string fudi;
-        if (!cf.get("udi", fudi) || fudi.compare(udi)) {
-            LOGINFO("MboxCache::get_offset:badudi fn " << (fn) << " udi [" << (udi) << "], fudi [" << (fudi) << "]\n");
-            return -1;
-        }
-        if (fseeko(fp, cacheoffset(msgnum), SEEK_SET) != 0) {
-            LOGDEB0("MboxCache::get_offsets: seek " << (lltodecstr(cacheoffset(msgnum))) << " errno " << (errno) << "\n");
-            return -1;
-        }
-        mbhoff_type offset = -1;
-        size_t ret;
-        if ((ret = fread(&offset, 1, sizeof(mbhoff_type), fp))
-            != sizeof(mbhoff_type)) {
-            LOGDEB0("MboxCache::get_offsets: read ret " << (ret) << " errno " << (errno) << "\n");
+        if (fsize < m_minfsize)
             return -1;
+        const char *rec = findrec(udi, fsize);
+        if (nullptr == rec) {
+            // Maybe the file was updated by another process
+            if (!remap() || nullptr == (rec = findrec(udi, fsize))) {
+                LOGDEB0("MboxCache::get_offset: no entry for [" << udi <<
+                        "]\n");
+                return -1;
+            }
         }
-        LOGDEB0("MboxCache::get_offsets: ret " << (lltodecstr(offset)) << "\n");
+        mbhoff_type offset = recoffset(rec, msgnum);
+        LOGDEB0("MboxCache::get_offset: ret " << lltodecstr(offset) << "\n");
         return offset;
     }
 
@@ -134,36 +125,36 @@ public:
     void put_offsets(RclConfig *config, const string& udi, mbhoff_type fsize,
                      vector<mbhoff_type>& offs)
     {
-        LOGDEB0("MboxCache::put_offsets: " << (offs.size()) << " offsets\n");
+        LOGDEB0("MboxCache::put_offsets: " << offs.size() << " offsets\n");
         if (!ok(config) || !maybemakedir())
             return;
+        std::unique_lock<std::mutex> locker(o_mcache_mutex);
         if (fsize < m_minfsize)
             return;
-        std::unique_lock<std::mutex> locker(o_mcache_mutex);
-        string fn = makefilename(udi);
-        FILE *fp;
-        if ((fp = fopen(fn.c_str(), "w")) == 0) {
-            LOGDEB("MboxCache::put_offsets: fopen errno " << (errno) << "\n");
+        const char *rec = findrec(udi, fsize);
+        if (rec && reccount(rec) == offs.size() && (offs.empty() ||
+                recoffset(rec, int(offs.size())) == offs.back())) {
+            // Already there
             return;
         }
-        FpKeeper keeper(&fp);
-        string blk1;
-        blk1.append("udi=");
-        blk1.append(udi);
-        blk1.append(cstr_newline);
-        blk1.resize(o_b1size, 0);
-        if (fwrite(blk1.c_str(), 1, o_b1size, fp) != o_b1size) {
-            LOGDEB("MboxCache::put_offsets: fwrite errno " << (errno) << "\n");
+        string data = makerecord(udi, fsize, offs);
+        string fn = path_cat(m_dir, o_filename);
+        int fd = open(fn.c_str(), O_WRONLY|O_APPEND|O_CREAT, 0600);
+        if (fd < 0) {
+            LOGDEB("MboxCache::put_offsets: open errno " << errno << "\n");
             return;
         }
-
-        for (vector<mbhoff_type>::const_iterator it = offs.begin();
-             it != offs.end(); it++) {
-            mbhoff_type off = *it;
-            if (fwrite((char*)&off, 1, sizeof(mbhoff_type), fp) != 
-                sizeof(mbhoff_type)) {
-                return;
-            }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            data.insert(0, o_magic);
+        }
+        // A single write, so that concurrent appenders don't mix their data.
+        if (write(fd, data.c_str(), data.size()) != ssize_t(data.size())) {
+            LOGDEB("MboxCache::put_offsets: write errno " << errno << "\n");
+        }
+        close(fd);
+        if (remap() && m_size > 2 * m_livesize + o_compactmin) {
+            compact();
         }
     }
 
@@ -183,6 +174,7 @@ public:
             m_minfsize = minmbs * 1000 * 1000;
 
             m_dir = config->getMboxcacheDir();
+            removeOldFiles();
             m_ok = true;
         }
         return m_ok;
@@ -195,7 +187,58 @@ private:
     string m_dir;
     // Don't cache smaller files. If -1, don't do anything.
     mbhoff_type m_minfsize;
-    static const size_t o_b1size;
+
+    // Current view of the offsets file
+    const char *m_base{nullptr};
+    size_t m_size{0};
+    bool m_mapped{false};
+    string m_data;
+    dev_t m_dev{0};
+    ino_t m_ino{0};
+    // Position of the last record for each udi, and if its checksum
+    // was verified.
+    struct RecRef {
+        size_t pos;
+        bool checked;
+    };
+    std::unordered_map<string, RecRef> m_recs;
+    // Total size of the current records
+    size_t m_livesize{0};
+
+    static const string o_filename;
+    static const string o_magic;
+    static const unsigned int o_blksize = 64;
+    static const size_t o_compactmin = 1024 * 1024;
+    // Fixed part of a record, before the udi
+    static const size_t o_hdrsize = 4 + 16 + 4;
+    // Checkpoint: offset and position in the deltas area
+    static const size_t o_cpsize = 8 + 4;
+
+    // Remove the per-folder files from the old cache format. They
+    // were named as the hex MD5 of the udi, and began with "udi=".
+    void removeOldFiles()
+    {
+        set<string> entries;
+        string reason;
+        if (!readdir(m_dir, reason, entries))
+            return;
+        for (const auto& entry : entries) {
+            if (entry.size() != 32 ||
+                entry.find_first_not_of("0123456789abcdef") != string::npos)
+                continue;
+            string fn = path_cat(m_dir, entry);
+            int fd = open(fn.c_str(), O_RDONLY);
+            if (fd < 0)
+                continue;
+            char hdr[4];
+            bool old = read(fd, hdr, 4) == 4 && !memcmp(hdr, "udi=", 4);
+            close(fd);
+            if (old) {
+                LOGDEB("MboxCache: removing old format file " << fn << "\n");
+                unlink(fn.c_str());
+            }
+        }
+    }
 
     // Create the cache directory if it does not exist
     bool maybemakedir()
@@ -206,23 +249,211 @@ private:
         }
         return true;
     }
-    // Compute file name from udi
-    string makefilename(const string& udi)
-    {
-        string digest, xdigest;
-        MD5String(udi, digest);
-        MD5HexPrint(digest, xdigest);
-        return path_cat(m_dir, xdigest);
+
+    template <class T> static void putval(string& out, T v) {
+        out.append((const char *)&v, sizeof(T));
+    }
+    template <class T> static T getval(const char *cp) {
+        T v;
+        memcpy(&v, cp, sizeof(T));
+        return v;
+    }
+
+    static string makerecord(const string& udi, mbhoff_type fsize,
+                             const vector<mbhoff_type>& offs) {
+        string checkpoints, deltas;
+        for (size_t i = 0; i < offs.size(); i++) {
+            if (i % o_blksize == 0) {
+                putval(checkpoints, int64_t(offs[i]));
+                putval(checkpoints, uint32_t(deltas.size()));
+            } else {
+                putVarint(deltas, uint64_t(offs[i] - offs[i-1]));
+            }
+        }
+        string body;
+        putval(body, uint32_t(udi.size()));
+        body += udi;
+        putval(body, int64_t(fsize));
+        putval(body, uint32_t(offs.size()));
+        body += checkpoints;
+        body += deltas;
+        string digest;
+        MD5String(body, digest);
+        string rec;
+        putval(rec, uint32_t(4 + digest.size() + body.size()));
+        rec += digest;
+        rec += body;
+        return rec;
+    }
+
+    // Record accessors. Records in the index passed the bounds checks
+    // in remap().
+    const char *recudi(const char *rec) {
+        return rec + o_hdrsize;
+    }
+    const char *recfixed(const char *rec) {
+        return rec + o_hdrsize + getval<uint32_t>(rec + 20);
+    }
+    uint32_t reclen(const char *rec) {
+        return getval<uint32_t>(rec);
+    }
+    mbhoff_type recfsize(const char *rec) {
+        return getval<int64_t>(recfixed(rec));
+    }
+    size_t reccount(const char *rec) {
+        return getval<uint32_t>(recfixed(rec) + 8);
+    }
+
+    // Offset for msgnum (starting at 1) inside a record
+    mbhoff_type recoffset(const char *rec, int msgnum) {
+        size_t cnt = reccount(rec);
+        if (msgnum < 1 || size_t(msgnum) > cnt)
+            return -1;
+        size_t idx = msgnum - 1;
+        const char *cps = recfixed(rec) + 12;
+        size_t nblocks = (cnt + o_blksize - 1) / o_blksize;
+        const char *dstart = cps + nblocks * o_cpsize;
+        const char *end = rec + reclen(rec);
+        if (dstart > end)
+            return -1;
+        const char *cp = cps + (idx / o_blksize) * o_cpsize;
+        mbhoff_type off = getval<int64_t>(cp);
+        cp = dstart + getval<uint32_t>(cp + 8);
+        for (size_t i = 0; i < idx % o_blksize; i++) {
+            uint64_t delta;
+            if (cp > end || !getVarint(cp, end, delta))
+                return -1;
+            off += mbhoff_type(delta);
+        }
+        return off;
     }
 
-    // Compute offset in cache file for the mbox offset of msgnum
-    mbhoff_type cacheoffset(int msgnum)
-    {// Msgnums are from 1
-        return o_b1size + (msgnum-1) * sizeof(mbhoff_type);
+    // Find the record for udi, checking its checksum on first use
+    const char *findrec(const string& udi, mbhoff_type fsize) {
+        auto it = m_recs.find(udi);
+        if (it == m_recs.end())
+            return nullptr;
+        const char *rec = m_base + it->second.pos;
+        if (!it->second.checked) {
+            string digest;
+            MD5String(string(rec + 20, reclen(rec) - 20), digest);
+            if (digest.compare(0, 16, rec + 4, 16)) {
+                LOGINFO("MboxCache: bad checksum for [" << udi << "]\n");
+                m_livesize -= reclen(rec);
+                m_recs.erase(it);
+                return nullptr;
+            }
+            it->second.checked = true;
+        }
+        return recfsize(rec) == fsize ? rec : nullptr;
+    }
+
+    void unmap() {
+#ifndef _WIN32
+        if (m_mapped) {
+            munmap((void *)m_base, m_size);
+        }
+#endif
+        m_mapped = false;
+        m_base = nullptr;
+        m_data.clear();
+        m_size = 0;
+        m_recs.clear();
+        m_livesize = 0;
+    }
+
+    // Access the current state of the offsets file and rebuild the
+    // index. Returns false if nothing changed or there is no data.
+    bool remap() {
+        string fn = path_cat(m_dir, o_filename);
+        struct stat st;
+        if (stat(fn.c_str(), &st) != 0) {
+            unmap();
+            return false;
+        }
+        if (m_base && st.st_dev == m_dev && st.st_ino == m_ino &&
+            size_t(st.st_size) == m_size) {
+            return false;
+        }
+        unmap();
+        m_dev = st.st_dev;
+        m_ino = st.st_ino;
+#ifndef _WIN32
+        int fd = open(fn.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                m_base = (const char *)addr;
+                m_size = st.st_size;
+                m_mapped = true;
+            }
+        }
+        close(fd);
+#endif
+        if (!m_mapped) {
+            if (!file_to_string(fn, m_data, -1, size_t(-1)))
+                return false;
+            m_base = m_data.c_str();
+            m_size = m_data.size();
+        }
+        if (m_size < o_magic.size() ||
+            o_magic.compare(0, o_magic.size(), m_base, o_magic.size())) {
+            LOGINFO("MboxCache: bad magic in " << fn << "\n");
+            unmap();
+            return false;
+        }
+        // Index the records. Stop at the first inconsistency, which
+        // would be an incomplete write.
+        size_t pos = o_magic.size();
+        while (m_size - pos >= o_hdrsize) {
+            const char *rec = m_base + pos;
+            size_t len = reclen(rec);
+            size_t udilen = getval<uint32_t>(rec + 20);
+            if (len > m_size - pos || len < o_hdrsize + udilen + 12)
+                break;
+            string udi(recudi(rec), udilen);
+            auto it = m_recs.find(udi);
+            if (it != m_recs.end()) {
+                m_livesize -= reclen(m_base + it->second.pos);
+            }
+            m_recs[udi] = RecRef{pos, false};
+            m_livesize += len;
+            pos += len;
+        }
+        return !m_recs.empty();
+    }
+
+    // Rewrite the file with only the current records
+    void compact() {
+        string fn = path_cat(m_dir, o_filename);
+        string tmp = fn + ".tmp";
+        LOGDEB("MboxCache::compact: size " << m_size << " live " <<
+               m_livesize << "\n");
+        string data(o_magic);
+        data.reserve(m_livesize + o_magic.size());
+        for (const auto& ent : m_recs) {
+            const char *rec = m_base + ent.second.pos;
+            data.append(rec, reclen(rec));
+        }
+        int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+        if (fd < 0) {
+            return;
+        }
+        bool ok = write(fd, data.c_str(), data.size()) == ssize_t(data.size());
+        close(fd);
+        if (!ok || rename(tmp.c_str(), fn.c_str()) != 0) {
+            LOGDEB("MboxCache::compact: failed, errno " << errno << "\n");
+            unlink(tmp.c_str());
+            return;
+        }
+        remap();
     }
 };
 
-const size_t MboxCache::o_b1size = 1024;
+const string MboxCache::o_filename("mboxoffsets");
+const string MboxCache::o_magic("RCLMBOF1");
 static class MboxCache o_mcache;
 
 static const string cstr_keyquirks("mhmboxquirks");
@@ -235,23 +466,30 @@ MimeHandlerMbox::~MimeHandlerMbox()
 void MimeHandlerMbox::clear_impl()
 {
     m_fn.erase();
+    m_ipath.erase();
+    closeFolder();
+}
+
+void MimeHandlerMbox::closeFolder()
+{
     if (m_vfp) {
 	fclose((FILE *)m_vfp);
 	m_vfp = 0;
     }
-    m_msgnum =  m_lineno = 0;
-    m_ipath.erase();
+    m_buf.clear();
+    m_bufoff = 0;
+    m_fsize = 0;
+    m_msgnum = 0;
+    m_pos = 0;
     m_offsets.clear();
+    m_offsetsdone = false;
 }
 
 bool MimeHandlerMbox::set_document_file_impl(const string& mt, const string &fn)
 {
     LOGDEB("MimeHandlerMbox::set_document_file(" << fn << ")\n");
+    closeFolder();
     m_fn = fn;
-    if (m_vfp) {
-	fclose((FILE *)m_vfp);
-	m_vfp = 0;
-    }
 
     m_vfp = fopen(fn.c_str(), "r");
     if (m_vfp == 0) {
@@ -273,8 +511,8 @@ bool MimeHandlerMbox::set_document_file_impl(const string& mt, const string &fn)
 	}
 	m_fsize = st.st_size;
     }
+
     m_havedoc = true;
-    m_offsets.clear();
     m_quirks = 0;
 
     // Check for location-based quirks:
@@ -296,19 +534,9 @@ bool MimeHandlerMbox::set_document_file_impl(const string& mt, const string &fn)
     return true;
 }
 
+// Max From_ line length we look at. Only the beginning of the line
+// matters for the regular expression.
 #define LL 1024
-typedef char line_type[LL+10];
-static inline void stripendnl(line_type& line, int& ll)
-{
-    ll = int(strlen(line));
-    while (ll > 0) {
-	if (line[ll-1] == '\n' || line[ll-1] == '\r') {
-	    line[ll-1] = 0;
-	    ll--;
-	} else 
-	    break;
-    }
-}
 
 // The mbox format uses lines beginning with 'From ' as separator.
 // Mailers are supposed to quote any other lines beginning with 
@@ -373,16 +601,210 @@ static const string miniTbirdFrom{"^From $"};
 static SimpleRegexp fromregex(frompat, SimpleRegexp::SRE_NOSUB);
 static SimpleRegexp minifromregex(miniTbirdFrom, SimpleRegexp::SRE_NOSUB);
 
+// Size of the folder reads, and data kept before the requested
+// offset, for looking back at the previous line.
+static const size_t readchunk = 1024 * 1024;
+static const size_t readback = 256;
+
+// Get the folder data at off. At least len bytes are available,
+// unless the end of file is hit, and *availp is set to the actual
+// count (which may be more than len). The pointer is only valid until
+// the next call.
+const char *MimeHandlerMbox::data(mbhoff_type off, size_t len, size_t *availp)
+{
+    *availp = 0;
+    if (off >= m_fsize)
+        return nullptr;
+    len = size_t(std::min(mbhoff_type(len), m_fsize - off));
+    mbhoff_type bufend = m_bufoff + mbhoff_type(m_buf.size());
+    if (off < m_bufoff || off + mbhoff_type(len) > bufend) {
+        mbhoff_type start = off > mbhoff_type(readback) ? off - readback : 0;
+        size_t cnt = size_t(std::min(
+            mbhoff_type(std::max(len + size_t(off - start), readchunk)),
+            m_fsize - start));
+        m_buf.resize(cnt);
+        FILE *fp = (FILE *)m_vfp;
+        size_t got = 0;
+        if (fseeko(fp, (off_t)start, SEEK_SET) >= 0)
+            got = fread(&m_buf[0], 1, cnt, fp);
+        m_buf.resize(got);
+        m_bufoff = start;
+        bufend = m_bufoff + mbhoff_type(m_buf.size());
+        if (got < cnt) {
+            // The folder was truncated while we were reading it. Act
+            // as if this was the end.
+            LOGINFO("MimeHandlerMbox: " << m_fn << " changed while "
+                    "reading, stopping at offset " << bufend << "\n");
+            m_fsize = bufend;
+            if (off >= m_fsize)
+                return nullptr;
+        }
+    }
+    *availp = size_t(bufend - off);
+    return m_buf.data() + (off - m_bufoff);
+}
+
+// Check if the line at off is a From_ line.
+bool MimeHandlerMbox::isFromLine(mbhoff_type off)
+{
+    size_t avail;
+    const char *cp = data(off, LL, &avail);
+    if (nullptr == cp)
+        return false;
+    size_t len = std::min(size_t(LL), avail);
+    const char *nl = (const char *)memchr(cp, '\n', len);
+    if (nl) {
+        len = nl - cp;
+    }
+    while (len > 0 && cp[len-1] == '\r') {
+        len--;
+    }
+    string line(cp, len);
+    return fromregex(line) ||
+        ((m_quirks & MBOXQUIRK_TBIRD) && minifromregex(line));
+}
+
+// Return the offset of the line following the one at off
+MimeHandlerMbox::mbhoff_type MimeHandlerMbox::lineEnd(mbhoff_type off)
+{
+    for (;;) {
+        size_t avail;
+        const char *cp = data(off, 1, &avail);
+        if (nullptr == cp)
+            return m_fsize;
+        const char *nl = (const char *)memchr(cp, '\n', avail);
+        if (nl)
+            return off + (nl - cp) + 1;
+        off += avail;
+    }
+}
+
+// Check if the line before the one at off is empty (only has '\r'
+// characters). The byte before off is a '\n'.
+bool MimeHandlerMbox::prevLineEmpty(mbhoff_type off)
+{
+    for (mbhoff_type i = off - 2; i >= 0; i--) {
+        size_t avail;
+        const char *cp = data(i, 1, &avail);
+        if (nullptr == cp)
+            return false;
+        if (*cp != '\r')
+            return *cp == '\n';
+    }
+    return true;
+}
+
+// Look for "\nFrom ". memmem() is typically vectorized and much
+// faster than looking at each line.
+static const char *findNlFrom(const char *cp, size_t len)
+{
+#ifndef _WIN32
+    return (const char *)memmem(cp, len, "\nFrom ", 6);
+#else
+    const char *end = cp + len;
+    while ((cp = (const char *)memchr(cp, '\n', end - cp))) {
+        if (end - cp >= 6 && !memcmp(cp + 1, "From ", 5))
+            return cp;
+        cp++;
+    }
+    return nullptr;
+#endif
+}
+
+// Return the offset of the first line beginning with "From " after
+// the one at off, or m_fsize.
+MimeHandlerMbox::mbhoff_type MimeHandlerMbox::nextFromCandidate(
+    mbhoff_type off)
+{
+    for (;;) {
+        size_t avail;
+        const char *cp = data(off, 6, &avail);
+        if (nullptr == cp || avail < 6)
+            return m_fsize;
+        const char *nl = findNlFrom(cp, avail);
+        if (nl)
+            return off + (nl - cp) + 1;
+        // Go on with the next chunk. Keep the possible beginning
+        // of a "\nFrom " at the end of this one.
+        off += avail - 5;
+    }
+}
+
+// Return the offset of the first From_ line starting at or after
+// off, which must be the beginning of a line, or m_fsize if there is
+// none. From_ lines must normally follow an empty line (or be at the
+// start of the file). Thunderbird sometimes omits the empty line, so
+// we don't check this in this case.
+MimeHandlerMbox::mbhoff_type MimeHandlerMbox::findFrom(mbhoff_type off)
+{
+    while (off < m_fsize) {
+        size_t avail;
+        const char *cp = data(off, 5, &avail);
+        if (cp && avail >= 5 && !memcmp(cp, "From ", 5)) {
+            bool hademptyline = true;
+            if (off > 0 && !(m_quirks & MBOXQUIRK_TBIRD)) {
+                hademptyline = prevLineEmpty(off);
+            }
+            if (hademptyline && isFromLine(off)) {
+                return off;
+            }
+        }
+        off = nextFromCandidate(off);
+    }
+    return m_fsize;
+}
+
+// Compute the offsets for all the From_ lines in the file, and
+// store them in the offsets cache.
+void MimeHandlerMbox::scanOffsets()
+{
+    m_offsets.clear();
+    for (mbhoff_type off = findFrom(0); off < m_fsize;
+         off = findFrom(lineEnd(off))) {
+        m_offsets.push_back(off);
+    }
+    m_offsetsdone = true;
+    if (!m_udi.empty()) {
+        o_mcache.put_offsets(m_config, m_udi, m_fsize, m_offsets);
+    }
+}
+
+// Set message text from the data in the folder. Line ends are
+// normalized to a single '\n' and the text ends with a newline.
+static void setMsgText(const char *cp, size_t len, string& out)
+{
+    out.clear();
+    if (len == 0)
+        return;
+    if (nullptr == memchr(cp, '\r', len)) {
+        out.assign(cp, len);
+    } else {
+        out.reserve(len);
+        const char *end = cp + len;
+        while (cp < end) {
+            const char *nl = (const char *)memchr(cp, '\n', end - cp);
+            const char *le = nl ? nl : end;
+            const char *lend = le;
+            while (lend > cp && lend[-1] == '\r')
+                lend--;
+            out.append(cp, lend - cp);
+            out += '\n';
+            cp = nl ? nl + 1 : end;
+        }
+    }
+    if (out.back() != '\n')
+        out += '\n';
+}
+
 bool MimeHandlerMbox::next_document()
 {
-    if (m_vfp == 0) {
+    if (m_vfp == nullptr) {
 	LOGERR("MimeHandlerMbox::next_document: not open\n");
 	return false;
     }
     if (!m_havedoc) {
 	return false;
     }
-    FILE *fp = (FILE *)m_vfp;
     int mtarg = 0;
     if (!m_ipath.empty()) {
 	sscanf(m_ipath.c_str(), "%d", &mtarg);
@@ -396,116 +818,78 @@ bool MimeHandlerMbox::next_document()
     if (mtarg == 0)
 	mtarg = -1;
 
-
-    // If we are called to retrieve a specific message, seek to bof
-    // (then scan up to the message). This is for the case where the
-    // same object is reused to fetch several messages (else the fp is
-    // just opened no need for a seek).  We could also check if the
-    // current message number is lower than the requested one and
-    // avoid rereading the whole thing in this case. But I'm not sure
-    // we're ever used in this way (multiple retrieves on same
-    // object).  So:
-    bool storeoffsets = true;
+    // Message text is between start and end. Note that, unlike
+    // versions up to 1.25.18, which read the folder with fgets(), lines
+    // longer than 1024 bytes are not split, and the text before the
+    // first From_ line (normally none) is not prepended to the first
+    // message. Indexing and fetching a message now give the same text.
+    mbhoff_type start, end;
+    bool iseof = false;
     if (mtarg > 0) {
-        mbhoff_type off;
-        line_type line;
+        // Retrieving a specific message. Use the offsets cache if
+        // possible, else compute all the offsets.
+        mbhoff_type off = -1;
         LOGDEB0("MimeHandlerMbox::next_doc: mtarg " << mtarg << " m_udi[" <<
                 m_udi << "]\n");
-        if (!m_udi.empty() && 
-            (off = o_mcache.get_offset(m_config, m_udi, mtarg)) >= 0 && 
-            fseeko(fp, (off_t)off, SEEK_SET) >= 0 && 
-            fgets(line, LL, fp) &&
-            (fromregex(line) || ((m_quirks & MBOXQUIRK_TBIRD) && 
-                                 minifromregex(line)))	) {
-                LOGDEB0("MimeHandlerMbox: Cache: From_ Ok\n");
-                fseeko(fp, (off_t)off, SEEK_SET);
-                m_msgnum = mtarg -1;
-		storeoffsets = false;
+        if (!m_offsetsdone && !m_udi.empty() && 
+            (off = o_mcache.get_offset(m_config, m_udi, m_fsize, mtarg)) >= 0 &&
+            off < m_fsize && isFromLine(off)) {
+            LOGDEB0("MimeHandlerMbox: Cache: From_ Ok\n");
+        } else {
+            if (!m_offsetsdone) {
+                scanOffsets();
+            }
+            off = mtarg <= int(m_offsets.size()) ? m_offsets[mtarg-1] : -1;
+        }
+        if (off < 0) {
+            LOGDEB("MimeHandlerMbox: no message " << mtarg << " in " <<
+                   m_fn << "\n");
+            return false;
+        }
+        m_msgnum = mtarg;
+        start = lineEnd(off);
+        end = findFrom(start);
+    } else {
+        if (m_msgnum == 0) {
+            m_offsets.clear();
+            m_pos = findFrom(0);
+        }
+        if (m_msgnum == 0 && m_pos >= m_fsize) {
+            // No From_ line: the whole file is a single message
+            start = 0;
+            end = m_fsize;
         } else {
-            fseek(fp, 0, SEEK_SET);
-            m_msgnum = 0;
+            LOGDEB0("MimeHandlerMbox: msgnum " << m_msgnum + 1 <<
+                    ", From_ at offset " << m_pos << "\n");
+            m_offsets.push_back(m_pos);
+            m_msgnum++;
+            start = lineEnd(m_pos);
+            end = m_pos = findFrom(start);
         }
+        iseof = end >= m_fsize;
     }
 
-    off_t message_end = 0;
-    bool iseof = false;
-    bool hademptyline = true;
-    string& msgtxt = m_metaData[cstr_dj_keycontent];
-    msgtxt.erase();
-    line_type line;
-    for (;;) {
-	message_end = ftello(fp);
-	if (!fgets(line, LL, fp)) {
-	    LOGDEB2("MimeHandlerMbox:next: eof\n");
-	    iseof = true;
-	    m_msgnum++;
-	    break;
-	}
-	m_lineno++;
-	int ll;
-	stripendnl(line, ll);
-	LOGDEB2("mhmbox:next: hadempty " << hademptyline << " lineno " <<
-                m_lineno << " ll " << ll << " Line: [" << line << "]\n");
-	if (hademptyline) {
-	    if (ll > 0) {
-		// Non-empty line with empty line flag set, reset flag
-		// and check regex.
-		if (!(m_quirks & MBOXQUIRK_TBIRD)) {
-		    // Tbird sometimes ommits the empty line, so avoid
-		    // resetting state (initially true) and hope for
-		    // the best
-		    hademptyline = false;
-		}
-		/* The 'F' compare is redundant but it improves performance
-		   A LOT */
-		if (line[0] == 'F' && (
-                        fromregex(line) || 
-                        ((m_quirks & MBOXQUIRK_TBIRD) && minifromregex(line)))
-		    ) {
-		    LOGDEB0("MimeHandlerMbox: msgnum " << m_msgnum <<
-                            ", From_ at line " << m_lineno << ": [" << line
-                            << "]\n");
-		    if (storeoffsets)
-			m_offsets.push_back(message_end);
-		    m_msgnum++;
-		    if ((mtarg <= 0 && m_msgnum > 1) || 
-			(mtarg > 0 && m_msgnum > mtarg)) {
-			// Got message, go do something with it
-			break;
-		    }
-		    // From_ lines are not part of messages
-		    continue;
-		} 
-	    }
-	} else if (ll <= 0) {
-	    hademptyline = true;
-	}
-
-	if (mtarg <= 0 || m_msgnum == mtarg) {
-	    // Accumulate message lines
-	    line[ll] = '\n';
-	    line[ll+1] = 0;
-	    msgtxt += line;
-	    if (msgtxt.size() > max_mbox_member_size) {
-		LOGERR("mh_mbox: huge message (more than " <<
-                       max_mbox_member_size/(1024*1024) << " MB) inside " <<
-                       m_fn << ", giving up\n");
-		return false;
-	    }
-	}
+    if (end - start > mbhoff_type(max_mbox_member_size)) {
+        LOGERR("mh_mbox: huge message (more than " <<
+               max_mbox_member_size/(1024*1024) << " MB) inside " <<
+               m_fn << ", giving up\n");
+        return false;
     }
+    string& msgtxt = m_metaData[cstr_dj_keycontent];
+    size_t avail;
+    const char *cp = data(start, size_t(end - start), &avail);
+    setMsgText(cp, std::min(avail, size_t(end - start)), msgtxt);
     LOGDEB2("Message text length " << msgtxt.size() << "\n");
     LOGDEB2("Message text: [" << msgtxt << "]\n");
     char buf[20];
-    // m_msgnum was incremented when hitting the next From_ or eof, so the data
-    // is for m_msgnum - 1
-    sprintf(buf, "%d", m_msgnum - 1); 
+    sprintf(buf, "%d", m_msgnum); 
     m_metaData[cstr_dj_keyipath] = buf;
     m_metaData[cstr_dj_keymt] = "message/rfc822";
     if (iseof) {
 	LOGDEB2("MimeHandlerMbox::next: eof hit\n");
 	m_havedoc = false;
-	if (!m_udi.empty() && storeoffsets) {
+	if (!m_udi.empty() && m_msgnum > 0) {
+            m_offsetsdone = true;
 	    o_mcache.put_offsets(m_config, m_udi, m_fsize, m_offsets);
 	}
     }
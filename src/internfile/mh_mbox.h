@@ -30,8 +30,7 @@
 class MimeHandlerMbox : public RecollFilter {
 public:
     MimeHandlerMbox(RclConfig *cnf, const std::string& id) 
-	: RecollFilter(cnf, id), m_vfp(0), m_msgnum(0), 
-	  m_lineno(0), m_fsize(0) {
+	: RecollFilter(cnf, id) {
     }
     virtual ~MimeHandlerMbox();
     virtual bool next_document() override;
@@ -48,14 +47,29 @@ protected:
 
 private:
     std::string m_fn;     // File name
-    void      *m_vfp;    // File pointer for folder
-    int        m_msgnum; // Current message number in folder. Starts at 1
+    void      *m_vfp{nullptr}; // File pointer for folder
+    // Read window: folder data starting at offset m_bufoff. We don't
+    // map the file because mail clients often truncate or rewrite a
+    // folder while we read it, which would get us a SIGBUS.
+    std::string m_buf;
+    mbhoff_type m_bufoff{0};
+    mbhoff_type m_fsize{0};
+    int        m_msgnum{0}; // Current message number in folder. Starts at 1
+    mbhoff_type m_pos{0};   // Offset of next From_ line when walking
     std::string m_ipath;
-    int        m_lineno; // debug 
-    mbhoff_type m_fsize;
     std::vector<mbhoff_type> m_offsets;
+    bool       m_offsetsdone{false}; // m_offsets covers the whole file
     enum Quirks {MBOXQUIRK_TBIRD=1};
-    int        m_quirks;
+    int        m_quirks{0};
+
+    void closeFolder();
+    const char *data(mbhoff_type off, size_t len, size_t *availp);
+    bool isFromLine(mbhoff_type off);
+    bool prevLineEmpty(mbhoff_type off);
+    mbhoff_type lineEnd(mbhoff_type off);
+    mbhoff_type nextFromCandidate(mbhoff_type off);
+    mbhoff_type findFrom(mbhoff_type off);
+    void scanOffsets();
 };
 
 #endif /* _MBOX_H_INCLUDED_ */
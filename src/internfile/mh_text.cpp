@@ -68,6 +68,7 @@ bool MimeHandlerText::set_document_file_impl(const string& mt, const string &fn)
     int maxmbs = 20;
     m_config->getConfParam("textfilemaxmbs", &maxmbs);
 
+    string md5;
     if (maxmbs == -1 || fsize / MB <= maxmbs) {
         // Text file page size: if set, we split text files into
         // multiple documents
@@ -79,16 +80,21 @@ bool MimeHandlerText::set_document_file_impl(const string& mt, const string &fn)
         }
         // Note: size_t is guaranteed unsigned, so max if ps is -1
         m_pagesz = size_t(ps);
-        if (!readnext())
+        // Compute the md5 while reading if needed. readnext() clears
+        // it if the data is then truncated.
+        if (!readnext(m_forPreview ? nullptr : &md5))
             return false;
     } else {
         LOGINF("MimeHandlerText: file too big (textfilemaxmbs=" << maxmbs <<
                "), contents will not be indexed: " << fn << endl);
     }
     if (!m_forPreview) {
-	string md5, xmd5;
-	MD5String(m_text, md5);
-	m_metaData[cstr_dj_keymd5] = MD5HexPrint(md5, xmd5);
+        if (md5.empty()) {
+            string digest;
+            MD5String(m_text, digest);
+            MD5HexPrint(digest, md5);
+        }
+	m_metaData[cstr_dj_keymd5] = md5;
     }
     m_havedoc = true;
     return true;
@@ -171,11 +177,14 @@ bool MimeHandlerText::next_document()
     }
 }
 
-bool MimeHandlerText::readnext()
+bool MimeHandlerText::readnext(string *md5p)
 {
     string reason;
     m_text.clear();
-    if (!file_to_string(m_fn, m_text, m_offs, m_pagesz, &reason)) {
+    bool ret = md5p ? file_to_string(m_fn, m_text, m_offs, m_pagesz, md5p,
+                                     &reason) :
+        file_to_string(m_fn, m_text, m_offs, m_pagesz, &reason);
+    if (!ret) {
         LOGERR("MimeHandlerText: can't read file: "  << reason << "\n" );
         m_havedoc = false;
         return false;
@@ -193,6 +202,9 @@ bool MimeHandlerText::readnext()
         string::size_type pos = m_text.find_last_of("\n\r");
         if (pos != string::npos && pos != 0) {
             m_text.erase(pos);
+            // The md5 computed while reading does not match the text
+            if (md5p)
+                md5p->clear();
         }
     }
     m_offs += m_text.length();
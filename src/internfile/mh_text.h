@@ -66,7 +66,7 @@ private:
     size_t m_pagesz{0};
     std::string m_charsetfromxattr; 
 
-    bool readnext();
+    bool readnext(std::string *md5p = nullptr);
 };
 
 #endif /* _MH_TEXT_H_INCLUDED_ */
@@ -82,28 +82,35 @@ static RecollFilter *getMimeHandlerFromCache(const string& key)
     return 0;
 }
 
-/* Return mime handler to pool */
-void returnMimeHandler(RecollFilter *handler)
+/* Insert handler in pool. Returns a handler which should be deleted
+ * (either the input one or an evicted one), or null. */
+static RecollFilter *putMimeHandlerInCache(RecollFilter *handler)
 {
     typedef multimap<string, RecollFilter*>::value_type value_type;
 
-    if (handler == 0) {
-	LOGERR("returnMimeHandler: bad parameter\n");
-	return;
-    }
-    handler->clear();
-
     std::unique_lock<std::mutex> locker(o_handlers_mutex);
 
     LOGDEB("returnMimeHandler: returning filter for " <<
            handler->get_mime_type() << " cache size " << o_handlers.size() <<
            "\n");
 
+    // Limit the number of idle processes kept for an execm filter
+    MimeHandlerExecMultiple *mhm =
+        dynamic_cast<MimeHandlerExecMultiple*>(handler);
+    if (mhm && mhm->maxIdleInstances() > 0 &&
+        o_handlers.count(handler->get_id()) >=
+        (unsigned int)mhm->maxIdleInstances()) {
+        LOGDEB("returnMimeHandler: enough idle " <<
+               handler->get_mime_type() << " filters, deleting\n");
+        return handler;
+    }
+
     // Limit pool size. The pool can grow quite big because there are
     // many filter types, each of which can be used in several copies
     // at the same time either because it occurs several times in a
     // stack (ie mail attachment to mail), or because several threads
     // are processing the same mime type at the same time.
+    RecollFilter *evicted = nullptr;
     multimap<string, RecollFilter *>::iterator it;
     if (o_handlers.size() >= max_handlers_cache_size) {
 	static int once = 1;
@@ -117,23 +124,41 @@ void returnMimeHandler(RecollFilter *handler)
 	if (o_hlru.size() > 0) {
 	    it = o_hlru.back();
 	    o_hlru.pop_back();
-	    delete it->second;
+	    evicted = it->second;
 	    o_handlers.erase(it);
 	}
     }
     it = o_handlers.insert(value_type(handler->get_id(), handler));
     o_hlru.push_front(it);
+    return evicted;
+}
+
+/* Return mime handler to pool */
+void returnMimeHandler(RecollFilter *handler)
+{
+    if (handler == 0) {
+	LOGERR("returnMimeHandler: bad parameter\n");
+	return;
+    }
+    handler->clear();
+
+    // Deleting a handler may mean terminating and waiting for a
+    // filter process: do it without holding the cache lock.
+    delete putMimeHandlerInCache(handler);
 }
 
 void clearMimeHandlerCache()
 {
     LOGDEB("clearMimeHandlerCache()\n");
-    multimap<string, RecollFilter *>::iterator it;
-    std::unique_lock<std::mutex> locker(o_handlers_mutex);
-    for (it = o_handlers.begin(); it != o_handlers.end(); it++) {
-	delete it->second;
+    multimap<string, RecollFilter *> handlers;
+    {
+        std::unique_lock<std::mutex> locker(o_handlers_mutex);
+        handlers.swap(o_handlers);
+        o_hlru.clear();
+    }
+    for (auto& entry : handlers) {
+	delete entry.second;
     }
-    o_handlers.clear();
 }
 
 /** For mime types set as "internal" in mimeconf: 
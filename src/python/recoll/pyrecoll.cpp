@@ -1300,6 +1300,30 @@ Query_highlight(recoll_QueryObject* self, PyObject *args, PyObject *kwargs)
     return unicode;
 }
 
+// Highlight and concatenate abstract snippets
+static string hlAbstract(const vector<string>& vabs, PyPlainToRich& hler,
+                         const HighlightData& hldata)
+{
+    string abstract;
+    for (unsigned int i = 0; i < vabs.size(); i++) {
+        if (vabs[i].empty())
+            continue;
+        list<string> lr;
+        // There may be data like page numbers before the snippet text.
+        // will be in brackets.
+        string::size_type bckt = vabs[i].find("]");
+        if (bckt == string::npos) {
+            hler.plaintorich(vabs[i], lr, hldata);
+        } else {
+            hler.plaintorich(vabs[i].substr(bckt), lr, hldata);
+            lr.front() = vabs[i].substr(0, bckt) + lr.front();
+        }
+        abstract += lr.front();
+        abstract += "...";
+    }
+    return abstract;
+}
+
 PyDoc_STRVAR(doc_Query_makedocabstract,
 "makedocabstract(doc, methods = object))\n"
 "Will create a snippets abstract for doc by selecting text around the match\n"
@@ -1347,22 +1371,7 @@ Query_makedocabstract(recoll_QueryObject* self, PyObject *args,PyObject *kwargs)
 	hler.set_inputhtml(0);
 	vector<string> vabs;
 	self->query->makeDocAbstract(*pydoc->doc, vabs);
-	for (unsigned int i = 0; i < vabs.size(); i++) {
-	    if (vabs[i].empty())
-		continue;
-	    list<string> lr;
-	    // There may be data like page numbers before the snippet text.
-	    // will be in brackets.
-	    string::size_type bckt = vabs[i].find("]");
-	    if (bckt == string::npos) {
-		hler.plaintorich(vabs[i], lr, hldata);
-	    } else {
-		hler.plaintorich(vabs[i].substr(bckt), lr, hldata);
-		lr.front() = vabs[i].substr(0, bckt) + lr.front();
-	    }
-	    abstract += lr.front();
-	    abstract += "...";
-	}
+	abstract = hlAbstract(vabs, hler, hldata);
     }
 
     // Return a python unicode object
@@ -1370,6 +1379,85 @@ Query_makedocabstract(recoll_QueryObject* self, PyObject *args,PyObject *kwargs)
 				     "UTF-8", "replace");
 }
 
+PyDoc_STRVAR(doc_Query_makedocabstracts,
+"makedocabstracts(docs, methods = object)) -> list of strings\n"
+"Same as makedocabstract() for a sequence of docs (e.g. a result page).\n"
+"The abstracts are computed in parallel.\n"
+);
+static PyObject *
+Query_makedocabstracts(recoll_QueryObject* self, PyObject *args,
+                       PyObject *kwargs)
+{
+    LOGDEB0("Query_makeDocAbstracts\n");
+    static const char *kwlist[] = {"docs", "methods", NULL};
+    PyObject *pydocs = 0;
+    PyObject *hlmethods = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O:Query_makeDocAbstracts",
+				     (char **)kwlist, &pydocs, &hlmethods)) {
+	return 0;
+    }
+    if (self->query == 0) {
+	LOGERR("Query_makeDocAbstracts: query not found " << self->query<<"\n");
+        PyErr_SetString(PyExc_AttributeError, "query");
+        return 0;
+    }
+    std::shared_ptr<Rcl::SearchData> sd = self->query->getSD();
+    if (!sd) {
+	PyErr_SetString(PyExc_ValueError, "Query not initialized");
+	return 0;
+    }
+    PyObject *seq = PySequence_Fast(pydocs, "docs must be a sequence");
+    if (seq == 0) {
+        return 0;
+    }
+    vector<Rcl::Doc> docs;
+    Py_ssize_t cnt = PySequence_Fast_GET_SIZE(seq);
+    for (Py_ssize_t i = 0; i < cnt; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        if (!PyObject_TypeCheck(item, &recoll_DocType) ||
+            ((recoll_DocObject *)item)->doc == 0) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_TypeError, "docs must contain Doc objects");
+            return 0;
+        }
+        docs.push_back(*((recoll_DocObject *)item)->doc);
+    }
+    Py_DECREF(seq);
+
+    vector<string> abstracts(docs.size());
+    if (hlmethods == 0) {
+        vector<vector<Rcl::Snippet>> vvabs;
+        self->query->makeDocAbstracts(docs, vvabs);
+        for (unsigned int i = 0; i < vvabs.size(); i++) {
+            for (const auto& snippet : vvabs[i]) {
+                abstracts[i] += snippet.snippet;
+                abstracts[i] += "...";
+            }
+        }
+    } else {
+	HighlightData hldata;
+	sd->getTerms(hldata);
+	PyPlainToRich hler(hlmethods);
+	hler.set_inputhtml(0);
+        vector<vector<string>> vvabs;
+        self->query->makeDocAbstracts(docs, vvabs);
+        for (unsigned int i = 0; i < vvabs.size(); i++) {
+            abstracts[i] = hlAbstract(vvabs[i], hler, hldata);
+        }
+    }
+
+    PyObject *result = PyList_New(abstracts.size());
+    if (result == 0) {
+        return 0;
+    }
+    for (unsigned int i = 0; i < abstracts.size(); i++) {
+        PyList_SET_ITEM(result, i, PyUnicode_Decode(
+                            abstracts[i].c_str(), abstracts[i].size(),
+                            "UTF-8", "replace"));
+    }
+    return result;
+}
+
 PyDoc_STRVAR(doc_Query_getxquery,
 "getxquery(None) -> Unicode string\n"
 "\n"
@@ -1470,6 +1558,8 @@ static PyMethodDef Query_methods[] = {
      doc_Query_getgroups},
     {"makedocabstract", (PyCFunction)Query_makedocabstract, 
      METH_VARARGS|METH_KEYWORDS, doc_Query_makedocabstract},
+    {"makedocabstracts", (PyCFunction)Query_makedocabstracts, 
+     METH_VARARGS|METH_KEYWORDS, doc_Query_makedocabstracts},
     {"scroll", (PyCFunction)Query_scroll, 
      METH_VARARGS|METH_KEYWORDS, doc_Query_scroll},
     {NULL}  /* Sentinel */
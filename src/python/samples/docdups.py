@@ -27,16 +27,56 @@ def init_stripchars(xdb):
     md5wpref = wrap_prefix("XM")
     
 
+# Common field names, coded as their index in the binary data
+# record. This must stay in sync with rcldb/rcldatarec.cpp
+common_names = ("url", "mtype", "fmtime", "dmtime", "origcharset", "fbytes",
+                "pcbytes", "dbytes", "sig", "ipath", "caption", "abstract",
+                "filename", "author", "keywords", "rclaptg", "rclbes",
+                "recipient", "rclmbreaks")
+
+def get_varint(data, pos):
+    v = 0
+    shift = 0
+    while pos < len(data):
+        c = data[pos]
+        pos += 1
+        v |= (c & 0x7f) << shift
+        if not c & 0x80:
+            return v, pos
+        shift += 7
+    raise ValueError("bad data record")
+
 # Retrieve named value from document data record.
-# The record format is a sequence of nm=value lines
+# The record format is a 0 byte and a version byte, then for each
+# field a name (common name index or length and bytes) and a length
+# and value bytes (see rcldb/rcldatarec.h). Records in older indexes
+# are a sequence of nm=value lines.
 def get_attribute(xdb, docid, fld):
     doc = xdb.get_document(docid)
-    data = doc.get_data()
-    s = data.find(fld+"=")
-    if s == -1:
-        return ""
-    e = data.find("\n", s)
-    return data[s+len(fld)+1:e]
+    data = bytearray(doc.get_data())
+    if len(data) < 2 or data[0] != 0:
+        data = data.decode("utf-8", "replace")
+        s = data.find(fld+"=")
+        if s == -1:
+            return ""
+        e = data.find("\n", s)
+        return data[s+len(fld)+1:e]
+    if data[1] != 1:
+        raise ValueError("unknown data record version %d" % data[1])
+    value = bytearray()
+    pos = 2
+    while pos < len(data):
+        v, pos = get_varint(data, pos)
+        if v & 1:
+            name = common_names[v >> 1]
+        else:
+            name = data[pos:pos+(v >> 1)].decode("utf-8")
+            pos += v >> 1
+        vlen, pos = get_varint(data, pos)
+        if name == fld:
+            value = data[pos:pos+vlen]
+        pos += vlen
+    return value.decode("utf-8", "replace")
 
 # Convenience: retrieve postings as Python list
 def get_postlist(xdb, term):
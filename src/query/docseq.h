@@ -107,6 +107,18 @@ class DocSequence {
 	abs.push_back(Rcl::Snippet(0, doc.meta[Rcl::Doc::keyabs]));
 	return true;
     }
+    /** Get abstracts for several documents (e.g. a result page), one
+     *  vector per input doc. The default calls getAbstract() for each */
+    virtual bool getAbstracts(std::vector<Rcl::Doc>& docs,
+			      std::vector<std::vector<std::string>>& abs)
+    {
+	abs.clear();
+	abs.resize(docs.size());
+	for (unsigned int i = 0; i < docs.size(); i++) {
+	    getAbstract(docs[i], abs[i]);
+	}
+	return true;
+    }
     virtual int getFirstMatchPage(Rcl::Doc&, std::string&) 
     {
 	return -1;
@@ -199,6 +211,13 @@ public:
 	    return false;
 	return m_seq->getAbstract(doc, abs);
     }
+    virtual bool getAbstracts(std::vector<Rcl::Doc>& docs,
+			      std::vector<std::vector<std::string>>& abs)
+    {
+	if (!m_seq)
+	    return false;
+	return m_seq->getAbstracts(docs, abs);
+    }
     /** Get duplicates. */
     virtual bool docDups(const Rcl::Doc& doc, std::vector<Rcl::Doc>& dups)
     {
@@ -121,6 +121,42 @@ bool DocSequenceDb::getAbstract(Rcl::Doc &doc, vector<string>& vabs)
     return true;
 }
 
+// Same as getAbstract() for a list of documents, using the parallel
+// abstract builder.
+bool DocSequenceDb::getAbstracts(vector<Rcl::Doc>& docs,
+                                 vector<vector<string>>& vabs)
+{
+    std::unique_lock<std::mutex> locker(o_dblock);
+    if (!setQuery())
+	return false;
+    vabs.clear();
+    vabs.resize(docs.size());
+
+    // The docs for which we do build an abstract, and their indexes
+    vector<Rcl::Doc> todo;
+    vector<unsigned int> idxs;
+    if (m_q->whatDb() && m_queryBuildAbstract) {
+        for (unsigned int i = 0; i < docs.size(); i++) {
+            if (docs[i].syntabs || m_queryReplaceAbstract) {
+                todo.push_back(docs[i]);
+                idxs.push_back(i);
+            }
+        }
+    }
+    if (!todo.empty()) {
+        vector<vector<string>> tabs;
+        m_q->makeDocAbstracts(todo, tabs);
+        for (unsigned int j = 0; j < idxs.size() && j < tabs.size(); j++) {
+            vabs[idxs[j]].swap(tabs[j]);
+        }
+    }
+    for (unsigned int i = 0; i < docs.size(); i++) {
+        if (vabs[i].empty())
+            vabs[i].push_back(docs[i].meta[Rcl::Doc::keyabs]);
+    }
+    return true;
+}
+
 int DocSequenceDb::getFirstMatchPage(Rcl::Doc &doc, string& term)
 {
     std::unique_lock<std::mutex> locker(o_dblock);
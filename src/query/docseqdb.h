@@ -38,6 +38,8 @@ class DocSequenceDb : public DocSequence {
     virtual bool getAbstract(Rcl::Doc &doc, vector<Rcl::Snippet>&);
 
     virtual bool getAbstract(Rcl::Doc &doc, vector<string>&);
+    virtual bool getAbstracts(std::vector<Rcl::Doc>& docs,
+                              std::vector<std::vector<std::string>>& abs);
     virtual int getFirstMatchPage(Rcl::Doc&, std::string& term);
     virtual bool docDups(const Rcl::Doc& doc, std::vector<Rcl::Doc>& dups);
     virtual string getDescription();
@@ -25,6 +25,7 @@
 #include <iostream>
 #include <list>
 #include <string>
+#include <algorithm>
 
 #include "rcldb.h"
 #include "rclquery.h"
@@ -56,8 +57,19 @@ bool dump_contents(RclConfig *rclconfig, Rcl::Doc& idoc)
     return true;
 }
 
+// Same format as Rcl::Query::makeDocAbstract(doc, string&)
+static string snippetsToString(const vector<Rcl::Snippet>& snippets)
+{
+    string abstract;
+    for (const auto& snippet : snippets) {
+        abstract.append(snippet.snippet);
+        abstract.append("...");
+    }
+    return abstract;
+}
+
 void output_fields(vector<string> fields, Rcl::Doc& doc,
-		   Rcl::Query& query, Rcl::Db& rcldb, bool printnames)
+		   const string& abstract, Rcl::Db& rcldb, bool printnames)
 {
     if (fields.empty()) {
         map<string,string>::const_iterator it;
@@ -69,8 +81,6 @@ void output_fields(vector<string> fields, Rcl::Doc& doc,
 	 it != fields.end(); it++) {
 	string out;
 	if (!it->compare("abstract")) {
-	    string abstract;
-	    query.makeDocAbstract(doc, abstract);
 	    base64_encode(abstract, out);
         } else if (!it->compare("xdocid")) {
             char cdocid[30];
@@ -372,13 +382,39 @@ endopts:
     if (op_flags & OPT_Q)
 	return(0);
 
+    // The results are processed in batches, so that the abstracts,
+    // when needed, can be computed in parallel.
+    bool needabstracts = (op_flags & OPT_F) ?
+        (fields.empty() ||
+         find(fields.begin(), fields.end(), "abstract") != fields.end()) :
+        ((op_flags & OPT_A) && !(op_flags & OPT_b));
+    const int batchsize = 100;
+    vector<Rcl::Doc> docs;
+    vector<vector<Rcl::Snippet>> abstracts;
+    vector<int> absrets;
+    int bfirst = firstres;
     for (int i = firstres; i < firstres + maxcount; i++) {
-	Rcl::Doc doc;
-	if (!query.getDoc(i, doc))
-	    break;
+        if (i - bfirst >= int(docs.size())) {
+            bfirst = i;
+            docs.clear();
+            for (int j = i; j < firstres + maxcount && j < i + batchsize; j++) {
+                Rcl::Doc doc;
+                if (!query.getDoc(j, doc))
+                    break;
+                docs.push_back(doc);
+            }
+            if (docs.empty())
+                break;
+            if (needabstracts)
+                absrets = query.makeDocAbstracts(docs, abstracts);
+        }
+	Rcl::Doc& doc(docs[i - bfirst]);
+        string abstract;
+        if (needabstracts)
+            abstract = snippetsToString(abstracts[i - bfirst]);
 
 	if (op_flags & OPT_F) {
-	    output_fields(fields, doc, query, rcldb, op_flags & OPT_N);
+	    output_fields(fields, doc, abstract, rcldb, op_flags & OPT_N);
 	    continue;
 	}
 
@@ -411,8 +447,7 @@ endopts:
 		}
 	    }
             if (op_flags & OPT_A) {
-                string abstract;
-                if (query.makeDocAbstract(doc, abstract)) {
+                if (absrets[i - bfirst] != Rcl::ABSRES_ERROR) {
                     cout << "ABSTRACT" << endl;
                     cout << abstract << endl;
                     cout << "/ABSTRACT" << endl;
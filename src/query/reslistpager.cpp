@@ -152,7 +152,8 @@ void ResListPager::resultPageFor(int docnum)
 }
 
 void ResListPager::displayDoc(RclConfig *config, int i, Rcl::Doc& doc, 
-			      const HighlightData& hdata, const string& sh)
+			      const HighlightData& hdata, const string& sh,
+			      const vector<string> *absp)
 {
     ostringstream chunk;
 
@@ -225,9 +226,13 @@ void ResListPager::displayDoc(RclConfig *config, int i, Rcl::Doc& doc,
 
     string richabst;
     bool needabstract = parFormat().find("%A") != string::npos;
-    if (needabstract && m_docSource) {
+    if (needabstract && (absp || m_docSource)) {
 	vector<string> vabs;
-	m_docSource->getAbstract(doc, vabs);
+	if (absp) {
+	    vabs = *absp;
+	} else {
+	    m_docSource->getAbstract(doc, vabs);
+	}
 	m_hiliter->set_inputhtml(false);
 
 	for (vector<string>::const_iterator it = vabs.begin();
@@ -447,12 +452,29 @@ void ResListPager::displayPage(RclConfig *config)
     HighlightData hdata;
     m_docSource->getTerms(hdata);
 
+    // Compute the abstracts for the whole page at once: this is
+    // where most of the time goes, and the doc source may do it in
+    // parallel.
+    vector<vector<string>> pageabs;
+    bool needabstract = parFormat().find("%A") != string::npos;
+    if (needabstract) {
+	vector<Rcl::Doc> docs;
+	for (const auto& entry : m_respage) {
+	    docs.push_back(entry.doc);
+	}
+	if (!m_docSource->getAbstracts(docs, pageabs) ||
+	    pageabs.size() != m_respage.size()) {
+	    pageabs.clear();
+	}
+    }
+
     // Emit data for result entry paragraph. Do it in chunks that make sense
     // html-wise, else our client may get confused
     for (int i = 0; i < (int)m_respage.size(); i++) {
 	Rcl::Doc& doc(m_respage[i].doc);
 	string& sh(m_respage[i].subHeader);
-	displayDoc(config, i, doc, hdata, sh);
+	displayDoc(config, i, doc, hdata, sh,
+		   pageabs.empty() ? nullptr : &pageabs[i]);
     }
 
     // Footer
@@ -84,8 +84,11 @@ public:
     void resultPageNext();
     void resultPageFor(int docnum);
     void displayPage(RclConfig *);
+    // absp: abstract if already computed (see displayPage()), else
+    // it is fetched from the doc source if needed.
     void displayDoc(RclConfig *, int idx, Rcl::Doc& doc, 
-		    const HighlightData& hdata, const string& sh = "");
+		    const HighlightData& hdata, const string& sh = "",
+		    const std::vector<std::string> *absp = nullptr);
     bool pageEmpty() {return m_respage.size() == 0;}
 
     string queryDescription() {
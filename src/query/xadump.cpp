@@ -33,6 +33,7 @@ using namespace std;
 #endif /* NO_NAMESPACES */
 
 #include "utf8iter.h"
+#include "rcldatarec.h"
 
 #include "xapian.h"
 
@@ -264,13 +265,13 @@ int main(int argc, char **argv)
 	} else if (op_flags & OPT_D) {
 	    Xapian::Document doc = db->get_document(docid);
 	    string data = doc.get_data();
-	    cout << data << endl;
+	    cout << Rcl::dataRecordToText(data) << endl;
 	} else if (op_flags & OPT_r) {
 	    wholedoc(db, docid);
 	} else if (op_flags & OPT_X) {
 	    Xapian::Document doc = db->get_document(docid);
 	    string data = doc.get_data();
-	    cout << data << endl;
+	    cout << Rcl::dataRecordToText(data) << endl;
 	    cout << "Really delete xapian document ?" << endl;
 	    string rep;
 	    cin >> rep;
@@ -315,7 +316,8 @@ int main(int argc, char **argv)
 		cout << "Document ID " << *i << "\t";
 		cout << i.get_percent() << "% ";
 		Xapian::Document doc = i.get_document();
-		cout << "[" << doc.get_data() << "]" << endl;
+		cout << "[" << Rcl::dataRecordToText(doc.get_data()) << "]" <<
+                    endl;
 	    }
 	}
     } catch (const Xapian::Error &e) {
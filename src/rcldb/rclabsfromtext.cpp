@@ -368,6 +368,7 @@ private:
 
 int Query::Native::abstractFromText(
     Rcl::Db::Native *ndb,
+    Xapian::Database& xrdb,
     Xapian::docid docid,
     const vector<string>& matchTerms,
     const multimap<double, vector<string>> byQ,
@@ -381,7 +382,7 @@ int Query::Native::abstractFromText(
     (void)chron;
     LOGABS("abstractFromText: entry: " << chron.millis() << "mS\n");
     string rawtext;
-    if (!ndb->getRawText(docid, rawtext)) {
+    if (!ndb->getRawText(docid, rawtext, &xrdb)) {
         LOGDEB0("abstractFromText: can't fetch text\n");
         return ABSRES_ERROR;
     }
@@ -431,7 +432,7 @@ int Query::Native::abstractFromText(
         );
 
     vector<int> vpbreaks;
-    ndb->getPagePositions(docid, vpbreaks);
+    ndb->getPagePositions(docid, vpbreaks, &xrdb);
 
     // Build the output snippets array by merging the fragments, their
     // main term and the page positions. 
@@ -39,8 +39,6 @@ using namespace std;
 
 namespace Rcl {
 
-static Chrono chron;
-
 // This is used as a marker inside the abstract frag lists, but
 // normally doesn't remain in final output (which is built with a
 // custom sep. by our caller).
@@ -98,6 +96,40 @@ bool Query::Native::getMatchTerms(unsigned long xdocid, vector<string>& terms)
     return true;
 }
 
+// Compute the sorted list of the query terms. This is used by
+// getMatchTerms(xdb,...), which needs no Enquire object and can be
+// called from several threads once this is done.
+void Query::Native::setSortedQTerms()
+{
+    if (!sortedqterms.empty())
+        return;
+    sortedqterms.insert(sortedqterms.begin(), xquery.get_terms_begin(),
+                        xquery.get_terms_end());
+    sort(sortedqterms.begin(), sortedqterms.end());
+    sortedqterms.erase(unique(sortedqterms.begin(), sortedqterms.end()),
+                       sortedqterms.end());
+}
+
+// Same as getMatchTerms() above, but using a specific database
+// handle: the matching terms are the query terms which appear in the
+// document term list.
+bool Query::Native::getMatchTerms(Xapian::Database& xdb, Xapian::docid docid,
+                                  vector<string>& terms)
+{
+    terms.clear();
+    vector<string> iterms;
+    Xapian::TermIterator xtermit = xdb.termlist_begin(docid);
+    for (const auto& term : sortedqterms) {
+        xtermit.skip_to(term);
+        if (xtermit == xdb.termlist_end(docid))
+            break;
+        if (*xtermit == term)
+            iterms.push_back(term);
+    }
+    noPrefixList(iterms, terms);
+    return true;
+}
+
 // Retrieve db-wide frequencies for the query terms and store them in
 // the query object. This is done at most once for a query, and the data is used
 // while computing abstracts for the different result documents.
@@ -138,18 +170,17 @@ void Query::Native::setDbWideQTermsFreqs()
 // root, compute a frequency for the group from the sum of member
 // occurrences, and let the frequency for each group member be the
 // aggregated frequency.
+//
+// setDbWideQTermsFreqs() must have been called first.
 double Query::Native::qualityTerms(Xapian::docid docid, 
                                    const vector<string>& terms,
-                                   multimap<double, vector<string> >& byQ)
+                                   multimap<double, vector<string> >& byQ,
+                                   Xapian::Database *xdbp)
 {
-    LOGABS("qualityTerms: entry " << chron.millis() << "mS\n");
-    setDbWideQTermsFreqs();
-    LOGABS("qualityTerms: setDbWide..:  " << chron.millis() << "mS\n");
-
     map<string, double> termQcoefs;
     double totalweight = 0;
 
-    Xapian::Database &xrdb = m_q->m_db->m_ndb->xrdb;
+    Xapian::Database &xrdb = xdbp ? *xdbp : m_q->m_db->m_ndb->xrdb;
     double doclen = xrdb.get_doclength(docid);
     if (doclen == 0) 
         doclen = 1;
@@ -157,8 +188,6 @@ double Query::Native::qualityTerms(Xapian::docid docid,
     if (m_q->m_sd) {
         m_q->m_sd->getTerms(hld);
     }
-    LOGABS("qualityTerms: m_sd->getTerms():  " << chron.millis() << "mS\n");
-
     // Group the input terms by the user term they were possibly
     // expanded from (by stemming)
     map<string, vector<string> > byRoot;
@@ -185,8 +214,7 @@ double Query::Native::qualityTerms(Xapian::docid docid,
             }
             byRootstr.append("\n");
         }
-        LOGABS("qualityTerms: uterms to terms: " << chron.millis() << "mS " <<
-               byRootstr << endl);
+        LOGABS("qualityTerms: uterms to terms: " << byRootstr << endl);
     }
 #endif
 
@@ -213,20 +241,22 @@ double Query::Native::qualityTerms(Xapian::docid docid,
         const string& root = toRoot[term];
         xtermit.skip_to(term);
         if (xtermit != xrdb.termlist_end(docid) && *xtermit == term) {
+            // Don't use termfreqs[]: this may be running in several
+            // threads and must not modify the map.
+            auto tfit = termfreqs.find(term);
+            double tfreq = tfit == termfreqs.end() ? 0.0 : tfit->second;
             if (grpwdfs.find(root) != grpwdfs.end()) {
                 grpwdfs[root] = xtermit.get_wdf() / doclen;
-                grptfreqs[root] = termfreqs[term];
+                grptfreqs[root] = tfreq;
             } else {
                 grpwdfs[root] += xtermit.get_wdf() / doclen;
-                grptfreqs[root] += termfreqs[term];
+                grptfreqs[root] += tfreq;
             }
         } else {
             LOGDEB("qualityTerms: term not found in doc term list: " << term <<
                    endl);
         }
     }    
-    LOGABS("qualityTerms: freqs compute:  " << chron.millis() << "mS\n");
-
     // Build a sorted by quality container for the groups
     for (const auto& group : byRoot) {
         double q = (grpwdfs[group.first]) * grptfreqs[group.first];
@@ -260,7 +290,6 @@ double Query::Native::qualityTerms(Xapian::docid docid,
 int Query::Native::getFirstMatchPage(Xapian::docid docid, string& term)
 {
     LOGDEB("Query::Native::getFirstMatchPage\n");
-    chron.restart();
     if (!m_q|| !m_q->m_db || !m_q->m_db->m_ndb || !m_q->m_db->m_ndb->m_isopen) {
         LOGERR("Query::getFirstMatchPage: no db\n");
         return -1;
@@ -503,6 +532,7 @@ void Query::Native::abstractCreateSnippetsVector(
 // Creating the abstract from index position data: top level routine
 int Query::Native::abstractFromIndex(
     Rcl::Db::Native *ndb,
+    Xapian::Database& xrdb,
     Xapian::docid docid,
     const vector<string>& matchTerms,
     const multimap<double, vector<string>> byQ,
@@ -513,7 +543,6 @@ int Query::Native::abstractFromIndex(
     Chrono& chron
     )
 {
-    Xapian::Database& xrdb(ndb->xrdb);
     int ret = ABSRES_OK;
     // The terms 'array' that we partially populate with the document
     // terms, at their positions around the search terms positions:
@@ -594,12 +623,18 @@ int Query::Native::abstractFromIndex(
         return ABSRES_OK;
     }
 
-    abstractPopulateContextTerms(xrdb, docid, maxpos, sparseDoc, ret);
-    
-    LOGABS("makeAbstract:" << chron.millis() << "mS: all term poslist read\n");
+    // Use the document forward index if there is one, else walk the
+    // term list.
+    if (ndb->fwdIdxPopulate(docid, maxpos, sparseDoc, &xrdb)) {
+        LOGABS("makeAbstract:" << chron.millis() << "mS: fwd index read\n");
+    } else {
+        abstractPopulateContextTerms(xrdb, docid, maxpos, sparseDoc, ret);
+        LOGABS("makeAbstract:" << chron.millis() <<
+               "mS: all term poslist read\n");
+    }
 
     vector<int> vpbreaks;
-    ndb->getPagePositions(docid, vpbreaks);
+    ndb->getPagePositions(docid, vpbreaks, &xrdb);
 
     LOGABS("makeAbstract:" << chron.millis() << "mS: extracting. Got " <<
            vpbreaks.size() << " pages\n");
@@ -621,17 +656,28 @@ int Query::Native::abstractFromIndex(
 // possibly retried by our caller.
 //
 // @param[out] vabs the abstract is returned as a vector of snippets.
+// @param xdbp if set, a database handle private to the calling
+//   thread, see Query::makeDocAbstracts(). setSortedQTerms() and
+//   setDbWideQTermsFreqs() must then have been called before.
 int Query::Native::makeAbstract(Xapian::docid docid,
                                 vector<Snippet>& vabs, 
-                                int imaxoccs, int ictxwords)
+                                int imaxoccs, int ictxwords,
+                                Xapian::Database *xdbp)
 {
-    chron.restart();
+    Chrono chron;
     LOGABS("makeAbstract: docid " << docid << " imaxoccs " <<
            imaxoccs << " ictxwords " << ictxwords << "\n");
 
+    Rcl::Db::Native *ndb(m_q->m_db->m_ndb);
+    Xapian::Database& xrdb = xdbp ? *xdbp : ndb->xrdb;
+
     // The (unprefixed) terms matched by this document
     vector<string> matchedTerms;
-    getMatchTerms(docid, matchedTerms);
+    if (xdbp) {
+        getMatchTerms(xrdb, docid, matchedTerms);
+    } else {
+        getMatchTerms(docid, matchedTerms);
+    }
     if (matchedTerms.empty()) {
         LOGDEB("makeAbstract:" << chron.millis() << "mS:Empty term list\n");
         return ABSRES_ERROR;
@@ -642,7 +688,9 @@ int Query::Native::makeAbstract(Xapian::docid docid,
     // Retrieve the term frequencies for the query terms. This is
     // actually computed only once for a query, and for all terms in
     // the query (not only the matches for this doc)
-    setDbWideQTermsFreqs();
+    if (!xdbp) {
+        setDbWideQTermsFreqs();
+    }
 
     // Build a sorted by quality container for the match terms We are
     // going to try and show text around the less common search terms.
@@ -651,7 +699,7 @@ int Query::Native::makeAbstract(Xapian::docid docid,
     // 'term groups' in the following: index terms expanded from the
     // same user term).
     multimap<double, vector<string>> byQ;
-    double totalweight = qualityTerms(docid, matchedTerms, byQ);
+    double totalweight = qualityTerms(docid, matchedTerms, byQ, &xrdb);
     LOGABS("makeAbstract:" << chron.millis() << "mS: computed Qcoefs.\n");
     // This can't happen, but would crash us
     if (totalweight == 0.0) {
@@ -659,8 +707,6 @@ int Query::Native::makeAbstract(Xapian::docid docid,
         return ABSRES_ERROR;
     }
 
-    Rcl::Db::Native *ndb(m_q->m_db->m_ndb);
-
     // Total number of slots we populate. The 7 is taken as
     // average word size. It was a mistake to have the user max
     // abstract size parameter in characters, we basically only deal
@@ -673,11 +719,11 @@ int Query::Native::makeAbstract(Xapian::docid docid,
            maxtotaloccs << " ctxwords " << ctxwords << "\n");
 
     if (ndb->m_storetext) {
-        return abstractFromText(ndb, docid, matchedTerms, byQ,
+        return abstractFromText(ndb, xrdb, docid, matchedTerms, byQ,
                                 totalweight, ctxwords, maxtotaloccs, vabs,
                                 chron);
     } else {
-        return abstractFromIndex(ndb, docid, matchedTerms, byQ,
+        return abstractFromIndex(ndb, xrdb, docid, matchedTerms, byQ,
                                  totalweight, ctxwords, maxtotaloccs, vabs,
                                  chron);
     }
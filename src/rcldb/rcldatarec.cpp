@@ -0,0 +1,225 @@
+/* Copyright (C) 2021 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "autoconfig.h"
+
+#include "rcldatarec.h"
+
+#include <string.h>
+
+#include "conftree.h"
+#include "smallut.h"
+
+using namespace std;
+
+namespace Rcl {
+
+static const char recordVersion = 1;
+
+// Common field names, coded as their index in the record. This can
+// only be appended to, else existing indexes would be misread.
+static const char *commonNames[] = {
+    "url", "mtype", "fmtime", "dmtime", "origcharset", "fbytes", "pcbytes",
+    "dbytes", "sig", "ipath", "caption", "abstract", "filename", "author",
+    "keywords", "rclaptg", "rclbes", "recipient", "rclmbreaks",
+};
+static const unsigned int commonNamesCnt =
+    sizeof(commonNames) / sizeof(commonNames[0]);
+
+static bool isBinary(const string& record)
+{
+    return record.size() >= 2 && record[0] == 0;
+}
+
+void dataRecordAppend(string& record, const string& name, const string& value)
+{
+    if (record.empty()) {
+        record += char(0);
+        record += recordVersion;
+    }
+    unsigned int i;
+    for (i = 0; i < commonNamesCnt; i++) {
+        if (!name.compare(commonNames[i]))
+            break;
+    }
+    if (i < commonNamesCnt) {
+        putVarint(record, (uint64_t(i) << 1) | 1);
+    } else {
+        putVarint(record, uint64_t(name.size()) << 1);
+        record += name;
+    }
+    putVarint(record, value.size());
+    record += value;
+}
+
+// Decode the name at pos. Returns either a common name index in
+// *cidx, or the name position and length in *npos, *nlen (and
+// *cidx set to -1).
+static bool getName(const string& record, string::size_type& pos,
+                    int *cidx, string::size_type *npos, uint64_t *nlen)
+{
+    uint64_t v;
+    if (!getVarint(record, pos, v))
+        return false;
+    if (v & 1) {
+        v >>= 1;
+        if (v >= commonNamesCnt)
+            return false;
+        *cidx = int(v);
+    } else {
+        *cidx = -1;
+        *nlen = v >> 1;
+        if (*nlen > record.size() - pos)
+            return false;
+        *npos = pos;
+        pos += *nlen;
+    }
+    return true;
+}
+
+static bool getValue(const string& record, string::size_type& pos,
+                     string::size_type *vpos, uint64_t *vlen)
+{
+    if (!getVarint(record, pos, *vlen) || *vlen > record.size() - pos)
+        return false;
+    *vpos = pos;
+    pos += *vlen;
+    return true;
+}
+
+DataRecordReader::DataRecordReader(const string& record)
+    : m_record(record)
+{
+    if (isBinary(m_record)) {
+        if (m_record[1] != recordVersion) {
+            m_ok = false;
+        }
+        m_pos = 2;
+        return;
+    }
+    // Old text record
+    ConfSimple parms(m_record);
+    if (!parms.ok()) {
+        m_ok = false;
+        return;
+    }
+    vector<string> names = parms.getNames(string());
+    for (const auto& name : names) {
+        string value;
+        parms.get(name, value);
+        m_fields.push_back({name, value});
+    }
+}
+
+bool DataRecordReader::next(string& name, string& value)
+{
+    if (!m_ok)
+        return false;
+    if (!isBinary(m_record)) {
+        if (m_pos >= m_fields.size())
+            return false;
+        name = m_fields[m_pos].first;
+        value = m_fields[m_pos].second;
+        m_pos++;
+        return true;
+    }
+    if (m_pos >= m_record.size())
+        return false;
+    int cidx;
+    string::size_type npos, vpos;
+    uint64_t nlen, vlen;
+    if (!getName(m_record, m_pos, &cidx, &npos, &nlen) ||
+        !getValue(m_record, m_pos, &vpos, &vlen)) {
+        m_ok = false;
+        return false;
+    }
+    if (cidx >= 0) {
+        name = commonNames[cidx];
+    } else {
+        name.assign(m_record, npos, nlen);
+    }
+    value.assign(m_record, vpos, vlen);
+    return true;
+}
+
+bool dataRecordGet(const string& record, const string& name, string& value)
+{
+    bool found = false;
+    if (!isBinary(record)) {
+        // Text format: look for lines beginning with "name=". The
+        // writer never put white space around the '='.
+        string::size_type pos = 0;
+        while (pos < record.size()) {
+            string::size_type eol = record.find_first_of("\n\r", pos);
+            if (eol == string::npos)
+                eol = record.size();
+            if (eol - pos > name.size() &&
+                !record.compare(pos, name.size(), name) &&
+                record[pos + name.size()] == '=') {
+                value = record.substr(pos + name.size() + 1,
+                                      eol - pos - name.size() - 1);
+                trimstring(value, " \t");
+                found = true;
+            }
+            pos = eol + 1;
+        }
+        return found;
+    }
+
+    if (record[1] != recordVersion)
+        return false;
+    // Look for the name in the common table first so that we just
+    // compare indexes while walking the record.
+    int wanted = -1;
+    for (unsigned int i = 0; i < commonNamesCnt; i++) {
+        if (!name.compare(commonNames[i])) {
+            wanted = int(i);
+            break;
+        }
+    }
+    string::size_type pos = 2;
+    while (pos < record.size()) {
+        int cidx;
+        string::size_type npos, vpos;
+        uint64_t nlen, vlen;
+        if (!getName(record, pos, &cidx, &npos, &nlen) ||
+            !getValue(record, pos, &vpos, &vlen)) {
+            break;
+        }
+        if (wanted >= 0 ? cidx == wanted :
+            (cidx < 0 && nlen == name.size() &&
+             !record.compare(npos, nlen, name))) {
+            value.assign(record, vpos, vlen);
+            found = true;
+        }
+    }
+    return found;
+}
+
+string dataRecordToText(const string& record)
+{
+    if (!isBinary(record))
+        return record;
+    string out;
+    DataRecordReader reader(record);
+    string name, value;
+    while (reader.next(name, value)) {
+        out += name + "=" + value + "\n";
+    }
+    return out;
+}
+
+}
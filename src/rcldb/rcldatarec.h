@@ -0,0 +1,75 @@
+#ifndef _RCLDATAREC_H_INCLUDED_
+#define _RCLDATAREC_H_INCLUDED_
+/* Copyright (C) 2021 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace Rcl {
+
+/**
+ * The document data record stores the fields which are returned with
+ * the query results (url, mime type, dates, sizes, stored metadata...).
+ *
+ * Records are written in a binary format: a 0 byte, a version byte,
+ * then for each field the name and the value. Names are coded as a
+ * varint: an odd value is the index of a common field name in a fixed
+ * table, an even one is the length of the name bytes which
+ * follow. Values are a varint length and the bytes.
+ *
+ * Old indexes have text records with one "name=value" line per field,
+ * which are still accepted by the readers.
+ */
+
+/** Append a field to a record. Starts a new binary record if empty. */
+void dataRecordAppend(std::string& record, const std::string& name,
+                      const std::string& value);
+
+/** Sequential reader for all the fields in a record */
+class DataRecordReader {
+public:
+    DataRecordReader(const std::string& record);
+    /** False if the record is not well formed */
+    bool ok() const {
+        return m_ok;
+    }
+    /** Get the next field. Returns false at the end of the record */
+    bool next(std::string& name, std::string& value);
+private:
+    const std::string& m_record;
+    bool m_ok{true};
+    std::string::size_type m_pos{0};
+    // Used for old text records only
+    std::vector<std::pair<std::string, std::string>> m_fields;
+};
+
+/** Extract a single field value, without decoding the rest of the
+ * record. If the field occurs several times, the last value is returned.
+ * @return false if the field is not found */
+bool dataRecordGet(const std::string& record, const std::string& name,
+                   std::string& value);
+
+/** Return the record in the old text format, for debug or display */
+std::string dataRecordToText(const std::string& record);
+
+}
+
+#endif /* _RCLDATAREC_H_INCLUDED_ */
@@ -49,6 +49,7 @@ using namespace std;
 #include "searchdata.h"
 #include "rclquery.h"
 #include "rclquery_p.h"
+#include "rcldatarec.h"
 #include "rclvalues.h"
 #include "md5ut.h"
 #include "cancelcheck.h"
@@ -61,7 +62,6 @@ using namespace std;
 #ifdef RCL_USE_ASPELL
 #include "rclaspell.h"
 #endif
-#include "zlibut.h"
 
 #ifndef XAPIAN_AT_LEAST
 // Added in Xapian 1.4.2. Define it here for older versions
@@ -75,9 +75,16 @@ using namespace std;
 
 // Recoll index format version is stored in user metadata. When this change,
 // we can't open the db and will have to reindex.
+// Version 2 (used after 1.25.18) has the binary document data
+// records (see rcldatarec.h). Version 1 indexes, with text records,
+// can still be used, and they are marked as version 2 when opened for
+// writing, so that older software refuses to read the new records.
 static const string cstr_RCL_IDX_VERSION_KEY("RCL_IDX_VERSION_KEY");
-static const string cstr_RCL_IDX_VERSION("1");
+static const string cstr_RCL_IDX_VERSION("2");
+static const string cstr_RCL_IDX_VERSION_TEXTREC("1");
 static const string cstr_RCL_IDX_DESCRIPTOR_KEY("RCL_IDX_DESCRIPTOR_KEY");
+// Dictionary for the stored texts compression (see rclztext.h)
+static const string cstr_RCL_IDX_TEXTDICT_KEY("RCL_IDX_TEXTDICT_KEY");
 
 static const string cstr_mbreaks("rclmbreaks");
 
@@ -165,6 +172,12 @@ Db::Native::~Native()
             LOGDEB1("Native::~Native: worker status " << status << "\n");
         }
     }
+    // Shards are normally merged and deleted on close. Else, they
+    // are left on disk, and will be overwritten by the next run
+    for (auto shp : m_shards) {
+        shp->wqueue.setTerminateAndWait();
+        delete shp;
+    }
 #endif // IDX_THREADS
 }
 
@@ -187,7 +200,8 @@ void *DbUpdWorker(void* vdbp)
 	case DbUpdTask::AddOrUpdate:
 	    LOGDEB("DbUpdWorker: got add/update task, ql " << qsz << "\n");
 	    status = ndbp->addOrUpdateWrite(
-                tsk->udi, tsk->uniterm, tsk->doc, tsk->txtlen, tsk->rawztext);
+                tsk->udi, tsk->uniterm, tsk->doc, tsk->txtlen, tsk->text,
+                tsk->fwdidx);
 	    break;
 	case DbUpdTask::Delete:
 	    LOGDEB("DbUpdWorker: got delete task, ql " << qsz << "\n");
@@ -211,14 +225,30 @@ void *DbUpdWorker(void* vdbp)
     }
 }
 
-void Db::Native::maybeStartThreads()
+void Db::Native::maybeStartThreads(const string& dir)
 {
     m_havewriteq = false;
     const RclConfig *cnf = m_rcldb->m_config;
     int writeqlen = cnf->getThrConf(RclConfig::ThrDbWrite).first;
     int writethreads = cnf->getThrConf(RclConfig::ThrDbWrite).second;
     if (writethreads > 1) {
-	LOGINFO("RclDb: write threads count was forced down to 1\n");
+        // Multiple threads can only be used when creating a new
+        // index in a one-shot indexing run, in which case each gets
+        // its own temporary index, merged at the end. Updating an
+        // existing index, or making the documents visible along the
+        // way needs the single writer.
+        if (writeqlen >= 0 && m_rcldb->m_shardedWrite &&
+            xwdb.get_doccount() == 0) {
+            if (startShards(dir, writethreads, writeqlen)) {
+                m_havewriteq = true;
+                LOGINFO("RclDb: using " << writethreads <<
+                        " write shards for new index\n");
+                return;
+            }
+            LOGERR("RclDb: write shards creation failed, using 1 thread\n");
+        } else {
+            LOGINFO("RclDb: write threads count was forced down to 1\n");
+        }
 	writethreads = 1;
     }
     if (writeqlen >= 0 && writethreads > 0) {
@@ -232,8 +262,400 @@ void Db::Native::maybeStartThreads()
            writeqlen << " wqts " << writethreads << "\n");
 }
 
+void *DbShardWorker(void* vshp)
+{
+    recoll_threadinit();
+    DbWriteShard *shp = (DbWriteShard *)vshp;
+    WorkQueue<DbUpdTask*> *tqp = &(shp->wqueue);
+
+    DbUpdTask *tsk = 0;
+    for (;;) {
+	size_t qsz = -1;
+	if (!tqp->take(&tsk, &qsz)) {
+	    tqp->workerExit();
+	    return (void*)1;
+	}
+        LOGDEB("DbShardWorker: shard " << shp->idx << " got task " <<
+               tsk->op << ", ql " << qsz << "\n");
+        bool status = shp->ndb->shardWrite(shp, tsk);
+        delete tsk;
+	if (!status) {
+	    LOGERR("DbShardWorker: shardWrite failed\n");
+	    tqp->workerExit();
+	    return (void*)0;
+	}
+    }
+}
+
+// Metadata key used for storing the document text inside a shard. The
+// final docid is only known after the merge, so the text is keyed by
+// uniterm, and moved to the usual docid-based key by mergeShards().
+static const string cstr_shardtextpfx("RCLSHTXT:");
+// Same for the forward index
+static const string cstr_shardfwdpfx("RCLSHFWD:");
+
+static string shardDir(const string& dir, int i)
+{
+    return path_canon(dir) + ".shard" + std::to_string(i);
+}
+
+bool Db::Native::startShards(const string& dir, int cnt, int qlen)
+{
+    string ermsg;
+    try {
+        for (int i = 0; i < cnt; i++) {
+            DbWriteShard *shp = new DbWriteShard(this, i, shardDir(dir, i),
+                                                 qlen);
+            m_shards.push_back(shp);
+            shp->xwdb = createNewDb(
+                shp->dir, string("xapian-shard") + std::to_string(i) + ".stub",
+                Xapian::DB_CREATE_OR_OVERWRITE);
+        }
+    } XCATCHERROR(ermsg);
+    if (!ermsg.empty()) {
+        LOGERR("Db::startShards: " << ermsg << "\n");
+    } else {
+        for (auto shp : m_shards) {
+            if (!shp->wqueue.start(1, DbShardWorker, shp)) {
+                LOGERR("Db::startShards: worker start failed\n");
+                ermsg = "worker start";
+                break;
+            }
+        }
+        if (ermsg.empty())
+            return true;
+    }
+    for (auto shp : m_shards) {
+        shp->wqueue.setTerminateAndWait();
+        delete shp;
+    }
+    m_shards.clear();
+    return false;
+}
+
+DbWriteShard *Db::Native::shardFor(const string& udi)
+{
+    return m_shards[std::hash<string>()(udi) % m_shards.size()];
+}
+
+// Execute update task inside a write shard. This is the sharded
+// equivalent of addOrUpdateWrite() and purgeFileWrite(). As the index
+// was empty when we started, there are no existence flags to set.
+bool Db::Native::shardWrite(DbWriteShard *shp, DbUpdTask *tsk)
+{
+    Chrono chron;
+    std::unique_ptr<Xapian::Document> doc_cleaner(tsk->doc);
+    string rawztext;
+    if (tsk->op == DbUpdTask::AddOrUpdate) {
+        m_ztext.compress(tsk->text, rawztext);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_rcldb->m_curtxtsz += tsk->txtlen;
+        if (!checkFsOccup())
+            return false;
+    }
+
+    std::unique_lock<std::mutex> lock(shp->mutex);
+    Xapian::WritableDatabase& wdb = shp->xwdb;
+    string ermsg;
+    try {
+        switch (tsk->op) {
+        case DbUpdTask::AddOrUpdate:
+            wdb.replace_document(tsk->uniterm, *tsk->doc);
+            // Setting an empty value deletes any previous entry
+            wdb.set_metadata(cstr_shardtextpfx + tsk->uniterm, rawztext);
+            wdb.set_metadata(cstr_shardfwdpfx + tsk->uniterm, tsk->fwdidx);
+            shp->curtxtsz += tsk->txtlen;
+            LOGINFO("Db::add: [" << tsk->udi << "] added to shard " <<
+                    shp->idx << "\n");
+            break;
+        case DbUpdTask::Delete:
+        case DbUpdTask::PurgeOrphans:
+        {
+            bool orphansOnly = tsk->op == DbUpdTask::PurgeOrphans;
+            Xapian::PostingIterator docid = wdb.postlist_begin(tsk->uniterm);
+            if (docid == wdb.postlist_end(tsk->uniterm))
+                break;
+            string sig;
+            if (orphansOnly) {
+                sig = wdb.get_document(*docid).get_value(VALUE_SIG);
+            } else {
+                wdb.delete_document(*docid);
+                wdb.set_metadata(cstr_shardtextpfx + tsk->uniterm, string());
+                wdb.set_metadata(cstr_shardfwdpfx + tsk->uniterm, string());
+            }
+            string pterm = make_parentterm(tsk->udi);
+            vector<Xapian::docid> docids(wdb.postlist_begin(pterm),
+                                         wdb.postlist_end(pterm));
+            for (auto did : docids) {
+                Xapian::Document xdoc = wdb.get_document(did);
+                if (orphansOnly && xdoc.get_value(VALUE_SIG) == sig)
+                    continue;
+                Xapian::TermIterator xit = xdoc.termlist_begin();
+                xit.skip_to(wrap_prefix(udi_prefix));
+                if (xit != xdoc.termlist_end()) {
+                    wdb.set_metadata(cstr_shardtextpfx + *xit, string());
+                    wdb.set_metadata(cstr_shardfwdpfx + *xit, string());
+                }
+                wdb.delete_document(did);
+            }
+        }
+        break;
+        }
+        if (m_rcldb->m_flushMb > 0) {
+            int flushmb = std::max(1, m_rcldb->m_flushMb / int(m_shards.size()));
+            if ((shp->curtxtsz - shp->flushtxtsz) / MB >= flushmb) {
+                LOGINF("Db::shardWrite: shard " << shp->idx << " flushing\n");
+                wdb.commit();
+                shp->flushtxtsz = shp->curtxtsz;
+            }
+        }
+    } XCATCHERROR(ermsg);
+    shp->totalworkns += chron.nanos();
+    if (!ermsg.empty()) {
+        LOGERR("Db::shardWrite: shard " << shp->idx << ": " << ermsg << "\n");
+        return false;
+    }
+    return true;
+}
+
+bool Db::Native::commitShards()
+{
+    bool ret = true;
+    for (auto shp : m_shards) {
+        shp->wqueue.waitIdle();
+        std::unique_lock<std::mutex> lock(shp->mutex);
+        string ermsg;
+        try {
+            shp->xwdb.commit();
+        } XCATCHERROR(ermsg);
+        if (!ermsg.empty()) {
+            LOGERR("Db::commitShards: shard " << shp->idx << ": " <<
+                   ermsg << "\n");
+            ret = false;
+        }
+        shp->flushtxtsz = shp->curtxtsz;
+    }
+    return ret;
+}
+
+// Move all the entries in directory from to directory to, recording
+// the moved names so that the operation can be undone.
+static bool moveDirEntries(const string& from, const string& to,
+                           vector<string>& moved)
+{
+    set<string> entries;
+    string reason;
+    // Trailing slash so that we also accept a link to a directory
+    string fromdir(from);
+    path_catslash(fromdir);
+    if (!readdir(fromdir, reason, entries)) {
+        LOGERR("Db::mergeShards: " << reason << "\n");
+        return false;
+    }
+    for (const auto& entry : entries) {
+        if (rename(path_cat(from, entry).c_str(),
+                   path_cat(to, entry).c_str()) != 0) {
+            LOGSYSERR("Db::mergeShards", "rename", path_cat(from, entry));
+            return false;
+        }
+        moved.push_back(entry);
+    }
+    return true;
+}
+
+static void unmoveDirEntries(const string& from, const string& to,
+                             const vector<string>& moved)
+{
+    for (const auto& entry : moved) {
+        if (rename(path_cat(to, entry).c_str(),
+                   path_cat(from, entry).c_str()) != 0) {
+            LOGSYSERR("Db::mergeShards", "rename back", path_cat(to, entry));
+        }
+    }
+}
+
+// Merge the shards into the main index directory, which is empty at
+// this point. The merged index is built and finalized (stored texts
+// moved to their final keys) beside the main one, and only swapped in
+// if everything went well. On failure, the main index is left as it
+// was and open, and the shards are kept so that the merge can be
+// retried.
+bool Db::Native::mergeShards(const string& dir)
+{
+    Chrono chron;
+    vector<string> srcdirs;
+    bool ok = true;
+    for (auto shp : m_shards) {
+        shp->wqueue.waitIdle();
+        shp->wqueue.setTerminateAndWait();
+        string ermsg;
+        try {
+            shp->xwdb.commit();
+            shp->xwdb.close();
+        } XCATCHERROR(ermsg);
+        if (!ermsg.empty()) {
+            LOGERR("Db::mergeShards: shard " << shp->idx << ": " <<
+                   ermsg << "\n");
+            ok = false;
+        }
+        LOGINFO("Db::mergeShards: shard " << shp->idx << " xapian work " <<
+                lltodecstr(shp->totalworkns/1000000) << " mS\n");
+        srcdirs.push_back(shp->dir);
+    }
+    if (!ok) {
+        // Leave the shards around for inspection
+        return false;
+    }
+
+    LOGINFO("Db::mergeShards: merging " << srcdirs.size() <<
+            " shards into " << dir << "\n");
+    string tmpdir = path_canon(dir) + ".merge";
+    if (path_exists(tmpdir))
+        wipedir(tmpdir, true, true);
+    // All the documents are indexed by us, so they have the sort values
+    m_sortvalues = true;
+    string ermsg;
+    try {
+#if XAPIAN_AT_LEAST(1,3,4)
+        Xapian::Database src;
+        for (const auto& sdir : srcdirs)
+            src.add_database(Xapian::Database(sdir));
+        src.compact(tmpdir);
+#else
+        Xapian::Compactor compactor;
+        for (const auto& sdir : srcdirs)
+            compactor.add_source(sdir);
+        compactor.set_destdir(tmpdir);
+        compactor.compact();
+#endif
+        Xapian::WritableDatabase mdb(tmpdir, Xapian::DB_OPEN);
+        mdb.set_metadata(cstr_RCL_IDX_DESCRIPTOR_KEY, newDescriptor());
+        mdb.set_metadata(cstr_RCL_IDX_VERSION_KEY, cstr_RCL_IDX_VERSION);
+        // The shards texts were compressed with the common dictionary
+        mdb.set_metadata(cstr_RCL_IDX_TEXTDICT_KEY, m_ztext.getDictRecord());
+        for (int fwd = 0; fwd < 2; fwd++) {
+            const string& pfx = fwd ? cstr_shardfwdpfx : cstr_shardtextpfx;
+            vector<string> keys(mdb.metadata_keys_begin(pfx),
+                                mdb.metadata_keys_end(pfx));
+            for (const auto& key : keys) {
+                string uniterm = key.substr(pfx.size());
+                Xapian::PostingIterator docid = mdb.postlist_begin(uniterm);
+                if (docid != mdb.postlist_end(uniterm)) {
+                    mdb.set_metadata(fwd ? fwdidxMetaKey(*docid) :
+                                     rawtextMetaKey(*docid),
+                                     mdb.get_metadata(key));
+                }
+                mdb.set_metadata(key, string());
+            }
+        }
+        mdb.commit();
+        mdb.close();
+    } XCATCHERROR(ermsg);
+    if (!ermsg.empty()) {
+        LOGERR("Db::mergeShards: building the merged index failed: " <<
+               ermsg << "\n");
+        wipedir(tmpdir, true, true);
+        return false;
+    }
+
+    // Replace the main index files with the merged ones. We move the
+    // files instead of the directory in case the latter is a link or
+    // mount point. The old files are kept aside until the merged
+    // index is in place.
+    string olddir = path_canon(dir) + ".premerge";
+    if (path_exists(olddir))
+        wipedir(olddir, true, true);
+    vector<string> oldmoved, newmoved;
+    try {
+        xrdb = Xapian::Database();
+        xwdb.close();
+        xwdb = Xapian::WritableDatabase();
+    } XCATCHERROR(ermsg);
+    bool swapped = ermsg.empty() && path_makepath(olddir, 0700) &&
+        moveDirEntries(dir, olddir, oldmoved) &&
+        moveDirEntries(tmpdir, dir, newmoved);
+    if (!swapped) {
+        LOGERR("Db::mergeShards: could not move the merged index in place\n");
+        unmoveDirEntries(tmpdir, dir, newmoved);
+        unmoveDirEntries(dir, olddir, oldmoved);
+    }
+
+    ermsg.clear();
+    try {
+        xwdb = Xapian::WritableDatabase(dir, Xapian::DB_OPEN);
+        xrdb = xwdb;
+    } XCATCHERROR(ermsg);
+    if (!ermsg.empty()) {
+        LOGERR("Db::mergeShards: reopening the index failed: " << ermsg <<
+               "\n");
+        // The close code must not try to use the database
+        m_noversionwrite = true;
+        return false;
+    }
+    wipedir(tmpdir, true, true);
+    if (!swapped) {
+        // Only removed if empty, that is, if the old files were restored
+        rmdir(olddir.c_str());
+        return false;
+    }
+    wipedir(olddir, true, true);
+    m_ztext.newDictAvailable();
+    for (auto shp : m_shards) {
+        wipedir(shp->dir, true, true);
+        unlink(path_cat(m_rcldb->m_config->getConfDir(), string("xapian-shard")
+                        + std::to_string(shp->idx) + ".stub").c_str());
+        delete shp;
+    }
+    m_shards.clear();
+    LOGINFO("Db::mergeShards: done in " << chron.millis() << " mS\n");
+    return true;
+}
+
 #endif // IDX_THREADS
 
+// Create a new index in dir, choosing the backend according to the
+// configuration, and set m_storetext accordingly.
+Xapian::WritableDatabase Db::Native::createNewDb(
+    const string& dir, const string& stubname, int action)
+{
+    Xapian::WritableDatabase wdb;
+    // New index. If possible, and depending on config, use a stub
+    // to force using Chert. No sense in doing this if we are
+    // storing the text anyway.
+#if XAPIAN_AT_LEAST(1,3,0) && XAPIAN_HAS_CHERT_BACKEND
+    // Xapian with Glass and Chert support. If storedoctext is
+    // specified in the configuration, use the default backend
+    // (Glass), else force Chert. There might be reasons why
+    // someone would want to use Chert and store text anyway, but
+    // it's an exotic case, and things are complicated enough
+    // already.
+    if (o_index_storedoctext) {
+        wdb = Xapian::WritableDatabase(dir, action);
+        m_storetext = true;
+    } else {
+        // Force Chert format, don't store the text.
+        string stub = path_cat(m_rcldb->m_config->getConfDir(),
+                               stubname);
+        FILE *fp = fopen(stub.c_str(), "w");
+        if (nullptr == fp) {
+            throw(string("Can't create ") + stub);
+        }
+        fprintf(fp, "chert %s\n", dir.c_str());
+        fclose(fp);
+        wdb = Xapian::WritableDatabase(stub, action);
+        m_storetext = false;
+    }
+#else
+    // Old Xapian (chert only) or much newer (no chert). Use the
+    // default index backend and let the user decide of the
+    // abstract generation method. The configured default is to
+    // store the text.
+    wdb = Xapian::WritableDatabase(dir, action);
+    m_storetext = o_index_storedoctext;
+#endif
+    return wdb;
+}
+
 void Db::Native::openWrite(const string& dir, Db::OpenMode mode)
 {
     int action = (mode == Db::DbUpd) ? Xapian::DB_CREATE_OR_OPEN :
@@ -259,49 +681,21 @@ void Db::Native::openWrite(const string& dir, Db::OpenMode mode)
             // according to configuration. The metadata record will be
             // written further down.
             m_storetext = o_index_storedoctext;
+            m_ztext.setDictRecord(string());
+            m_sortvalues = true;
             LOGDEB("Db:: index " << (m_storetext?"stores":"does not store") <<
                    " document text\n");
         } else {
-            // Existing non empty. Get the option from the index.
+            // Existing non empty. Get the options from the index.
             storesDocText(xwdb);
+            m_sortvalues = descriptorFlag(xwdb, "sortvalues");
         }
     } else {
-        // New index. If possible, and depending on config, use a stub
-        // to force using Chert. No sense in doing this if we are
-        // storing the text anyway.
-#if XAPIAN_AT_LEAST(1,3,0) && XAPIAN_HAS_CHERT_BACKEND
-        // Xapian with Glass and Chert support. If storedoctext is
-        // specified in the configuration, use the default backend
-        // (Glass), else force Chert. There might be reasons why
-        // someone would want to use Chert and store text anyway, but
-        // it's an exotic case, and things are complicated enough
-        // already.
-        if (o_index_storedoctext) {
-            xwdb = Xapian::WritableDatabase(dir, action);
-            m_storetext = true;
-        } else {
-            // Force Chert format, don't store the text.
-            string stub = path_cat(m_rcldb->m_config->getConfDir(),
-                                   "xapian.stub");
-            FILE *fp = fopen(stub.c_str(), "w");
-            if (nullptr == fp) {
-                throw(string("Can't create ") + stub);
-            }
-            fprintf(fp, "chert %s\n", dir.c_str());
-            fclose(fp);
-            xwdb = Xapian::WritableDatabase(stub, action);
-            m_storetext = false;
-        }
+        xwdb = createNewDb(dir, "xapian.stub", action);
+        m_ztext.setDictRecord(string());
+        m_sortvalues = true;
         LOGINF("Rcl::Db::openWrite: new index will " << (m_storetext?"":"not ")
                << "store document text\n");
-#else
-        // Old Xapian (chert only) or much newer (no chert). Use the
-        // default index backend and let the user decide of the
-        // abstract generation method. The configured default is to
-        // store the text.
-        xwdb = Xapian::WritableDatabase(dir, action);
-        m_storetext = o_index_storedoctext;
-#endif
     }
 
     // If the index is empty, write the data format version, 
@@ -309,29 +703,59 @@ void Db::Native::openWrite(const string& dir, Db::OpenMode mode)
     // with recoll 1.24, maybe we'll have other stuff to store in
     // there in the future).
     if (xwdb.get_doccount() == 0) {
-        string desc = string("storetext=") + (m_storetext ? "1" : "0") + "\n";
-        xwdb.set_metadata(cstr_RCL_IDX_DESCRIPTOR_KEY, desc);
+        xwdb.set_metadata(cstr_RCL_IDX_DESCRIPTOR_KEY, newDescriptor());
         xwdb.set_metadata(cstr_RCL_IDX_VERSION_KEY, cstr_RCL_IDX_VERSION);
     }
 
     m_iswritable = true;
 
 #ifdef IDX_THREADS
-    maybeStartThreads();
+    maybeStartThreads(dir);
 #endif
 }
 
-void Db::Native::storesDocText(Xapian::Database& db)
+bool Db::Native::descriptorFlag(Xapian::Database& db, const string& name)
 {
     string desc = db.get_metadata(cstr_RCL_IDX_DESCRIPTOR_KEY);
     ConfSimple cf(desc, 1);
     string val;
-    m_storetext = false;
-    if (cf.get("storetext", val) && stringToBool(val)) {
-        m_storetext = true;
-    }
+    return cf.get(name, val) && stringToBool(val);
+}
+
+string Db::Native::newDescriptor()
+{
+    // The sortvalues option was added after 1.25.18. Older indexes may
+    // have documents without the sort values
+    return string("storetext=") + (m_storetext ? "1" : "0") + "\n" +
+        "sortvalues=" + (m_sortvalues ? "1" : "0") + "\n";
+}
+
+Xapian::valueno Db::Native::sortValueSlot(const string& fld)
+{
+    // The size value has always been set
+    if (fld == Doc::keyfs)
+        return VALUE_SIZE;
+    if (!m_sortvalues)
+        return Xapian::BAD_VALUENO;
+    if (fld == cstr_dmtime)
+        return VALUE_SORTMTIME;
+    if (fld == Doc::keyds)
+        return VALUE_SORTDBYTES;
+    if (fld == cstr_caption)
+        return VALUE_SORTTITLE;
+    if (fld == Doc::keyfn)
+        return VALUE_SORTFN;
+    return Xapian::BAD_VALUENO;
+}
+
+void Db::Native::storesDocText(Xapian::Database& db)
+{
+    m_storetext = descriptorFlag(db, "storetext");
     LOGDEB("Db:: index " << (m_storetext?"stores":"does not store") <<
            " document text\n");
+    if (m_storetext) {
+        m_ztext.setDictRecord(db.get_metadata(cstr_RCL_IDX_TEXTDICT_KEY));
+    }
 }
 
 void Db::Native::openRead(const string& dir)
@@ -339,6 +763,18 @@ void Db::Native::openRead(const string& dir)
     m_iswritable = false;
     xrdb = Xapian::Database(dir);
     storesDocText(xrdb);
+    m_sortvalues = descriptorFlag(xrdb, "sortvalues");
+}
+
+Xapian::Database Db::Native::openReadClone()
+{
+    Xapian::Database db(m_rcldb->m_basedir);
+    if (!m_iswritable) {
+        for (const auto& extra : m_rcldb->m_extraDbs) {
+            db.add_database(Xapian::Database(extra));
+        }
+    }
+    return db;
 }
 
 /* See comment in class declaration: return all subdocuments of a
@@ -545,9 +981,9 @@ Xapian::docid Db::Native::getDoc(const string& udi, int idxi,
 bool Db::Native::dbDataToRclDoc(Xapian::docid docid, std::string &data, 
 				Doc &doc, bool fetchtext)
 {
-    LOGDEB2("Db::dbDataToRclDoc: data:\n" << data << "\n");
-    ConfSimple parms(data);
-    if (!parms.ok())
+    LOGDEB2("Db::dbDataToRclDoc: data:\n" << dataRecordToText(data) << "\n");
+    DataRecordReader reader(data);
+    if (!reader.ok())
 	return false;
 
     doc.xdocid = docid;
@@ -566,41 +1002,60 @@ bool Db::Native::dbDataToRclDoc(Xapian::docid docid, std::string &data,
 	    doc.idxi = idxi;
 	}
     }
-    parms.get(Doc::keyurl, doc.idxurl);
+
+    // The title and abstract are always set in meta, possibly empty
+    string& title = doc.meta[Doc::keytt];
+    string& abstract = doc.meta[Doc::keyabs];
+    string name, value;
+    while (reader.next(name, value)) {
+        // Special cases:
+        if (name == Doc::keyurl) {
+            doc.idxurl = value;
+        } else if (name == Doc::keytp) {
+            doc.mimetype = value;
+        } else if (name == Doc::keyfmt) {
+            doc.fmtime = value;
+        } else if (name == Doc::keydmt) {
+            doc.dmtime = value;
+        } else if (name == Doc::keyoc) {
+            doc.origcharset = value;
+        } else if (name == cstr_caption) {
+            title = value;
+        } else if (name == Doc::keyabs) {
+            abstract = value;
+            continue;
+        } else if (name == Doc::keyipt) {
+            doc.ipath = value;
+        } else if (name == Doc::keypcs) {
+            doc.pcbytes = value;
+        } else if (name == Doc::keyfs) {
+            doc.fbytes = value;
+        } else if (name == Doc::keyds) {
+            doc.dbytes = value;
+        } else if (name == Doc::keysig) {
+            doc.sig = value;
+        }
+        // Normal key/value pairs. Don't override values set by our caller
+        doc.meta.insert({name, value});
+    }
+    if (!reader.ok()) {
+        LOGERR("Db::dbDataToRclDoc: bad data record for docid " << docid <<
+               "\n");
+        return false;
+    }
+
     doc.url = doc.idxurl;
     m_rcldb->m_config->urlrewrite(dbdir, doc.url);
     if (!doc.url.compare(doc.idxurl))
 	doc.idxurl.clear();
 
-    // Special cases:
-    parms.get(Doc::keytp, doc.mimetype);
-    parms.get(Doc::keyfmt, doc.fmtime);
-    parms.get(Doc::keydmt, doc.dmtime);
-    parms.get(Doc::keyoc, doc.origcharset);
-    parms.get(cstr_caption, doc.meta[Doc::keytt]);
-
-    parms.get(Doc::keyabs, doc.meta[Doc::keyabs]);
     // Possibly remove synthetic abstract indicator (if it's there, we
     // used to index the beginning of the text as abstract).
     doc.syntabs = false;
-    if (doc.meta[Doc::keyabs].find(cstr_syntAbs) == 0) {
-	doc.meta[Doc::keyabs] = 
-	    doc.meta[Doc::keyabs].substr(cstr_syntAbs.length());
+    if (abstract.find(cstr_syntAbs) == 0) {
+	abstract = abstract.substr(cstr_syntAbs.length());
 	doc.syntabs = true;
     }
-    parms.get(Doc::keyipt, doc.ipath);
-    parms.get(Doc::keypcs, doc.pcbytes);
-    parms.get(Doc::keyfs, doc.fbytes);
-    parms.get(Doc::keyds, doc.dbytes);
-    parms.get(Doc::keysig, doc.sig);
-
-    // Normal key/value pairs:
-    vector<string> keys = parms.getNames(string());
-    for (vector<string>::const_iterator it = keys.begin(); 
-	 it != keys.end(); it++) {
-	if (doc.meta.find(*it) == doc.meta.end())
-	    parms.get(*it, doc.meta[*it]);
-    }
     doc.meta[Doc::keyurl] = doc.url;
     doc.meta[Doc::keymt] = doc.dmtime.empty() ? doc.fmtime : doc.dmtime;
     if (fetchtext) {
@@ -625,19 +1080,20 @@ bool Db::Native::hasPages(Xapian::docid docid)
 }
 
 // Return the positions list for the page break term
-bool Db::Native::getPagePositions(Xapian::docid docid, vector<int>& vpos)
+bool Db::Native::getPagePositions(Xapian::docid docid, vector<int>& vpos,
+                                  Xapian::Database *xdbp)
 {
+    Xapian::Database& xrdb = xdbp ? *xdbp : this->xrdb;
     vpos.clear();
     // Need to retrieve the document record to check for multiple page breaks
-    // that we store there for lack of better place
+    // that we store there for lack of better place. We only need this
+    // field, and don't call dbDataToRclDoc(), which accesses xrdb.
     map<int, int> mbreaksmap;
     try {
 	Xapian::Document xdoc = xrdb.get_document(docid);
 	string data = xdoc.get_data();
-	Doc doc;
 	string mbreaks;
-	if (dbDataToRclDoc(docid, data, doc) && 
-	    doc.getmeta(cstr_mbreaks, &mbreaks)) {
+	if (dataRecordGet(data, cstr_mbreaks, mbreaks)) {
 	    vector<string> values;
 	    stringToTokens(mbreaks, values, ",");
 	    for (unsigned int i = 0; i < values.size() - 1; i += 2) {
@@ -685,7 +1141,18 @@ int Db::Native::getPageNumberForPosition(const vector<int>& pbreaks, int pos)
     return int(it - pbreaks.begin() + 1);
 }
 
-bool Db::Native::getRawText(Xapian::docid docid_combined, string& rawtext)
+ZTextCodec *Db::Native::extraCodec(size_t dbidx)
+{
+    std::unique_lock<std::mutex> lock(m_extracodecsmutex);
+    if (m_extracodecs.size() < dbidx)
+        m_extracodecs.resize(dbidx);
+    if (!m_extracodecs[dbidx-1])
+        m_extracodecs[dbidx-1] = std::unique_ptr<ZTextCodec>(new ZTextCodec);
+    return m_extracodecs[dbidx-1].get();
+}
+
+bool Db::Native::getRawText(Xapian::docid docid_combined, string& rawtext,
+                            Xapian::Database *xdbp)
 {
     if (!m_storetext) {
         LOGDEB("Db::Native::getRawText: document text not stored in index\n");
@@ -698,11 +1165,25 @@ bool Db::Native::getRawText(Xapian::docid docid_combined, string& rawtext)
     size_t dbidx = whatDbIdx(docid_combined);
     Xapian::docid docid = whatDbDocid(docid_combined);
     string reason;
+    // The compression dictionary belongs to the index. It is
+    // (re)loaded when missing, as it may have been created by the
+    // indexer after we opened the index.
+    ZTextCodec *codec = &m_ztext;
     if (dbidx != 0) {
         Xapian::Database db(m_rcldb->m_extraDbs[dbidx-1]);
-        XAPTRY(rawtext = db.get_metadata(rawtextMetaKey(docid)), db, reason);
+        codec = extraCodec(dbidx);
+        XAPTRY(rawtext = db.get_metadata(rawtextMetaKey(docid));
+               if (!codec->hasDictFor(rawtext))
+                   codec->setDictRecord(
+                       db.get_metadata(cstr_RCL_IDX_TEXTDICT_KEY)),
+               db, reason);
     } else {
-        XAPTRY(rawtext = xrdb.get_metadata(rawtextMetaKey(docid)), xrdb, reason);
+        Xapian::Database& rdb = xdbp ? *xdbp : xrdb;
+        XAPTRY(rawtext = rdb.get_metadata(rawtextMetaKey(docid));
+               if (!codec->hasDictFor(rawtext))
+                   codec->setDictRecord(
+                       rdb.get_metadata(cstr_RCL_IDX_TEXTDICT_KEY)),
+               rdb, reason);
     }
     if (!reason.empty()) {
         LOGERR("Rcl::Db::getRawText: could not get value: " << reason << endl);
@@ -711,28 +1192,97 @@ bool Db::Native::getRawText(Xapian::docid docid_combined, string& rawtext)
     if (rawtext.empty()) {
         return true;
     }
-    ZLibUtBuf cbuf;
-    inflateToBuf(rawtext.c_str(), rawtext.size(), cbuf);
-    rawtext.assign(cbuf.getBuf(), cbuf.getCnt());
+    string ztext;
+    ztext.swap(rawtext);
+    if (!codec->uncompress(ztext, rawtext)) {
+        LOGERR("Rcl::Db::getRawText: could not uncompress text for docid " <<
+               docid << "\n");
+        return false;
+    }
     return true;
 }
 
-// Note: we're passed a Xapian::Document* because Xapian
-// reference-counting is not mt-safe. We take ownership and need
-// to delete it before returning.
-bool Db::Native::addOrUpdateWrite(
-    const string& udi, const string& uniterm, Xapian::Document *newdocument_ptr, 
-    size_t textlen, const string& rawztext)
+// The forward index is stored as index metadata. Format:
+//  - Vocabulary: term count (varint), then for each term, its length
+//    (varint) and bytes. Term ids are 1-based, by order of first use.
+//  - First position (varint), positions count (varint), id width
+//    (1 byte).
+//  - The term ids (little-endian, width bytes each) for each
+//    position. 0 for positions with no unprefixed term.
+bool Db::Native::fwdIdxPopulate(Xapian::docid docid_combined,
+                                unsigned int maxpos,
+                                map<unsigned int, string>& sparseDoc,
+                                Xapian::Database *xdbp)
 {
-#ifdef IDX_THREADS
-    Chrono chron;
-    std::unique_lock<std::mutex> lock(m_mutex);
-#endif
-    std::unique_ptr<Xapian::Document> doc_cleaner(newdocument_ptr);
+    size_t dbidx = whatDbIdx(docid_combined);
+    Xapian::docid docid = whatDbDocid(docid_combined);
+    string data, reason;
+    if (dbidx != 0) {
+        Xapian::Database db(m_rcldb->m_extraDbs[dbidx-1]);
+        XAPTRY(data = db.get_metadata(fwdidxMetaKey(docid)), db, reason);
+    } else {
+        Xapian::Database& rdb = xdbp ? *xdbp : xrdb;
+        XAPTRY(data = rdb.get_metadata(fwdidxMetaKey(docid)), rdb, reason);
+    }
+    if (!reason.empty()) {
+        LOGERR("Rcl::Db::fwdIdxPopulate: could not get value: " << reason <<
+               endl);
+        return false;
+    }
+    if (data.empty()) {
+        return false;
+    }
 
-    // Check file system full every mbyte of indexed text. It's a bit wasteful
-    // to do this after having prepared the document, but it needs to be in
-    // the single-threaded section.
+    string::size_type pos = 0;
+    uint64_t cnt, len;
+    if (!getVarint(data, pos, cnt) || cnt > data.size()) {
+        goto bad;
+    }
+    {
+        // (offset, length) of the terms in data
+        vector<pair<string::size_type, uint64_t>> vocab;
+        vocab.reserve(cnt);
+        for (uint64_t i = 0; i < cnt; i++) {
+            if (!getVarint(data, pos, len) || len > data.size() - pos) {
+                goto bad;
+            }
+            vocab.push_back({pos, len});
+            pos += len;
+        }
+        uint64_t minpos, npos;
+        if (!getVarint(data, pos, minpos) ||
+            !getVarint(data, pos, npos) || pos >= data.size()) {
+            goto bad;
+        }
+        int width = data[pos++];
+        if (width < 1 || width > 4 || (data.size() - pos) / width < npos) {
+            goto bad;
+        }
+        const unsigned char *ids = (const unsigned char *)data.c_str() + pos;
+        for (auto it = sparseDoc.lower_bound(minpos);
+             it != sparseDoc.end() && it->first <= maxpos &&
+                 it->first < minpos + npos; it++) {
+            if (!it->second.empty())
+                continue;
+            const unsigned char *cp = ids + (it->first - minpos) * width;
+            uint32_t id = 0;
+            for (int i = width - 1; i >= 0; i--) {
+                id = (id << 8) | cp[i];
+            }
+            if (id == 0 || id > vocab.size())
+                continue;
+            it->second.assign(data, vocab[id-1].first, vocab[id-1].second);
+        }
+    }
+    return true;
+
+bad:
+    LOGERR("Rcl::Db::fwdIdxPopulate: bad data for docid " << docid << "\n");
+    return false;
+}
+
+bool Db::Native::checkFsOccup()
+{
     if (m_rcldb->m_maxFsOccupPc > 0 && 
 	(m_rcldb->m_occFirstCheck || 
 	 (m_rcldb->m_curtxtsz - m_rcldb->m_occtxtsz) / MB >= 1)) {
@@ -746,6 +1296,30 @@ bool Db::Native::addOrUpdateWrite(
 	}
 	m_rcldb->m_occtxtsz = m_rcldb->m_curtxtsz;
     }
+    return true;
+}
+
+// Note: we're passed a Xapian::Document* because Xapian
+// reference-counting is not mt-safe. We take ownership and need
+// to delete it before returning.
+bool Db::Native::addOrUpdateWrite(
+    const string& udi, const string& uniterm, Xapian::Document *newdocument_ptr, 
+    size_t textlen, const string& text, const string& fwdidx)
+{
+    // Compress the text before entering the single-threaded section
+    string rawztext;
+    m_ztext.compress(text, rawztext);
+#ifdef IDX_THREADS
+    Chrono chron;
+    std::unique_lock<std::mutex> lock(m_mutex);
+#endif
+    std::unique_ptr<Xapian::Document> doc_cleaner(newdocument_ptr);
+
+    // Check file system full every mbyte of indexed text. It's a bit wasteful
+    // to do this after having prepared the document, but it needs to be in
+    // the single-threaded section.
+    if (!checkFsOccup())
+        return false;
 
     const char *fnc = udi.c_str();
     string ermsg;
@@ -779,13 +1353,25 @@ bool Db::Native::addOrUpdateWrite(
 	}
     }
 
-    XAPTRY(xwdb.set_metadata(rawtextMetaKey(did), rawztext),
+    XAPTRY(xwdb.set_metadata(rawtextMetaKey(did), rawztext);
+           xwdb.set_metadata(fwdidxMetaKey(did), fwdidx),
            xwdb, m_rcldb->m_reason);
     if (!m_rcldb->m_reason.empty()) {
         LOGERR("Db::addOrUpdate: set_metadata error: " <<
                m_rcldb->m_reason << "\n");
         // This only affects snippets, so let's say not fatal
     }
+    // Store the text compression dictionary along with the first
+    // text which uses it
+    if (m_ztext.newDictAvailable()) {
+        XAPTRY(xwdb.set_metadata(cstr_RCL_IDX_TEXTDICT_KEY,
+                                 m_ztext.getDictRecord()),
+               xwdb, m_rcldb->m_reason);
+        if (!m_rcldb->m_reason.empty()) {
+            LOGERR("Db::addOrUpdate: set_metadata error: " <<
+                   m_rcldb->m_reason << "\n");
+        }
+    }
     
     // Test if we're over the flush threshold (limit memory usage):
     bool ret = m_rcldb->maybeflush(textlen);
@@ -888,6 +1474,19 @@ Db::Db(const RclConfig *cfp)
 	m_config->getConfParam("idxflushmb", &m_flushMb);
 	m_config->getConfParam("idxmetastoredlen", &m_idxMetaStoredLen);
 	m_config->getConfParam("idxtexttruncatelen", &m_idxTextTruncateLen);
+        m_config->getConfParam("indexStoreForwardIndex",
+                               &m_ndb->m_storefwdidx);
+        string codecname;
+        if (m_config->getConfParam("indexStoredTextCodec", codecname) &&
+            !codecname.empty()) {
+            ZTextCodec::Codec codec;
+            if (ZTextCodec::nameToCodec(codecname, &codec)) {
+                m_ndb->m_ztext.setCodec(codec);
+            } else {
+                LOGERR("Db::Db: unknown or unsupported text codec [" <<
+                       codecname << "], using zlib\n");
+            }
+        }
     }
 }
 
@@ -960,7 +1559,10 @@ bool Db::open(OpenMode mode, OpenError *error)
 		LOGDEB("Db::Open: adding query db [" << &db << "]\n");
                 // An error here used to be non-fatal (1.13 and older)
                 // but I can't see why
-                m_ndb->xrdb.add_database(Xapian::Database(db));
+                Xapian::Database xdb(db);
+                if (!Native::descriptorFlag(xdb, "sortvalues"))
+                    m_ndb->m_sortvalues = false;
+                m_ndb->xrdb.add_database(xdb);
 	    }
 	    break;
 	}
@@ -971,13 +1573,21 @@ bool Db::open(OpenMode mode, OpenError *error)
 	// truncated db
 	if (mode != DbTrunc && m_ndb->xrdb.get_doccount() > 0) {
 	    string version = m_ndb->xrdb.get_metadata(cstr_RCL_IDX_VERSION_KEY);
-	    if (version.compare(cstr_RCL_IDX_VERSION)) {
+	    if (version.compare(cstr_RCL_IDX_VERSION) &&
+                version.compare(cstr_RCL_IDX_VERSION_TEXTREC)) {
 		m_ndb->m_noversionwrite = true;
 		LOGERR("Rcl::Db::open: file index [" << version <<
                        "], software [" << cstr_RCL_IDX_VERSION << "]\n");
 		throw Xapian::DatabaseError("Recoll index version mismatch",
 					    "", "");
 	    }
+            if (m_ndb->m_iswritable && version.compare(cstr_RCL_IDX_VERSION)) {
+                LOGINF("Rcl::Db::open: upgrading index version from " <<
+                       version << " to " << cstr_RCL_IDX_VERSION << "\n");
+                m_ndb->xwdb.set_metadata(cstr_RCL_IDX_VERSION_KEY,
+                                         cstr_RCL_IDX_VERSION);
+                m_ndb->xwdb.commit();
+            }
 	}
 	m_mode = mode;
 	m_ndb->m_isopen = true;
@@ -1013,6 +1623,9 @@ bool Db::i_close(bool final)
 	if (w) {
 #ifdef IDX_THREADS
 	    waitUpdIdle();
+            if (!m_ndb->m_shards.empty() && !m_ndb->mergeShards(m_basedir)) {
+                LOGERR("Rcl::Db:close: merging the write shards failed\n");
+            }
 #endif
 	    if (!m_ndb->m_noversionwrite)
 		m_ndb->xwdb.set_metadata(cstr_RCL_IDX_VERSION_KEY, 
@@ -1221,6 +1834,68 @@ bool Db::fieldToTraits(const string& fld, const FieldTraits **ftpp,
     return false;
 }
 
+// Build the forward index for positions >= minpos from the terms
+// already added to the Xapian document. See fwdIdxPopulate() for the
+// format. The termlist is in alphabetic order, so that we keep the
+// alphabetically first term for each position, as the termlist walk
+// in the abstract code does.
+static void docForwardIndex(Xapian::Document& xdoc, Xapian::termpos minpos,
+                            string& out)
+{
+    out.clear();
+    // Local vocabulary. Ids are 1-based, 0 is for an empty slot
+    vector<string> vocab;
+    vector<uint32_t> slots;
+    string ermsg;
+    try {
+        for (Xapian::TermIterator term = xdoc.termlist_begin();
+             term != xdoc.termlist_end(); term++) {
+            if (has_prefix(*term))
+                continue;
+            bool used = false;
+            for (Xapian::PositionIterator pos = term.positionlist_begin();
+                 pos != term.positionlist_end(); pos++) {
+                if (*pos < minpos)
+                    continue;
+                if (*pos - minpos >= slots.size())
+                    slots.resize(*pos - minpos + 1);
+                uint32_t& slot = slots[*pos - minpos];
+                if (slot == 0) {
+                    if (!used) {
+                        vocab.push_back(*term);
+                        used = true;
+                    }
+                    slot = vocab.size();
+                }
+            }
+        }
+    } XCATCHERROR(ermsg);
+    if (!ermsg.empty()) {
+        LOGERR("Db: forward index: xapian error " << ermsg << "\n");
+        return;
+    }
+    if (slots.empty())
+        return;
+    int width = vocab.size() < 0xff ? 1 : vocab.size() < 0xffff ? 2 :
+        vocab.size() < 0xffffff ? 3 : 4;
+    putVarint(out, vocab.size());
+    for (const auto& term : vocab) {
+        putVarint(out, term.size());
+        out.append(term);
+    }
+    putVarint(out, minpos);
+    putVarint(out, slots.size());
+    out += char(width);
+    size_t offs = out.size();
+    out.resize(offs + slots.size() * width);
+    for (auto id : slots) {
+        for (int i = 0; i < width; i++) {
+            out[offs++] = char(id & 0xff);
+            id >>= 8;
+        }
+    }
+}
+
 // The splitter breaks text into words and adds postings to the Xapian
 // document. We use a single object to split all of the document
 // fields and position jumps to separate fields
@@ -1320,10 +1995,11 @@ public:
 		m_ts->wdb.add_spelling(term);
 	    }
 #endif
-	    // Index the prefixed term.
+	    // Index the prefixed term. Build it in the member buffer
+	    // to avoid an allocation per term
 	    if (!m_ts->ft.pfx.empty()) {
-		m_ts->doc.add_posting(m_ts->ft.pfx + term, pos, 
-                                      m_ts->ft.wdfinc);
+		m_pfxterm.assign(m_ts->ft.pfx).append(term);
+		m_ts->doc.add_posting(m_pfxterm, pos, m_ts->ft.wdfinc);
 	    }
 	    return true;
 	} XCATCHERROR(ermsg);
@@ -1371,6 +2047,8 @@ public:
     }
 
     TextSplitDb *m_ts;
+    // Prefixed term buffer
+    string m_pfxterm;
     // Auxiliary page breaks data for positions with multiple page breaks.
     int m_lastpagepos;
     // increment of page breaks at same pos. Normally 0, 1.. when several
@@ -1468,7 +2146,6 @@ bool Db::setSynGroupsFile(const string& fn)
 }
     
 static const string cstr_nc("\n\r\x0c\\");
-#define RECORD_APPEND(R, NM, VAL) {R += NM + "=" + VAL + "\n";}
 
 // Add document in internal form to the database: index the terms in
 // the title abstract and body and add special terms for file name,
@@ -1503,7 +2180,8 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
     // Udi unique term: this is used for file existence/uptodate
     // checks, and unique id for the replace_document() call.
     string uniterm = make_uniterm(udi);
-    string rawztext; // Doc compressed text
+    string storedtext; // Doc text to be stored, compressed by the writer
+    string fwdidx; // Forward index to be stored
 
     if (doc.onlyxattr) {
 	// Only updating an existing doc with new extended attributes
@@ -1623,9 +2301,7 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 	    LOGDEB("Db::addOrUpdate: split failed for main text\n");
         } else {
             if (m_ndb->m_storetext) {
-                ZLibUtBuf buf;
-                deflateToBuf(doc.text.c_str(), doc.text.size(), buf);
-                rawztext.assign(buf.getBuf(), buf.getCnt());
+                storedtext = doc.text;
             }
         }
 
@@ -1645,6 +2321,12 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 	}
 #endif
 
+        // Without the stored text, the snippets are built from the
+        // index data. The forward index makes this much faster.
+        if (m_ndb->m_storefwdidx && !m_ndb->m_storetext) {
+            docForwardIndex(newdocument, baseTextPosition, fwdidx);
+        }
+
 	////// Special terms for other metadata. No positions for these.
 	// Mime type
 	newdocument.add_boolean_term(wrap_prefix(mimetype_prefix) + doc.mimetype);
@@ -1714,22 +2396,22 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 	// record can keep a simple syntax)
 
 	string record;
-	RECORD_APPEND(record, Doc::keyurl, doc.url);
-	RECORD_APPEND(record, Doc::keytp, doc.mimetype);
+	dataRecordAppend(record, Doc::keyurl, doc.url);
+	dataRecordAppend(record, Doc::keytp, doc.mimetype);
 	// We left-zero-pad the times so that they are lexico-sortable
 	leftzeropad(doc.fmtime, 11);
-	RECORD_APPEND(record, Doc::keyfmt, doc.fmtime);
+	dataRecordAppend(record, Doc::keyfmt, doc.fmtime);
 	if (!doc.dmtime.empty()) {
 	    leftzeropad(doc.dmtime, 11);
-	    RECORD_APPEND(record, Doc::keydmt, doc.dmtime);
+	    dataRecordAppend(record, Doc::keydmt, doc.dmtime);
 	}
-	RECORD_APPEND(record, Doc::keyoc, doc.origcharset);
+	dataRecordAppend(record, Doc::keyoc, doc.origcharset);
 
 	if (doc.fbytes.empty())
 	    doc.fbytes = doc.pcbytes;
 
 	if (!doc.fbytes.empty()) {
-	    RECORD_APPEND(record, Doc::keyfs, doc.fbytes);
+	    dataRecordAppend(record, Doc::keyfs, doc.fbytes);
 	    leftzeropad(doc.fbytes, 12);
 	    newdocument.add_value(VALUE_SIZE, doc.fbytes);
 	}
@@ -1737,26 +2419,26 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 	    newdocument.add_boolean_term(has_children_term);
 	}	
 	if (!doc.pcbytes.empty())
-	    RECORD_APPEND(record, Doc::keypcs, doc.pcbytes);
+	    dataRecordAppend(record, Doc::keypcs, doc.pcbytes);
 	char sizebuf[30]; 
 	sprintf(sizebuf, "%u", (unsigned int)doc.text.length());
-	RECORD_APPEND(record, Doc::keyds, sizebuf);
+	dataRecordAppend(record, Doc::keyds, sizebuf);
 
 	// Note that we add the signature both as a value and in the data record
 	if (!doc.sig.empty()) {
-	    RECORD_APPEND(record, Doc::keysig, doc.sig);
+	    dataRecordAppend(record, Doc::keysig, doc.sig);
 	    newdocument.add_value(VALUE_SIG, doc.sig);
 	}
 
 	if (!doc.ipath.empty())
-	    RECORD_APPEND(record, Doc::keyipt, doc.ipath);
+	    dataRecordAppend(record, Doc::keyipt, doc.ipath);
 
         // Fields from the Meta array. Handle title specially because it has a 
         // different name inside the data record (history...)
         string& ttref = doc.meta[Doc::keytt];
         ttref = neutchars(truncate_to_word(ttref, m_idxMetaStoredLen), cstr_nc);
 	if (!ttref.empty()) {
-	    RECORD_APPEND(record, cstr_caption, ttref);
+	    dataRecordAppend(record, cstr_caption, ttref);
             ttref.clear();
         }
 
@@ -1781,7 +2463,7 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
             // Do the append here to avoid the different truncation done
             // in the regular "stored" loop
             if (!absref.empty()) {
-                RECORD_APPEND(record, Doc::keyabs, absref);
+                dataRecordAppend(record, Doc::keyabs, absref);
                 absref.clear();
             }
         }
@@ -1795,7 +2477,7 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 		string value = 
 		    neutchars(truncate_to_word(doc.meta[nm], 
                                                m_idxMetaStoredLen), cstr_nc);
-		RECORD_APPEND(record, nm, value);
+		dataRecordAppend(record, nm, value);
 	    }
 	}
 
@@ -1810,7 +2492,7 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 		string value = 
 		    neutchars(truncate_to_word(*fnp, 
                                                m_idxMetaStoredLen), cstr_nc);
-		RECORD_APPEND(record, Rcl::Doc::keyfn, value);
+		dataRecordAppend(record, Rcl::Doc::keyfn, value);
             }
         }
 
@@ -1825,7 +2507,7 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 		multibreaks << tpidx.m_pageincrvec[i].first << "," << 
 		    tpidx.m_pageincrvec[i].second;
 	    }
-	    RECORD_APPEND(record, string(cstr_mbreaks), multibreaks.str());
+	    dataRecordAppend(record, string(cstr_mbreaks), multibreaks.str());
 	}
     
 	// If the file's md5 was computed, add value and term. 
@@ -1841,15 +2523,35 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 	    newdocument.add_boolean_term(wrap_prefix("XM") + *md5);
 	}
 
-	LOGDEB0("Rcl::Db::add: new doc record:\n" << record << "\n");
+	// Sort values, so that sorting the results on the usual fields
+	// does not need to fetch and parse the data records.
+	newdocument.add_value(VALUE_SORTMTIME,
+                              doc.dmtime.empty() ? doc.fmtime : doc.dmtime);
+	string sortsize(sizebuf);
+	leftzeropad(sortsize, 12);
+	newdocument.add_value(VALUE_SORTDBYTES, sortsize);
+	string sortfld;
+	if (dataRecordGet(record, cstr_caption, sortfld))
+	    newdocument.add_value(VALUE_SORTTITLE,
+                                  sort_key_from_string(sortfld));
+	if (dataRecordGet(record, Doc::keyfn, sortfld))
+	    newdocument.add_value(VALUE_SORTFN, sort_key_from_string(sortfld));
+
+	LOGDEB0("Rcl::Db::add: new doc record:\n" << dataRecordToText(record) <<
+                "\n");
 	newdocument.set_data(record);
     }
 #ifdef IDX_THREADS
     if (m_ndb->m_havewriteq) {
 	DbUpdTask *tp = new DbUpdTask(
             DbUpdTask::AddOrUpdate, udi, uniterm, newdocument_ptr,
-            doc.text.length(), rawztext);
-	if (!m_ndb->m_wqueue.put(tp)) {
+            doc.text.length(), storedtext);
+        tp->fwdidx.swap(fwdidx);
+        // In sharded mode, subdocuments go with their parent file
+        WorkQueue<DbUpdTask*>& wqueue = m_ndb->m_shards.empty() ?
+            m_ndb->m_wqueue :
+            m_ndb->shardFor(parent_udi.empty() ? udi : parent_udi)->wqueue;
+	if (!wqueue.put(tp)) {
 	    LOGERR("Db::addOrUpdate:Cant queue task\n");
             delete newdocument_ptr;
 	    return false;
@@ -1860,7 +2562,7 @@ bool Db::addOrUpdate(const string &udi, const string &parent_udi, Doc &doc)
 #endif
 
     return m_ndb->addOrUpdateWrite(udi, uniterm, newdocument_ptr,
-				   doc.text.length(), rawztext);
+				   doc.text.length(), storedtext, fwdidx);
 }
 
 bool Db::Native::docToXdocXattrOnly(TextSplitDb *splitter, const string &udi, 
@@ -1905,10 +2607,17 @@ bool Db::Native::docToXdocXattrOnly(TextSplitDb *splitter, const string &udi,
     xdoc.add_value(VALUE_SIG, doc.sig);
 
     // Parse current data record into a dict for ease of processing
-    ConfSimple datadic(data);
-    if (!datadic.ok()) {
-	LOGERR("db::docToXdocXattrOnly: failed turning data rec to dict\n");
-	return false;
+    map<string, string> datadic;
+    {
+        DataRecordReader reader(data);
+        string name, value;
+        while (reader.next(name, value)) {
+            datadic[name] = value;
+        }
+        if (!reader.ok()) {
+            LOGERR("db::docToXdocXattrOnly: bad data record\n");
+            return false;
+        }
     }
 
     // For each "stored" field, check if set in doc metadata and
@@ -1921,21 +2630,20 @@ bool Db::Native::docToXdocXattrOnly(TextSplitDb *splitter, const string &udi,
 	    string value = neutchars(
                 truncate_to_word(doc.meta[nm], m_rcldb->m_idxMetaStoredLen), 
                 cstr_nc);
-	    datadic.set(nm, value, "");
+	    datadic[nm] = value;
 	}
     }
+    datadic[Doc::keysig] = doc.sig;
+    auto fnit = datadic.find(Doc::keyfn);
+    if (fnit != datadic.end()) {
+        xdoc.add_value(VALUE_SORTFN, sort_key_from_string(fnit->second));
+    }
 
-    // Recreate the record. We want to do this with the local RECORD_APPEND
-    // method for consistency in format, instead of using ConfSimple print
-    vector<string> names = datadic.getNames("");
+    // Recreate the record (in the current format)
     data.clear();
-    for (vector<string>::const_iterator it = names.begin(); 
-	 it != names.end(); it++) {
-	string value;
-	datadic.get(*it, value, "");
-	RECORD_APPEND(data, *it, value);
+    for (const auto& ent : datadic) {
+	dataRecordAppend(data, ent.first, ent.second);
     }
-    RECORD_APPEND(data, Doc::keysig, doc.sig);
     xdoc.set_data(data);
     return true;
 }
@@ -1943,13 +2651,18 @@ bool Db::Native::docToXdocXattrOnly(TextSplitDb *splitter, const string &udi,
 #ifdef IDX_THREADS
 void Db::waitUpdIdle()
 {
+    if (m_ndb->m_iswritable && !m_ndb->m_shards.empty()) {
+        m_ndb->commitShards();
+        return;
+    }
     if (m_ndb->m_iswritable && m_ndb->m_havewriteq) {
 	Chrono chron;
 	m_ndb->m_wqueue.waitIdle();
 	// We flush here just for correct measurement of the thread work time
 	string ermsg;
 	try {
-	    m_ndb->xwdb.commit();
+            if (m_idleCommit)
+                m_ndb->xwdb.commit();
 	} XCATCHERROR(ermsg);
 	if (!ermsg.empty()) {
 	    LOGERR("Db::waitUpdIdle: flush() failed: " << ermsg << "\n");
@@ -1981,6 +2694,16 @@ bool Db::doFlush()
 	LOGERR("Db::doFLush: no ndb??\n");
 	return false;
     }
+#ifdef IDX_THREADS
+    // Shards are only used by one-shot runs which make the documents
+    // visible when closing, just save memory here.
+    if (!m_ndb->m_shards.empty()) {
+        if (!m_ndb->commitShards())
+            return false;
+        m_flushtxtsz = m_curtxtsz;
+        return true;
+    }
+#endif
     string ermsg;
     try {
 	m_ndb->xwdb.commit();
@@ -2023,6 +2746,17 @@ void Db::i_setExistingFlags(const string& udi, unsigned int docid)
         updated[docid] = true;
     }
 
+    if (m_ndb->m_havesnap) {
+        auto it = m_ndb->m_subdocsnap.find(docid);
+        if (it != m_ndb->m_subdocsnap.end()) {
+            for (auto sdocid : it->second) {
+                if (sdocid < updated.size())
+                    updated[sdocid] = true;
+            }
+        }
+        return;
+    }
+
     // Set the existence flag for all the subdocs (if any)
     vector<Xapian::docid> docids;
     if (!m_ndb->subDocs(udi, 0, docids)) {
@@ -2059,6 +2793,33 @@ bool Db::needUpdate(const string &udi, const string& sig,
 	return true;
     }
 
+    if (m_ndb->m_havesnap) {
+        // Check against the in-memory data: no index access, and no
+        // locking except for setting the flags.
+        auto it = m_ndb->m_udisnap.find(udi);
+        if (it == m_ndb->m_udisnap.end()) {
+            LOGDEB("Db::needUpdate:yes (new): [" << udi << "]\n");
+            return true;
+        }
+        if (docidp) {
+            *docidp = it->second.docid;
+        }
+        if (osigp) {
+            *osigp = it->second.sig;
+        }
+        if (sig != it->second.sig) {
+            LOGDEB("Db::needUpdate:yes: olsig [" << it->second.sig <<
+                   "] new [" << sig << "] [" << udi << "]\n");
+            return true;
+        }
+        LOGDEB("Db::needUpdate:no: [" << udi << "]\n");
+#ifdef IDX_THREADS
+        std::unique_lock<std::mutex> lock(m_ndb->m_mutex);
+#endif
+        i_setExistingFlags(udi, it->second.docid);
+        return false;
+    }
+
     string uniterm = make_uniterm(udi);
     string ermsg;
 
@@ -2122,6 +2883,69 @@ bool Db::needUpdate(const string &udi, const string& sig,
     return false;
 }
 
+bool Db::preloadUpdateData()
+{
+    if (m_ndb == 0 || !m_ndb->m_isopen)
+        return false;
+    // Nothing to check against in these cases.
+    if (inFullReset())
+        return true;
+
+#ifdef IDX_THREADS
+    std::unique_lock<std::mutex> lock(m_ndb->m_mutex);
+#endif
+    Chrono chron;
+    m_ndb->m_havesnap = false;
+    m_ndb->m_udisnap.clear();
+    m_ndb->m_subdocsnap.clear();
+    Xapian::Database& xrdb = m_ndb->xrdb;
+    string ermsg;
+    try {
+        // Read the signatures in docid order, then walk the udi terms
+        // (one per document), and the parent terms.
+        vector<string> sigs(xrdb.get_lastdocid() + 1);
+        for (Xapian::ValueIterator vit = xrdb.valuestream_begin(VALUE_SIG);
+             vit != xrdb.valuestream_end(VALUE_SIG); vit++) {
+            if (vit.get_docid() < sigs.size())
+                sigs[vit.get_docid()] = *vit;
+        }
+        m_ndb->m_udisnap.reserve(xrdb.get_doccount());
+        string pfx = wrap_prefix(udi_prefix);
+        for (Xapian::TermIterator it = xrdb.allterms_begin(pfx);
+             it != xrdb.allterms_end(pfx); it++) {
+            Xapian::PostingIterator docid = xrdb.postlist_begin(*it);
+            if (docid == xrdb.postlist_end(*it) || *docid >= sigs.size())
+                continue;
+            Native::UpdSnapEntry& ent =
+                m_ndb->m_udisnap[(*it).substr(pfx.size())];
+            ent.docid = *docid;
+            ent.sig.swap(sigs[*docid]);
+        }
+        pfx = wrap_prefix(parent_prefix);
+        for (Xapian::TermIterator it = xrdb.allterms_begin(pfx);
+             it != xrdb.allterms_end(pfx); it++) {
+            auto pit = m_ndb->m_udisnap.find((*it).substr(pfx.size()));
+            if (pit == m_ndb->m_udisnap.end())
+                continue;
+            vector<Xapian::docid>& docids =
+                m_ndb->m_subdocsnap[pit->second.docid];
+            docids.insert(docids.end(), xrdb.postlist_begin(*it),
+                          xrdb.postlist_end(*it));
+        }
+    } XCATCHERROR(ermsg);
+    if (!ermsg.empty()) {
+        LOGERR("Db::preloadUpdateData: " << ermsg << "\n");
+        m_ndb->m_udisnap.clear();
+        m_ndb->m_subdocsnap.clear();
+        return false;
+    }
+    m_ndb->m_havesnap = true;
+    LOGINFO("Db::preloadUpdateData: " << m_ndb->m_udisnap.size() <<
+            " documents, " << m_ndb->m_subdocsnap.size() <<
+            " with subdocs, loaded in " << chron.millis() << " mS\n");
+    return true;
+}
+
 // Return existing stem db languages
 vector<string> Db::getStemLangs()
 {
@@ -2180,6 +3004,10 @@ bool Db::purge()
 	return false;
 
 #ifdef IDX_THREADS
+    // Sharded writes only happen when building a new index: nothing
+    // can need purging. The shards are merged by close()
+    if (!m_ndb->m_shards.empty())
+        return true;
     // If we manage our own write queue, make sure it's drained and closed
     if (m_ndb->m_havewriteq)
 	m_ndb->m_wqueue.setTerminateAndWait();
@@ -2296,7 +3124,9 @@ bool Db::purgeFile(const string &udi, bool *existed)
         string rztxt;
 	DbUpdTask *tp = new DbUpdTask(DbUpdTask::Delete, udi, uniterm, 
 				      0, (size_t)-1, rztxt);
-	if (!m_ndb->m_wqueue.put(tp)) {
+        WorkQueue<DbUpdTask*>& wqueue = m_ndb->m_shards.empty() ?
+            m_ndb->m_wqueue : m_ndb->shardFor(udi)->wqueue;
+	if (!wqueue.put(tp)) {
 	    LOGERR("Db::purgeFile:Cant queue task\n");
 	    return false;
 	} else {
@@ -2324,7 +3154,9 @@ bool Db::purgeOrphans(const string &udi)
         string rztxt;
 	DbUpdTask *tp = new DbUpdTask(DbUpdTask::PurgeOrphans, udi, uniterm, 
 				      0, (size_t)-1, rztxt);
-	if (!m_ndb->m_wqueue.put(tp)) {
+        WorkQueue<DbUpdTask*>& wqueue = m_ndb->m_shards.empty() ?
+            m_ndb->m_wqueue : m_ndb->shardFor(udi)->wqueue;
+	if (!wqueue.put(tp)) {
 	    LOGERR("Db::purgeFile:Cant queue task\n");
 	    return false;
 	} else {
@@ -2364,21 +3196,17 @@ bool Db::dbStats(DbStats& res, bool listfailed)
                     continue;
                 }
                 string data = doc.get_data();
-                ConfSimple parms(data);
-                if (!parms.ok()) {
-                } else {
-                    string url, ipath;
-                    parms.get(Doc::keyipt, ipath);
-                    parms.get(Doc::keyurl, url);
-                    // Turn to local url or not? It seems to make more
-                    // sense to keep the original urls as seen by the
-                    // indexer.
-                    // m_config->urlrewrite(dbdir, url);
-                    if (!ipath.empty()) {
-                        url += " | " + ipath;
-                    }
-                    res.failedurls.push_back(url);
+                string url, ipath;
+                dataRecordGet(data, Doc::keyipt, ipath);
+                dataRecordGet(data, Doc::keyurl, url);
+                // Turn to local url or not? It seems to make more
+                // sense to keep the original urls as seen by the
+                // indexer.
+                // m_config->urlrewrite(dbdir, url);
+                if (!ipath.empty()) {
+                    url += " | " + ipath;
                 }
+                res.failedurls.push_back(url);
             } catch (Xapian::DocNotFoundError) {
                 continue;
             }
@@ -2602,4 +3430,39 @@ bool Db::udiTreeMarkExisting(const string& udi)
     return ret;
 }
 
+bool Db::udiTreeList(const string& udi, string& resume, size_t max,
+                     vector<string>& udis)
+{
+    LOGDEB("Db::udiTreeList: " << udi << " after [" << resume << "]\n");
+    if (nullptr == m_ndb || !m_ndb->m_isopen)
+        return false;
+    string wrapd = wrap_prefix(udi_prefix);
+    string pfx = make_uniterm(udi);
+
+#ifdef IDX_THREADS
+    std::unique_lock<std::mutex> lock(m_ndb->m_mutex);
+#endif
+    Xapian::Database& xrdb = m_ndb->xrdb;
+    string ermsg;
+    try {
+        Xapian::TermIterator it = xrdb.allterms_begin(pfx);
+        if (!resume.empty()) {
+            string rterm = make_uniterm(resume);
+            it.skip_to(rterm);
+            if (it != xrdb.allterms_end(pfx) && *it == rterm)
+                it++;
+        }
+        for (; it != xrdb.allterms_end(pfx) && udis.size() < max; it++) {
+            udis.push_back((*it).substr(wrapd.size()));
+        }
+    } XCATCHERROR(ermsg);
+    if (!ermsg.empty()) {
+        LOGERR("Db::udiTreeList: " << ermsg << "\n");
+        return false;
+    }
+    if (!udis.empty())
+        resume = udis.back();
+    return true;
+}
+
 } // End namespace Rcl
@@ -70,6 +70,12 @@ enum value_slot {
     ////////// Recoll only:
     // Doc sig as chosen by app (ex: mtime+size
     VALUE_SIG = 10,
+    // Sort keys, used by Query::setSortBy() if the index descriptor
+    // says that they are present.
+    VALUE_SORTMTIME = 11, // dmtime if set else fmtime, 0-padded
+    VALUE_SORTDBYTES = 12, // Text size, 0-padded
+    VALUE_SORTTITLE = 13, // Title collation key
+    VALUE_SORTFN = 14, // File name collation key
 };
 
 class SearchData;
@@ -262,6 +268,14 @@ public:
     bool needUpdate(const string &udi, const string& sig, 
                     unsigned int *xdocid = 0, std::string *osig = 0);
 
+    /** Load the update check data for all documents (udi, signature,
+     * subdocuments) in memory, so that the following needUpdate() calls
+     * do not need to access the index. This is only worth it for an
+     * incremental pass over a big tree where few files have changed.
+     * The data reflects the index at the time of the call.
+     */
+    bool preloadUpdateData();
+
     /** Set the existance flags for the document and its eventual subdocuments
      * 
      * This can be called by the indexer after needUpdate() has returned true,
@@ -480,6 +494,21 @@ public:
         m_flushMb = mb;
     }
     bool doFlush();
+    /** Commit the index when the update queue gets idle (the
+        default), or leave this to explicit doFlush() calls. The
+        latter is used by the monitor long-lived writer session */
+    void setIdleCommit(bool onoff) {
+        m_idleCommit = onoff;
+    }
+
+    /** Allow using concurrent write shards if the index is empty
+        when opened for writing. The shards are only merged into the
+        index when it is closed, and nothing is visible before, so
+        this is only set for one-shot full indexing runs. Evaluated
+        by open(). */
+    void setShardedWrite(bool onoff) {
+        m_shardedWrite = onoff;
+    }
 
     // Use empty fn for no synonyms
     bool setSynGroupsFile(const std::string& fn);
@@ -491,6 +520,13 @@ public:
     // currently unmounted (topdir does not exist or is empty.
     bool udiTreeMarkExisting(const string& udi);
 
+    // List the UDIs having input as prefix, in index order, by chunks
+    // of at most max. resume is the last UDI of the previous chunk
+    // (empty for the first one), it is updated. The list is empty at
+    // the end. Used by the real time indexer to walk big trees by steps.
+    bool udiTreeList(const string& udi, string& resume, size_t max,
+                     vector<string>& udis);
+
     /* This has to be public for access by embedded Query::Native */
     Native *m_ndb; 
 private:
@@ -546,6 +582,10 @@ private:
     int          m_synthAbsWordCtxLen;
     // Flush threshold. Megabytes of text indexed before we flush.
     int          m_flushMb;
+    // Commit in waitUpdIdle()
+    bool         m_idleCommit{true};
+    // Write shards allowed for a new index
+    bool         m_shardedWrite{false};
     // Maximum file system occupation percentage
     int          m_maxFsOccupPc;
     // Database directory
@@ -21,7 +21,10 @@
 #include "autoconfig.h"
 
 #include <mutex>
+#include <memory>
 #include <functional>
+#include <map>
+#include <unordered_map>
 
 #include <xapian.h>
 
@@ -29,6 +32,7 @@
 #include "workqueue.h"
 #endif // IDX_THREADS
 #include "xmacros.h"
+#include "rclztext.h"
 
 
 namespace Rcl {
@@ -42,8 +46,8 @@ class Query;
 //  - purgeOrphans when a multidoc file is updated during a partial pass (no 
 //    general purge). We want to remove subDocs that possibly don't
 //    exist anymore. We find them by their different sig
-// txtlen and doc are only valid for add/update else, len is (size_t)-1 and doc
-// is empty
+// txtlen, doc and text are only valid for add/update else, len is
+// (size_t)-1 and doc is empty
 class DbUpdTask {
 public:
     enum Op {AddOrUpdate, Delete, PurgeOrphans};
@@ -52,10 +56,10 @@ public:
     // available on the caller site.
     // Take some care to avoid sharing string data (if string impl is cow)
     DbUpdTask(Op _op, const string& ud, const string& un, 
-	      Xapian::Document *d, size_t tl, string& rztxt)
+	      Xapian::Document *d, size_t tl, string& txt)
         : op(_op), udi(ud.begin(), ud.end()), uniterm(un.begin(), un.end()), 
           doc(d), txtlen(tl) {
-        rawztext.swap(rztxt);
+        text.swap(txt);
     }
     // Udi and uniterm equivalently designate the doc
     Op op;
@@ -66,7 +70,34 @@ public:
     // purge because we actually don't know it, and the code fakes a
     // text length based on the term count.
     size_t txtlen;
-    string rawztext; // Compressed doc text
+    // Doc text to be stored, if any. It is compressed by the worker
+    string text;
+    // Forward index to be stored, if any
+    string fwdidx;
+};
+
+// Temporary index used by one of the write threads when creating a new
+// index with several of them (last value of thrTCounts > 1). Each
+// shard has its own queue and thread. Tasks are routed by the udi of
+// the file-level document, so that a file and its subdocuments always
+// land in the same shard. The shards are merged into the main index
+// when it is closed.
+class DbWriteShard {
+public:
+    DbWriteShard(Db::Native *n, int i, const string& d, int qlen)
+        : ndb(n), idx(i), dir(d), 
+          wqueue(string("DbUpdShard") + std::to_string(i), qlen) {}
+    Db::Native *ndb;
+    int idx;
+    string dir;
+    Xapian::WritableDatabase xwdb;
+    WorkQueue<DbUpdTask*> wqueue;
+    // Held by the worker while updating xwdb, and by the main thread
+    // when committing.
+    std::mutex mutex;
+    int64_t curtxtsz{0};
+    int64_t flushtxtsz{0};
+    long long totalworkns{0};
 };
 #endif // IDX_THREADS
 
@@ -83,14 +114,48 @@ class Db::Native {
     bool m_iswritable;
     bool m_noversionwrite; //Set if open failed because of version mismatch!
     bool m_storetext{false};
+    // Compression of the stored document texts
+    ZTextCodec m_ztext;
+    // Codecs for the extra query indexes, which have their own
+    // dictionaries. Created on first use.
+    std::vector<std::unique_ptr<ZTextCodec>> m_extracodecs;
+    std::mutex m_extracodecsmutex;
+    ZTextCodec *extraCodec(size_t dbidx);
+    // Store per-document forward indexes (if the text is not stored)
+    bool m_storefwdidx{false};
+    // All documents in the index(es) have the sort values
+    // (VALUE_SORTXX), so that Query can use them instead of QSorter.
+    bool m_sortvalues{false};
 #ifdef IDX_THREADS
     WorkQueue<DbUpdTask*> m_wqueue;
     std::mutex m_mutex;
     long long  m_totalworkns;
     bool m_havewriteq;
-    void maybeStartThreads();
+    std::vector<DbWriteShard*> m_shards;
+    void maybeStartThreads(const string& dir);
+    // Sharded write mode: start the shards, route and execute tasks,
+    // commit, and finally merge them into the main index.
+    bool startShards(const string& dir, int cnt, int qlen);
+    DbWriteShard *shardFor(const string& udi);
+    bool shardWrite(DbWriteShard *shp, DbUpdTask *tsk);
+    bool commitShards();
+    bool mergeShards(const string& dir);
 #endif // IDX_THREADS
 
+    // Snapshot of the udi -> (docid, signature) associations and of the
+    // subdocuments lists, optionally loaded at the start of an
+    // incremental pass (Db::preloadUpdateData()), so that needUpdate()
+    // does not need to access the index. It reflects the index state
+    // at load time and is not modified afterwards, so it can be read
+    // without locking.
+    struct UpdSnapEntry {
+        Xapian::docid docid;
+        string sig;
+    };
+    bool m_havesnap{false};
+    std::unordered_map<string, UpdSnapEntry> m_udisnap;
+    std::unordered_map<Xapian::docid, std::vector<Xapian::docid> > m_subdocsnap;
+
     // Indexing 
     Xapian::WritableDatabase xwdb;
     // Querying (active even if the wdb is too)
@@ -101,19 +166,42 @@ class Db::Native {
 
 #ifdef IDX_THREADS
     friend void *DbUpdWorker(void*);
+    friend void *DbShardWorker(void*);
 #endif // IDX_THREADS
 
     void openWrite(const std::string& dir, Db::OpenMode mode);
+    // Create new index, possibly forcing the backend, depending on config.
+    Xapian::WritableDatabase createNewDb(const string& dir,
+                                         const string& stubname, int action);
+
+    // Fail if the file system occupation exceeds the configured maximum.
+    // Called with m_mutex held when threaded.
+    bool checkFsOccup();
     void openRead(const string& dir);
+    /** Open a new handle on the same indexes as xrdb (main and
+     * additional), so that the docids are the same. Xapian objects
+     * can't be shared between threads, this is for use by worker
+     * threads (which must also destroy it). Throws Xapian errors. */
+    Xapian::Database openReadClone();
 
     // Determine if an existing index is of the full-text-storing kind
-    // by looking at the index metadata. Stores the result in m_storetext
+    // by looking at the index metadata. Stores the result in
+    // m_storetext, and loads the text compression dictionary if any.
     void storesDocText(Xapian::Database&);
+    // Get a boolean option from the index descriptor
+    static bool descriptorFlag(Xapian::Database& db, const string& name);
+    // Descriptor for a new index, from our current options
+    string newDescriptor();
+    /** Value slot holding the sort keys for a data record field
+     * (e.g. caption, dmtime), or Xapian::BAD_VALUENO */
+    Xapian::valueno sortValueSlot(const string& fld);
     
-    // Final steps of doc update, part which need to be single-threaded
+    // Final steps of doc update, part which need to be
+    // single-threaded. The text to be stored is compressed before
+    // entering the single-threaded section.
     bool addOrUpdateWrite(const string& udi, const string& uniterm, 
 			  Xapian::Document *doc, size_t txtlen
-                          , const string& rawztext);
+                          , const string& text, const string& fwdidx);
 
     /** Delete all documents which are contained in the input document, 
      * which must be a file-level one.
@@ -129,7 +217,11 @@ class Db::Native {
     bool purgeFileWrite(bool onlyOrphans, const string& udi, 
 			const string& uniterm);
 
-    bool getPagePositions(Xapian::docid docid, vector<int>& vpos);
+    // The optional xdbp parameter to these and getRawText(),
+    // fwdIdxPopulate(), designates a handle to use instead of xrdb
+    // (see openReadClone()).
+    bool getPagePositions(Xapian::docid docid, vector<int>& vpos,
+                          Xapian::Database *xdbp = nullptr);
     int getPageNumberForPosition(const vector<int>& pbreaks, int pos);
 
     bool dbDataToRclDoc(Xapian::docid docid, std::string &data, Doc &doc,
@@ -205,11 +297,26 @@ class Db::Native {
         return buf;
     }
 
-    bool getRawText(Xapian::docid docid, string& rawtext);
+    bool getRawText(Xapian::docid docid, string& rawtext,
+                    Xapian::Database *xdbp = nullptr);
+
+    std::string fwdidxMetaKey(Xapian::docid did) {
+        return "RCLFWD:" + rawtextMetaKey(did);
+    }
+
+    /** Populate the empty slots of a sparse document (as built for
+     * abstract generation), up to maxpos, from the document forward
+     * index: this associates each text position with the
+     * alphabetically first unprefixed term indexed at this position.
+     * @return false if the document has no forward index. */
+    bool fwdIdxPopulate(Xapian::docid docid, unsigned int maxpos,
+                        std::map<unsigned int, std::string>& sparseDoc,
+                        Xapian::Database *xdbp = nullptr);
 
     void deleteDocument(Xapian::docid docid) {
         string metareason;
-        XAPTRY(xwdb.set_metadata(rawtextMetaKey(docid), string()),
+        XAPTRY(xwdb.set_metadata(rawtextMetaKey(docid), string());
+               xwdb.set_metadata(fwdidxMetaKey(docid), string()),
                xwdb, metareason);
         if (!metareason.empty()) {
             LOGERR("deleteDocument: set_metadata error: " <<
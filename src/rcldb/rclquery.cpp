@@ -22,6 +22,8 @@
 
 #include <vector>
 #include <sstream>
+#include <thread>
+#include <atomic>
 
 #include "xapian.h"
 
@@ -32,6 +34,8 @@
 #include "rcldb_p.h"
 #include "rclquery.h"
 #include "rclquery_p.h"
+#include "rcldatarec.h"
+#include "rclvalues.h"
 #include "conftree.h"
 #include "smallut.h"
 #include "chrono.h"
@@ -71,41 +75,26 @@ class QSorter : public Xapian::KeyMaker
 {
 public:
     QSorter(const string& f) 
-        : m_fld(docfToDatf(f) + "=") {
-        m_ismtime = !m_fld.compare("dmtime=");
+        : m_fld(docfToDatf(f)) {
+        m_ismtime = !m_fld.compare(cstr_dmtime);
         if (m_ismtime)
             m_issize = false;
         else 
-            m_issize = !m_fld.compare("fbytes=") || !m_fld.compare("dbytes=") ||
-                !m_fld.compare("pcbytes=");
+            m_issize = !m_fld.compare(Doc::keyfs) ||
+                !m_fld.compare(Doc::keyds) || !m_fld.compare(Doc::keypcs);
     }
 
     virtual std::string operator()(const Xapian::Document& xdoc) const {
         string data = xdoc.get_data();
         // It would be simpler to do the record->Rcl::Doc thing, but
-        // hand-doing this will be faster. It makes more assumptions
-        // about the format than a ConfTree though:
-        string::size_type i1, i2;
-        i1 = data.find(m_fld);
-        if (i1 == string::npos) {
-            if (m_ismtime) {
-                // Ugly: specialcase mtime as it's either dmtime or fmtime
-                i1 = data.find("fmtime=");
-                if (i1 == string::npos) {
-                    return string();
-                }
-            } else {
+        // just extracting the field is faster.
+        string term;
+        if (!dataRecordGet(data, m_fld, term)) {
+            // Ugly: specialcase mtime as it's either dmtime or fmtime
+            if (!m_ismtime || !dataRecordGet(data, Doc::keyfmt, term)) {
                 return string();
             }
         }
-        i1 += m_fld.length();
-        if (i1 >= data.length())
-            return string();
-        i2 = data.find_first_of("\n\r", i1);
-        if (i2 == string::npos)
-            return string();
-
-        string term = data.substr(i1, i2-i1);
         if (m_ismtime) {
             return term;
         } else if (m_issize) {
@@ -114,22 +103,9 @@ public:
             return term;
         }
 
-        // Process data for better sorting. We should actually do the
-        // unicode thing
-        // (http://unicode.org/reports/tr10/#Introduction), but just
-        // removing accents and majuscules will remove the most
-        // glaring weirdnesses (or not, depending on your national
-        // approach to collating...)
-        string sortterm;
-        // We're not even sure the term is utf8 here (ie: url)
-        if (!unacmaybefold(term, sortterm, "UTF-8", UNACOP_UNACFOLD)) {
-            sortterm = term;
-        }
-        // Also remove some common uninteresting starting characters
-        i1 = sortterm.find_first_not_of(" \t\\\"'([*+,.#/");
-        if (i1 != 0 && i1 != string::npos) {
-            sortterm = sortterm.substr(i1, sortterm.size()-i1);
-        }
+        // Process data for better sorting. This is also used for
+        // computing the sort values at index time.
+        string sortterm = sort_key_from_string(term);
 
         LOGDEB2("QSorter: [" << term << "] -> [" << sortterm << "]\n");
         return sortterm;
@@ -143,10 +119,13 @@ private:
 
 Query::Query(Db *db)
     : m_nq(new Native(this)), m_db(db), m_sorter(0), m_sortAscending(true),
-      m_collapseDuplicates(false), m_resCnt(-1), m_snipMaxPosWalk(1000000)
+      m_collapseDuplicates(false), m_resCnt(-1), m_snipMaxPosWalk(1000000),
+      m_snipThreads(0)
 {
-    if (db)
+    if (db) {
         db->getConf()->getConfParam("snippetMaxPosWalk", &m_snipMaxPosWalk);
+        db->getConf()->getConfParam("snippetThreads", &m_snipThreads);
+    }
 }
 
 Query::~Query()
@@ -211,11 +190,22 @@ bool Query::setQuery(std::shared_ptr<SearchData> sdata)
                     delete (QSorter*)m_sorter;
                     m_sorter = 0;
                 }
-                m_sorter = new QSorter(m_sortField);
+                // Use the precomputed sort value if the index has it,
+                // this avoids fetching and parsing the data record
+                // for every matching document.
+                Xapian::valueno slot =
+                    m_db->m_ndb->sortValueSlot(docfToDatf(m_sortField));
                 // It really seems there is a xapian bug about sort order, we 
                 // invert here.
-                m_nq->xenquire->set_sort_by_key((QSorter*)m_sorter, 
-                                                !m_sortAscending);
+                if (slot != Xapian::BAD_VALUENO) {
+                    LOGDEB0("Query::setQuery: sorting on value slot " << slot <<
+                            "\n");
+                    m_nq->xenquire->set_sort_by_value(slot, !m_sortAscending);
+                } else {
+                    m_sorter = new QSorter(m_sortField);
+                    m_nq->xenquire->set_sort_by_key((QSorter*)m_sorter, 
+                                                    !m_sortAscending);
+                }
             }
             m_nq->xenquire->set_query(m_nq->xquery);
             m_nq->xmset = Xapian::MSet();
@@ -276,20 +266,43 @@ int Query::makeDocAbstract(const Doc &doc, vector<Snippet>& abstract,
         return ABSRES_ERROR;
     }
     int ret = ABSRES_ERROR;
-    XAPTRY(ret = m_nq->makeAbstract(doc.xdocid, abstract, maxoccs, ctxwords),
+    if (m_nq->getCachedAbstract(doc.xdocid, maxoccs, ctxwords, abstract, &ret))
+        return ret;
+    vector<Snippet> vabs;
+    XAPTRY(ret = m_nq->makeAbstract(doc.xdocid, vabs, maxoccs, ctxwords),
            m_db->m_ndb->xrdb, m_reason);
     if (!m_reason.empty()) {
         LOGDEB("makeDocAbstract: makeAbstract: reason: " << m_reason << "\n");
         return ABSRES_ERROR;
     }
+    m_nq->cacheAbstract(doc.xdocid, maxoccs, ctxwords, vabs, ret);
+    abstract.insert(abstract.end(), vabs.begin(), vabs.end());
     return ret;
 }
 
-bool Query::makeDocAbstract(const Doc &doc, vector<string>& abstract)
+bool Query::Native::getCachedAbstract(Xapian::docid id, int maxoccs,
+                                      int ctxwords, vector<Snippet>& vabs,
+                                      int *retp)
 {
-    vector<Snippet> vpabs;
-    if (!makeDocAbstract(doc, vpabs))
+    AbsEntry *entry = abscache.get(id);
+    if (nullptr == entry || entry->maxoccs != maxoccs ||
+        entry->ctxwords != ctxwords) {
         return false;
+    }
+    vabs.insert(vabs.end(), entry->snippets.begin(), entry->snippets.end());
+    *retp = entry->ret;
+    return true;
+}
+
+void Query::Native::cacheAbstract(Xapian::docid id, int maxoccs, int ctxwords,
+                                  const vector<Snippet>& vabs, int ret)
+{
+    abscache.put(id, AbsEntry{maxoccs, ctxwords, ret, vabs});
+}
+
+static void snippetsToStrings(const vector<Snippet>& vpabs,
+                              vector<string>& abstract)
+{
     for (vector<Snippet>::const_iterator it = vpabs.begin();
          it != vpabs.end(); it++) {
         string chunk;
@@ -301,9 +314,119 @@ bool Query::makeDocAbstract(const Doc &doc, vector<string>& abstract)
         chunk += it->snippet;
         abstract.push_back(chunk);
     }
+}
+
+bool Query::makeDocAbstract(const Doc &doc, vector<string>& abstract)
+{
+    vector<Snippet> vpabs;
+    if (!makeDocAbstract(doc, vpabs))
+        return false;
+    snippetsToStrings(vpabs, abstract);
     return true;
 }
 
+vector<int> Query::makeDocAbstracts(const vector<Doc>& docs,
+                                    vector<vector<Snippet>>& abstracts,
+                                    int maxoccs, int ctxwords)
+{
+    vector<int> rets(docs.size(), ABSRES_ERROR);
+    abstracts.clear();
+    abstracts.resize(docs.size());
+    if (!m_db || !m_db->m_ndb || !m_db->m_ndb->m_isopen || !m_nq) {
+        LOGERR("Query::makeDocAbstracts: no db or no nq\n");
+        return rets;
+    }
+
+    // Indexes of the docs for which we have no cached abstract
+    vector<unsigned int> todo;
+    for (unsigned int i = 0; i < docs.size(); i++) {
+        if (!m_nq->getCachedAbstract(docs[i].xdocid, maxoccs, ctxwords,
+                                     abstracts[i], &rets[i])) {
+            todo.push_back(i);
+        }
+    }
+
+    unsigned int nthreads = m_snipThreads > 0 ? m_snipThreads :
+        std::thread::hardware_concurrency();
+    if (nthreads > todo.size())
+        nthreads = (unsigned int)todo.size();
+    // A writable index may have uncommitted changes which another
+    // handle would not see.
+    if (nthreads <= 1 || m_db->m_ndb->m_iswritable) {
+        for (auto i : todo) {
+            rets[i] = makeDocAbstract(docs[i], abstracts[i], maxoccs, ctxwords);
+        }
+        return rets;
+    }
+
+    // Compute the data shared by the workers. This is done once per query.
+    XAPTRY(m_nq->setSortedQTerms(); m_nq->setDbWideQTermsFreqs(),
+           m_db->m_ndb->xrdb, m_reason);
+    if (!m_reason.empty()) {
+        LOGERR("makeDocAbstracts: " << m_reason << "\n");
+        return rets;
+    }
+    LOGDEB("makeDocAbstracts: " << docs.size() << " docs, " << nthreads <<
+           " threads\n");
+
+    // The workers pull the next document to process from the common
+    // index, and write to their own slots in rets and abstracts.
+    std::atomic<unsigned int> next(0);
+    vector<std::thread> workers;
+    for (unsigned int t = 0; t < nthreads; t++) {
+        workers.push_back(std::thread([&]() {
+            string reason;
+            try {
+                Xapian::Database xdb = m_db->m_ndb->openReadClone();
+                unsigned int j;
+                while ((j = next++) < todo.size()) {
+                    unsigned int i = todo[j];
+                    XAPTRY(rets[i] = m_nq->makeAbstract(
+                               Xapian::docid(docs[i].xdocid), abstracts[i],
+                               maxoccs, ctxwords, &xdb), xdb, reason);
+                    if (!reason.empty()) {
+                        LOGDEB("makeDocAbstracts: makeAbstract: reason: " <<
+                               reason << "\n");
+                        rets[i] = ABSRES_ERROR;
+                        reason.clear();
+                    }
+                }
+            } XCATCHERROR(reason);
+            if (!reason.empty()) {
+                LOGERR("makeDocAbstracts: can't open index: " << reason <<
+                       "\n");
+            }
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto i : todo) {
+        if (rets[i] != ABSRES_ERROR) {
+            m_nq->cacheAbstract(docs[i].xdocid, maxoccs, ctxwords,
+                                abstracts[i], rets[i]);
+        }
+    }
+    return rets;
+}
+
+bool Query::makeDocAbstracts(const vector<Doc>& docs,
+                             vector<vector<string>>& abstracts)
+{
+    vector<vector<Snippet>> vpabs;
+    vector<int> rets = makeDocAbstracts(docs, vpabs);
+    abstracts.clear();
+    abstracts.resize(docs.size());
+    bool ok = false;
+    for (unsigned int i = 0; i < docs.size(); i++) {
+        if (rets[i] != ABSRES_ERROR) {
+            snippetsToStrings(vpabs[i], abstracts[i]);
+            ok = true;
+        }
+    }
+    return ok || docs.empty();
+}
+
 bool Query::makeDocAbstract(const Doc &doc, string& abstract)
 {
     vector<Snippet> vpabs;
@@ -379,6 +502,17 @@ bool Query::getDoc(int xapi, Doc &doc, bool fetchtext)
         return false;
     }
 
+    // The table view calls us for each cell: avoid fetching and
+    // decoding the data each time. The text is not cached.
+    Doc *cached = m_nq->doccache.get(xapi);
+    if (cached) {
+        doc = *cached;
+        if (fetchtext) {
+            m_db->m_ndb->getRawText(Xapian::docid(doc.xdocid), doc.text);
+        }
+        return true;
+    }
+
     int first = m_nq->xmset.get_firstitem();
     int last = first + m_nq->xmset.size() -1;
 
@@ -450,7 +584,13 @@ bool Query::getDoc(int xapi, Doc &doc, bool fetchtext)
     }
 
     // Parse xapian document's data and populate doc fields
-    return m_db->m_ndb->dbDataToRclDoc(docid, data, doc, fetchtext);
+    if (!m_db->m_ndb->dbDataToRclDoc(docid, data, doc, false))
+        return false;
+    m_nq->doccache.put(xapi, doc);
+    if (fetchtext) {
+        m_db->m_ndb->getRawText(docid, doc.text);
+    }
+    return true;
 }
 
 vector<string> Query::expand(const Doc &doc)
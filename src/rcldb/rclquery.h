@@ -108,6 +108,20 @@ public:
     // Returned as a vector of pair<page,snippet> page is 0 if unknown
     int makeDocAbstract(const Doc &doc, std::vector<Snippet>& abst, 
                         int maxoccs= -1, int ctxwords = -1);
+    /** Build the abstracts for several documents (e.g. a result
+     * page). The work is shared by several threads, each using its
+     * own index handle (see the snippetThreads configuration
+     * variable).
+     * @param[out] abstracts one snippets vector per input document.
+     * @return one ABSRES_XX value per input document, as makeDocAbstract()
+     */
+    std::vector<int> makeDocAbstracts(
+        const std::vector<Doc>& docs,
+        std::vector<std::vector<Snippet>>& abstracts,
+        int maxoccs = -1, int ctxwords = -1);
+    // Same, abstracts returned as strings like makeDocAbstract().
+    bool makeDocAbstracts(const std::vector<Doc>& docs,
+                          std::vector<std::vector<std::string>>& abstracts);
     /** Retrieve page number for first match for "significant" query term 
      *  @param term returns the chosen term */
     int getFirstMatchPage(const Doc &doc, std::string& term);
@@ -139,6 +153,7 @@ private:
     int    m_resCnt;
     std::shared_ptr<SearchData> m_sd;
     int    m_snipMaxPosWalk;
+    int    m_snipThreads;
 
     /* Copyconst and assignement private and forbidden */
     Query(const Query &) {}
@@ -20,15 +20,58 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <list>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <xapian.h>
 #include "rclquery.h"
+#include "rcldoc.h"
 
 class Chrono;
 
 namespace Rcl {
 
+/** Small bounded LRU cache, used for the decoded documents and the
+ * abstracts of the current query */
+template <class K, class V> class QueryLru {
+public:
+    QueryLru(size_t maxsize)
+        : m_maxsize(maxsize) {}
+    /** Return a pointer to the cached value or nullptr. The pointer is
+     * valid until the next put() or clear() */
+    V *get(const K& key) {
+        auto it = m_map.find(key);
+        if (it == m_map.end())
+            return nullptr;
+        m_list.splice(m_list.begin(), m_list, it->second);
+        return &it->second->second;
+    }
+    void put(const K& key, const V& value) {
+        auto it = m_map.find(key);
+        if (it != m_map.end()) {
+            it->second->second = value;
+            m_list.splice(m_list.begin(), m_list, it->second);
+            return;
+        }
+        m_list.push_front(std::pair<K, V>(key, value));
+        m_map[key] = m_list.begin();
+        if (m_list.size() > m_maxsize) {
+            m_map.erase(m_list.back().first);
+            m_list.pop_back();
+        }
+    }
+    void clear() {
+        m_map.clear();
+        m_list.clear();
+    }
+private:
+    size_t m_maxsize;
+    // Most recently used first
+    std::list<std::pair<K, V>> m_list;
+    std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator> m_map;
+};
+
 class Query::Native {
 public:
     // The query I belong to
@@ -42,25 +85,52 @@ public:
     Xapian::MSet xmset;    
     // Term frequencies for current query. See makeAbstract, setQuery
     std::map<std::string, double>  termfreqs; 
+    // Sorted query terms. See setSortedQTerms()
+    std::vector<std::string> sortedqterms;
+    // Decoded documents, by result rank (without the text).
+    QueryLru<int, Doc> doccache;
+    // Computed abstracts, by docid, with the parameters used
+    struct AbsEntry {
+        int maxoccs;
+        int ctxwords;
+        int ret;
+        std::vector<Snippet> snippets;
+    };
+    QueryLru<Xapian::docid, AbsEntry> abscache;
 
     Native(Query *q)
-        : m_q(q), xenquire(0) { }
+        : m_q(q), xenquire(0), doccache(1000), abscache(200) { }
     ~Native() {
         clear();
     }
     void clear() {
         delete xenquire; xenquire = 0;
         termfreqs.clear();
+        sortedqterms.clear();
+        doccache.clear();
+        abscache.clear();
     }
     /** Return a list of terms which matched for a specific result document */
     bool getMatchTerms(unsigned long xdocid, std::vector<std::string>& terms);
+    /** Same, not using the Enquire object. Needs setSortedQTerms() */
+    bool getMatchTerms(Xapian::Database& xdb, Xapian::docid docid,
+                       std::vector<std::string>& terms);
+    void setSortedQTerms();
     int makeAbstract(Xapian::docid id, std::vector<Snippet>&,
-                     int maxoccs = -1, int ctxwords = -1);
+                     int maxoccs = -1, int ctxwords = -1,
+                     Xapian::Database *xdbp = nullptr);
+    /** Look up / store an abstract in the cache. Only called from
+     * the Query's thread */
+    bool getCachedAbstract(Xapian::docid id, int maxoccs, int ctxwords,
+                           std::vector<Snippet>& vabs, int *retp);
+    void cacheAbstract(Xapian::docid id, int maxoccs, int ctxwords,
+                       const std::vector<Snippet>& vabs, int ret);
     int getFirstMatchPage(Xapian::docid docid, std::string& term);
     void setDbWideQTermsFreqs();
     double qualityTerms(Xapian::docid docid, 
                         const std::vector<std::string>& terms,
-                        std::multimap<double, std::vector<std::string> >& byQ);
+                        std::multimap<double, std::vector<std::string> >& byQ,
+                        Xapian::Database *xdbp = nullptr);
     void abstractPopulateQTerm(
         Xapian::Database& xrdb,
         Xapian::docid docid,
@@ -91,6 +161,7 @@ public:
         std::vector<Snippet>& vabs);
     int abstractFromIndex(
         Rcl::Db::Native *ndb,
+        Xapian::Database& xrdb,
         Xapian::docid docid,
         const std::vector<std::string>& matchTerms,
         const std::multimap<double, std::vector<std::string>> byQ,
@@ -102,6 +173,7 @@ public:
         );
     int abstractFromText(
         Rcl::Db::Native *ndb,
+        Xapian::Database& xrdb,
         Xapian::docid docid,
         const std::vector<std::string>& matchTerms,
         const std::multimap<double, std::vector<std::string>> byQ,
@@ -92,6 +92,26 @@ string convert_field_value(const FieldTraits& ft,
     return ndata;
 }
 
+string sort_key_from_string(const string& term)
+{
+    // We should actually do the unicode thing
+    // (http://unicode.org/reports/tr10/#Introduction), but just
+    // removing accents and majuscules will remove the most glaring
+    // weirdnesses (or not, depending on your national approach to
+    // collating...)
+    string sortterm;
+    // We're not even sure the term is utf8 here (ie: url)
+    if (!unacmaybefold(term, sortterm, "UTF-8", UNACOP_UNACFOLD)) {
+        sortterm = term;
+    }
+    // Also remove some common uninteresting starting characters
+    string::size_type i1 = sortterm.find_first_not_of(" \t\\\"'([*+,.#/");
+    if (i1 != 0 && i1 != string::npos) {
+        sortterm = sortterm.substr(i1, sortterm.size()-i1);
+    }
+    return sortterm;
+}
+
 }
 
 
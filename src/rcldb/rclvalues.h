@@ -24,6 +24,8 @@ extern void add_field_value(Xapian::Document& xdoc, const FieldTraits& ft,
                             const std::string& data);
 extern std::string convert_field_value(const FieldTraits& ft,
                                        const std::string& data);
+/** Compute the sort key for a text field value (title, file name...) */
+extern std::string sort_key_from_string(const std::string& data);
 }
 
 #endif /* _RCLVALUES_H_INCLUDED_ */
@@ -0,0 +1,461 @@
+/* Copyright (C) 2021 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "autoconfig.h"
+
+#include "rclztext.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "log.h"
+#include "md5.h"
+#include "zlibut.h"
+
+using namespace std;
+
+namespace Rcl {
+
+// Texts up to this size are compressed with the dictionary, and
+// possibly used as samples for building it.
+static const size_t smalldocmax = 16 * 1024;
+// The dictionary is built when we have this many samples, or this
+// many bytes of them.
+static const size_t dictsamplescnt = 1000;
+static const size_t dictsamplesbytes = 2 * 1024 * 1024;
+// Dictionary sizes. zlib can only use the last 32 KB
+static const size_t zlibdictsize = 32 * 1024;
+static const size_t zstddictsize = 64 * 1024;
+static const int zstdlevel = 3;
+// Record header: 0, codec, flags, [dictionary id]
+static const unsigned char ZTF_DICT = 1;
+static const size_t dictidlen = 4;
+
+class ZTDict {
+public:
+    ZTDict(ZTextCodec::Codec c, const string& d)
+        : codec(c), data(d) {
+        string digest;
+        MD5String(data, digest);
+        id = digest.substr(0, dictidlen);
+#ifdef HAVE_LIBZSTD
+        if (codec == ZTextCodec::ZTC_ZSTD) {
+            cdict = ZSTD_createCDict(data.c_str(), data.size(), zstdlevel);
+            ddict = ZSTD_createDDict(data.c_str(), data.size());
+        }
+#endif
+    }
+    ~ZTDict() {
+#ifdef HAVE_LIBZSTD
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+#endif
+    }
+    ZTextCodec::Codec codec;
+    string data;
+    string id;
+#ifdef HAVE_LIBZSTD
+    ZSTD_CDict *cdict{nullptr};
+    ZSTD_DDict *ddict{nullptr};
+#endif
+};
+
+class ZTextCodec::Internal {
+public:
+    // Build a dictionary from the samples. This is used for zlib, and
+    // as a fallback for zstd: we look for the words and lines which
+    // occur in many documents, and concatenate the most interesting
+    // ones, ending with the best, as zlib matches nearer strings more
+    // cheaply.
+    static string simpleDict(const vector<string>& samples, size_t maxsize) {
+        unordered_map<string, int> dfs;
+        unordered_set<string> seen;
+        for (const auto& sample : samples) {
+            seen.clear();
+            string::size_type pos = 0;
+            while (pos < sample.size()) {
+                auto nl = sample.find('\n', pos);
+                if (nl == string::npos)
+                    nl = sample.size();
+                if (nl - pos >= 8 && nl - pos <= 200) {
+                    seen.insert(sample.substr(pos, nl - pos + 1));
+                }
+                pos = nl + 1;
+            }
+            pos = 0;
+            while ((pos = sample.find_first_not_of(" \t\r\n", pos)) !=
+                   string::npos) {
+                auto end = sample.find_first_of(" \t\r\n", pos);
+                if (end == string::npos)
+                    end = sample.size();
+                if (end - pos >= 3 && end - pos <= 80) {
+                    seen.insert(sample.substr(pos, end - pos));
+                }
+                pos = end;
+            }
+            for (const auto& s : seen) {
+                dfs[s]++;
+            }
+        }
+
+        int mindf = std::max(2, int(samples.size() / 50));
+        vector<pair<size_t, const string *>> cands;
+        for (const auto& ent : dfs) {
+            if (ent.second >= mindf) {
+                cands.push_back({ent.second * ent.first.size(), &ent.first});
+            }
+        }
+        std::sort(cands.begin(), cands.end(),
+                  [](const pair<size_t, const string *>& a,
+                     const pair<size_t, const string *>& b) {
+                      return a.first > b.first;});
+        size_t total = 0;
+        size_t cnt = 0;
+        for (; cnt < cands.size(); cnt++) {
+            if (total + cands[cnt].second->size() + 1 > maxsize)
+                break;
+            total += cands[cnt].second->size() + 1;
+        }
+        string dict;
+        dict.reserve(total);
+        while (cnt > 0) {
+            cnt--;
+            dict.append(*cands[cnt].second);
+            if (dict.back() != '\n')
+                dict += ' ';
+        }
+        return dict;
+    }
+
+    static string buildDict(Codec codec, const vector<string>& samples) {
+#ifdef HAVE_LIBZSTD
+        if (codec == ZTC_ZSTD) {
+            string all;
+            vector<size_t> sizes;
+            for (const auto& sample : samples) {
+                all.append(sample);
+                sizes.push_back(sample.size());
+            }
+            string dict(zstddictsize, 0);
+            size_t ret = ZDICT_trainFromBuffer(
+                &dict[0], dict.size(), all.c_str(), &sizes[0], sizes.size());
+            if (!ZDICT_isError(ret)) {
+                dict.resize(ret);
+                return dict;
+            }
+            LOGINF("ZTextCodec: dictionary training failed: " <<
+                   ZDICT_getErrorName(ret) << "\n");
+            return simpleDict(samples, zstddictsize);
+        }
+#endif
+        return simpleDict(samples, zlibdictsize);
+    }
+
+    // Get the dictionary to use for compressing in. Also manages
+    // the samples collection, and builds the dictionary when
+    // possible.
+    shared_ptr<ZTDict> getDict(const string& in) {
+        if (in.size() > smalldocmax)
+            return shared_ptr<ZTDict>();
+        vector<string> mysamples;
+        Codec mycodec;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (dict || !sampling)
+                return dict;
+            samples.push_back(in);
+            samplesbytes += in.size();
+            if (samples.size() < dictsamplescnt &&
+                samplesbytes < dictsamplesbytes) {
+                return shared_ptr<ZTDict>();
+            }
+            // We're the one building the dictionary. Do it outside
+            // of the lock.
+            mysamples.swap(samples);
+            mycodec = codec;
+            samplesbytes = 0;
+            sampling = false;
+        }
+        string data = buildDict(mycodec, mysamples);
+        if (data.empty()) {
+            return shared_ptr<ZTDict>();
+        }
+        LOGINF("ZTextCodec: built dictionary, size " << data.size() << "\n");
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!dict) {
+            dict = make_shared<ZTDict>(mycodec, data);
+            dictisnew = true;
+        }
+        return dict;
+    }
+
+    std::mutex mutex;
+    Codec codec{ZTC_ZLIB};
+    shared_ptr<ZTDict> dict;
+    bool dictisnew{false};
+    bool sampling{true};
+    vector<string> samples;
+    size_t samplesbytes{0};
+};
+
+ZTextCodec::ZTextCodec()
+{
+    m = new Internal;
+}
+
+ZTextCodec::~ZTextCodec()
+{
+    delete m;
+}
+
+bool ZTextCodec::nameToCodec(const string& name, Codec *codecp)
+{
+    if (name == "zlib") {
+        *codecp = ZTC_ZLIB;
+        return true;
+    }
+#ifdef HAVE_LIBZSTD
+    if (name == "zstd") {
+        *codecp = ZTC_ZSTD;
+        return true;
+    }
+#endif
+    return false;
+}
+
+void ZTextCodec::setCodec(Codec codec)
+{
+    std::unique_lock<std::mutex> lock(m->mutex);
+    m->codec = codec;
+}
+
+bool ZTextCodec::setDictRecord(const string& record)
+{
+    std::unique_lock<std::mutex> lock(m->mutex);
+    m->dict.reset();
+    m->dictisnew = false;
+    m->samples.clear();
+    m->samplesbytes = 0;
+    if (record.empty()) {
+        m->sampling = true;
+        return true;
+    }
+    // Don't try to build another one if this one is unusable
+    m->sampling = false;
+    if (record.size() <= 1 + dictidlen) {
+        LOGERR("ZTextCodec::setDictRecord: bad record\n");
+        return false;
+    }
+    Codec codec = Codec(record[0]);
+    if (codec != ZTC_ZLIB && codec != ZTC_ZSTD) {
+        LOGERR("ZTextCodec::setDictRecord: bad codec " << int(codec) << "\n");
+        return false;
+    }
+    m->dict = make_shared<ZTDict>(codec, record.substr(1 + dictidlen));
+    if (m->dict->id != record.substr(1, dictidlen)) {
+        LOGERR("ZTextCodec::setDictRecord: bad dictionary id\n");
+        m->dict.reset();
+        return false;
+    }
+    return true;
+}
+
+string ZTextCodec::getDictRecord()
+{
+    std::unique_lock<std::mutex> lock(m->mutex);
+    if (!m->dict)
+        return string();
+    string record(1, char(m->dict->codec));
+    record.append(m->dict->id);
+    record.append(m->dict->data);
+    return record;
+}
+
+bool ZTextCodec::newDictAvailable()
+{
+    std::unique_lock<std::mutex> lock(m->mutex);
+    bool ret = m->dictisnew;
+    m->dictisnew = false;
+    return ret;
+}
+
+bool ZTextCodec::compress(const string& in, string& out)
+{
+    out.clear();
+    if (in.empty())
+        return true;
+    Codec codec;
+    {
+        std::unique_lock<std::mutex> lock(m->mutex);
+        codec = m->codec;
+    }
+    shared_ptr<ZTDict> dict = m->getDict(in);
+    if (dict && dict->codec != codec)
+        dict.reset();
+
+    if (codec == ZTC_ZLIB && !dict) {
+        // Same as older versions
+        ZLibUtBuf buf;
+        if (!deflateToBuf(in.c_str(), in.size(), buf))
+            return false;
+        out.assign(buf.getBuf(), buf.getCnt());
+        return true;
+    }
+
+    out.push_back(0);
+    out.push_back(char(codec));
+    out.push_back(dict ? ZTF_DICT : 0);
+    if (dict) {
+        out.append(dict->id);
+    }
+    switch (codec) {
+    case ZTC_ZLIB:
+    {
+        ZLibUtBuf buf;
+        if (!deflateToBuf(in.c_str(), in.size(), buf,
+                          dict->data.c_str(), dict->data.size()))
+            return false;
+        out.append(buf.getBuf(), buf.getCnt());
+        return true;
+    }
+#ifdef HAVE_LIBZSTD
+    case ZTC_ZSTD:
+    {
+        size_t hdrsize = out.size();
+        size_t cap = ZSTD_compressBound(in.size());
+        out.resize(hdrsize + cap);
+        ZSTD_CCtx *cctx = ZSTD_createCCtx();
+        size_t ret = dict ?
+            ZSTD_compress_usingCDict(cctx, &out[hdrsize], cap,
+                                     in.c_str(), in.size(), dict->cdict) :
+            ZSTD_compressCCtx(cctx, &out[hdrsize], cap, in.c_str(), in.size(),
+                              zstdlevel);
+        ZSTD_freeCCtx(cctx);
+        if (ZSTD_isError(ret)) {
+            LOGERR("ZTextCodec::compress: " << ZSTD_getErrorName(ret) << "\n");
+            out.clear();
+            return false;
+        }
+        out.resize(hdrsize + ret);
+        return true;
+    }
+#endif
+    default:
+        LOGERR("ZTextCodec::compress: bad codec " << int(codec) << "\n");
+        out.clear();
+        return false;
+    }
+}
+
+bool ZTextCodec::hasDictFor(const string& in)
+{
+    if (in.size() < 3 + dictidlen || in[0] != 0 || !(in[2] & ZTF_DICT))
+        return true;
+    std::unique_lock<std::mutex> lock(m->mutex);
+    return m->dict && !in.compare(3, dictidlen, m->dict->id);
+}
+
+bool ZTextCodec::uncompress(const string& in, string& out)
+{
+    out.clear();
+    if (in.empty())
+        return true;
+    if (in[0] != 0) {
+        // Bare zlib data
+        ZLibUtBuf buf;
+        if (!inflateToBuf(in.c_str(), in.size(), buf))
+            return false;
+        out.assign(buf.getBuf(), buf.getCnt());
+        return true;
+    }
+
+    if (in.size() < 3) {
+        LOGERR("ZTextCodec::uncompress: bad data\n");
+        return false;
+    }
+    Codec codec = Codec(in[1]);
+    unsigned char flags = in[2];
+    size_t hdrsize = 3;
+    shared_ptr<ZTDict> dict;
+    if (flags & ZTF_DICT) {
+        hdrsize += dictidlen;
+        {
+            std::unique_lock<std::mutex> lock(m->mutex);
+            dict = m->dict;
+        }
+        if (!dict || in.size() < hdrsize ||
+            in.compare(3, dictidlen, dict->id) || dict->codec != codec) {
+            LOGERR("ZTextCodec::uncompress: dictionary not found\n");
+            return false;
+        }
+    }
+    const char *data = in.c_str() + hdrsize;
+    size_t datasize = in.size() - hdrsize;
+    switch (codec) {
+    case ZTC_ZLIB:
+    {
+        ZLibUtBuf buf;
+        if (!inflateToBuf(data, datasize, buf,
+                          dict ? dict->data.c_str() : nullptr,
+                          dict ? dict->data.size() : 0))
+            return false;
+        out.assign(buf.getBuf(), buf.getCnt());
+        return true;
+    }
+#ifdef HAVE_LIBZSTD
+    case ZTC_ZSTD:
+    {
+        unsigned long long size = ZSTD_getFrameContentSize(data, datasize);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+            LOGERR("ZTextCodec::uncompress: bad zstd data\n");
+            return false;
+        }
+        out.resize(size);
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        size_t ret = dict ?
+            ZSTD_decompress_usingDDict(dctx, &out[0], out.size(),
+                                       data, datasize, dict->ddict) :
+            ZSTD_decompressDCtx(dctx, &out[0], out.size(), data, datasize);
+        ZSTD_freeDCtx(dctx);
+        if (ZSTD_isError(ret)) {
+            LOGERR("ZTextCodec::uncompress: " << ZSTD_getErrorName(ret) <<"\n");
+            out.clear();
+            return false;
+        }
+        out.resize(ret);
+        return true;
+    }
+#endif
+    default:
+        LOGERR("ZTextCodec::uncompress: unsupported codec " << int(codec) <<
+               "\n");
+        return false;
+    }
+}
+
+} // namespace Rcl
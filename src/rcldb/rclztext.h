@@ -0,0 +1,82 @@
+#ifndef _RCLZTEXT_H_INCLUDED_
+#define _RCLZTEXT_H_INCLUDED_
+/* Copyright (C) 2021 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string>
+
+namespace Rcl {
+
+/**
+ * Compression of the document texts stored in the index (used for
+ * generating snippets).
+ *
+ * The texts can be compressed with zlib or, if available at build
+ * time, zstd. Small documents are compressed with a dictionary built
+ * from samples of the first ones indexed, which is stored in the
+ * index metadata (see getDictRecord()/setDictRecord()).
+ *
+ * Texts compressed with zlib without a dictionary are bare zlib
+ * streams, as written by older versions. Other records begin with a
+ * 0 byte (which a zlib stream can't), followed by the codec and flags
+ * bytes and the dictionary identifier if one was used.
+ *
+ * compress() and uncompress() can be called concurrently from
+ * several threads.
+ */
+class ZTextCodec {
+public:
+    enum Codec {ZTC_ZLIB = 1, ZTC_ZSTD = 2};
+
+    ZTextCodec();
+    ~ZTextCodec();
+    ZTextCodec(const ZTextCodec&) = delete;
+    ZTextCodec& operator=(const ZTextCodec&) = delete;
+
+    /** Translate configuration value. Returns false if the name is
+     * unknown or the codec was not compiled in. */
+    static bool nameToCodec(const std::string& name, Codec *codecp);
+    /** Set the codec used for compressing. Uncompressing uses the
+     * one which was used for the data, whatever this is set to. */
+    void setCodec(Codec codec);
+
+    /** Set the dictionary from the record stored in the index. An
+     * empty record resets to no dictionary */
+    bool setDictRecord(const std::string& record);
+    /** Get the current dictionary record (empty if none) */
+    std::string getDictRecord();
+    /** Returns true once after a new dictionary was built by
+     * compress(), so that it can be stored in the index */
+    bool newDictAvailable();
+
+    /** Check that we have the dictionary needed for uncompressing
+     * in, if any. A false return means that the dictionary record
+     * should be reloaded from the index: it may have been created
+     * after we read it. */
+    bool hasDictFor(const std::string& in);
+
+    bool compress(const std::string& in, std::string& out);
+    bool uncompress(const std::string& in, std::string& out);
+
+    class Internal;
+private:
+    Internal *m{nullptr};
+};
+
+}
+
+#endif /* _RCLZTEXT_H_INCLUDED_ */
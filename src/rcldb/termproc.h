@@ -128,7 +128,8 @@ public:
     virtual bool takeword(const string& itrm, int pos, int bs, int be)
     {
         m_totalterms++;
-        string otrm;
+        // Reuse the member buffer to avoid an allocation per term
+        string& otrm = m_otrm;
 
         if (!unacmaybefold(itrm, otrm, "UTF-8", UNACOP_UNACFOLD)) {
             LOGDEB("splitter::takeword: unac [" << itrm << "] failed\n");
@@ -165,7 +166,7 @@ public:
                     it++;
                 }
                 if (*itprev == 0x30fc || *itprev == 0xff70) {
-                    otrm = otrm.substr(0, itprev.getBpos());
+                    otrm.erase(itprev.getBpos());
                 }
             }
         }
@@ -212,6 +213,7 @@ public:
 private:
     int m_totalterms;
     int m_unacerrors;
+    string m_otrm;
 };
 
 /** Compare to stop words list and discard if match found */
@@ -41,6 +41,7 @@ static int     op_flags;
 #define OPT_M     0x400
 #define OPT_D     0x800
 #define OPT_k     0x1000
+#define OPT_j     0x2000
 class myCB : public FsTreeWalkerCB {
  public:
     FsTreeWalker::Status processone(const string &path, 
@@ -92,6 +93,7 @@ static char usage [] =
 " -w : unset default FNM_PATHNAME when using fnmatch() to match skipped paths\n"
 " -M <depth>: limit depth (works with -b/m/d)\n"
 " -D : skip dotfiles\n"
+" -j <nthreads> : read directories ahead with threads (natural order only)\n"
 "-k : like du\n"
 ;
 static void
@@ -106,6 +108,7 @@ int main(int argc, const char **argv)
     vector<string> patterns;
     vector<string> paths;
     int maxdepth = -1;
+    int nthreads = 0;
 
     thisprog = argv[0];
     argc--; argv++;
@@ -120,6 +123,10 @@ int main(int argc, const char **argv)
 	    case 'c':	op_flags |= OPT_c; break;
 	    case 'd':	op_flags |= OPT_d; break;
 	    case 'D':	op_flags |= OPT_D; break;
+	    case 'j':	op_flags |= OPT_j; if (argc < 2)  Usage();
+		nthreads = atoi(*(++argv));
+		argc--; 
+		goto b1;
 	    case 'k':	op_flags |= OPT_k; break;
 	    case 'L':	op_flags |= OPT_L; break;
 	    case 'm':	op_flags |= OPT_m; break;
@@ -185,6 +192,7 @@ int main(int argc, const char **argv)
     FsTreeWalker walker;
     walker.setOpts(opt); 
     walker.setMaxDepth(maxdepth);
+    walker.setWalkThreads(nthreads);
     walker.setSkippedNames(patterns);
     walker.setSkippedPaths(paths);
     myCB cb;
@@ -11,6 +11,8 @@
 #include <math.h>
 
 #include <iostream>
+#include <chrono>
+#include <new>
 
 #include "readfile.h"
 #include "log.h"
@@ -22,14 +24,31 @@
 
 using namespace std;
 
+// Count the heap allocations for the -b option
+static unsigned long long allocs_count;
+void *operator new(size_t sz)
+{
+    allocs_count++;
+    void *p = malloc(sz ? sz : 1);
+    if (nullptr == p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
 class myTermProc : public Rcl::TermProc {
     int first;
     bool nooutput;
 public:
     myTermProc() : TermProc(0), first(1), nooutput(false) {}
     void setNoOut(bool val) {nooutput = val;}
+    long long termcount{0};
     virtual bool takeword(const string &term, int pos, int bs, int be)
     {
+        termcount++;
         if (nooutput)
             return true;
         FILE *fp = stdout;
@@ -52,6 +71,7 @@ public:
 #define OPT_S     0x80
 #define OPT_u     0x100
 #define OPT_p     0x200
+#define OPT_b     0x400
 
 bool dosplit(const string& data, TextSplit::Flags flags, int op_flags)
 {
@@ -59,6 +79,14 @@ bool dosplit(const string& data, TextSplit::Flags flags, int op_flags)
 
     Rcl::TermProc *nxt = &printproc;
 
+    // Benchmark: same pipeline as for indexing, minus the index itself
+    Rcl::StopList stoplist;
+    Rcl::TermProcStop stopproc(nxt, stoplist);
+    if (op_flags & OPT_b) {
+        nxt = &stopproc;
+        op_flags |= OPT_u | OPT_q;
+    }
+
 //    Rcl::TermProcCommongrams commonproc(nxt, stoplist);
 //    if (op_flags & OPT_S)
 //        nxt = &commonproc;
@@ -72,7 +100,18 @@ bool dosplit(const string& data, TextSplit::Flags flags, int op_flags)
     if (op_flags & OPT_q)
         printproc.setNoOut(true);
 
+    unsigned long long allocs0 = allocs_count;
+    auto start = chrono::steady_clock::now();
     splitter.text_to_words(data);
+    if (op_flags & OPT_b) {
+        auto ms = chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - start).count();
+        unsigned long long allocs = allocs_count - allocs0;
+        cout << printproc.termcount << " terms, " << allocs << " allocations ("
+             << double(allocs) / double(printproc.termcount ? 
+                                         printproc.termcount : 1)
+             << " per term), " << ms << " mS" << endl;
+    }
 
 #ifdef TEXTSPLIT_STATS
         TextSplit::Stats::Values v = splitter.getStats();
@@ -120,6 +159,7 @@ static string thisprog;
 static string usage =
     " textsplit [opts] [filename]\n"
     "   -q : no output\n"
+    "   -b : benchmark the indexing pipeline: print allocations and time\n"
     "   -s :  only spans\n"
     "   -w :  only words\n"
     "   -n :  no numbers\n"
@@ -156,6 +196,7 @@ int main(int argc, char **argv)
             Usage();
         while (**argv)
             switch (*(*argv)++) {
+            case 'b':   op_flags |= OPT_b; break;
             case 'c':   op_flags |= OPT_c; break;
             case 'C':   op_flags |= OPT_C; if (argc < 2)  Usage();
                 charset = *(++argv); argc--; 
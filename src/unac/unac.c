@@ -53,6 +53,11 @@ static inline bool is_except_char(unsigned short c, string& trans)
     trans = it->second;
     return true;
 }
+/* Same as except_trans, but with the translations stored in UTF-8,
+   for use by the native UTF-8 code path. Also remember if any of the
+   exception characters is ASCII, which disables the ASCII shortcut */
+static std::unordered_map<unsigned short, string> except_trans_utf8;
+static bool except_trans_ascii;
 #endif /* BUILDING_RECOLL*/
 
 /*
@@ -14309,6 +14314,140 @@ int fold_string_utf16(const char* in, size_t in_length,
 				      outp, out_lengthp, UNAC_FOLD);
 }
 
+#ifdef BUILDING_RECOLL
+/* Append Unicode BMP character to UTF-8 string */
+static inline void utf8_append_bmp(string& out, unsigned short c)
+{
+    if (c < 0x80) {
+	out += char(c);
+    } else if (c < 0x800) {
+	out += char(0xc0 | (c >> 6));
+	out += char(0x80 | (c & 0x3f));
+    } else {
+	out += char(0xe0 | (c >> 12));
+	out += char(0x80 | ((c >> 6) & 0x3f));
+	out += char(0x80 | (c & 0x3f));
+    }
+}
+
+/*
+ * Native UTF-8 version of unacmaybefold_string_utf16(). This walks the
+ * UTF-8 input and looks up the same tables, without going through
+ * iconv, so that it needs no global lock. The output is appended to a
+ * caller-supplied string, which is cleared first and whose storage can
+ * be reused across calls.
+ *
+ * Runs of ASCII characters are handled without table lookups (the
+ * tables leave them alone, except for case-folding upper-case
+ * letters). Characters outside of the BMP are not in the tables and
+ * are copied unchanged, which is what happens with the surrogate pairs
+ * in the UTF-16 version.
+ *
+ * Returns 0 for success, -1 with errno set to EILSEQ if the input is
+ * not valid UTF-8 (same as what iconv does).
+ */
+int unacmaybefold_string_utf8(const char* in, size_t in_length,
+			      string& out, int what)
+{
+    const unsigned char *cp = (const unsigned char *)in;
+    const unsigned char *end = cp + in_length;
+    bool doascii = !except_trans_ascii || what != UNAC_UNACFOLD;
+
+    out.clear();
+    out.reserve(in_length);
+
+    while (cp < end) {
+	if (*cp < 0x80 && doascii) {
+	    const unsigned char *start = cp;
+	    if (what == UNAC_UNAC) {
+		while (cp < end && *cp < 0x80)
+		    cp++;
+		out.append((const char *)start, cp - start);
+	    } else {
+		while (cp < end && *cp < 0x80) {
+		    unsigned char c = *cp++;
+		    if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		    out += char(c);
+		}
+	    }
+	    continue;
+	}
+
+	/* Decode one character, with the same strictness as iconv:
+	   reject overlong forms, surrogates and values beyond 10FFFF */
+	const unsigned char *start = cp;
+	unsigned int c;
+	size_t clen;
+	if (*cp < 0x80) {
+	    c = *cp;
+	    clen = 1;
+	} else if ((*cp & 0xe0) == 0xc0) {
+	    c = *cp & 0x1f;
+	    clen = 2;
+	} else if ((*cp & 0xf0) == 0xe0) {
+	    c = *cp & 0x0f;
+	    clen = 3;
+	} else if ((*cp & 0xf8) == 0xf0) {
+	    c = *cp & 0x07;
+	    clen = 4;
+	} else {
+	    errno = EILSEQ;
+	    return -1;
+	}
+	if (size_t(end - cp) < clen) {
+	    errno = EILSEQ;
+	    return -1;
+	}
+	for (size_t i = 1; i < clen; i++) {
+	    if ((cp[i] & 0xc0) != 0x80) {
+		errno = EILSEQ;
+		return -1;
+	    }
+	    c = (c << 6) | (cp[i] & 0x3f);
+	}
+	cp += clen;
+	if ((clen == 2 && c < 0x80) || (clen == 3 && c < 0x800) ||
+	    (clen == 4 && (c < 0x10000 || c > 0x10ffff)) ||
+	    (c >= 0xd800 && c <= 0xdfff)) {
+	    errno = EILSEQ;
+	    return -1;
+	}
+
+	if (c > 0xffff) {
+	    out.append((const char *)start, clen);
+	    continue;
+	}
+
+	/* See unacmaybefold_string_utf16() about the exceptions */
+	if (what != UNAC_FOLD && except_trans_utf8.size() != 0) {
+	    auto it = except_trans_utf8.find((unsigned short)c);
+	    if (it != except_trans_utf8.end()) {
+		// An empty translation (single char entry) means: leave
+		// the char alone, as for a 0 length decomposition.
+		if (what == UNAC_UNAC || it->second.empty()) {
+		    out.append((const char *)start, clen);
+		} else {
+		    out += it->second;
+		}
+		continue;
+	    }
+	}
+
+	unsigned short* p;
+	size_t l;
+	unac_uf_char_utf16_(c, p, l, what)
+	if (l == 0) {
+	    out.append((const char *)start, clen);
+	} else if (l != 1 || *p != 0) {
+	    for (size_t k = 0; k < l; k++)
+		utf8_append_bmp(out, p[k]);
+	}
+    }
+    return 0;
+}
+#endif /* BUILDING_RECOLL */
+
 static const char *utf16be = "UTF-16BE";
 static iconv_t u8tou16_cd = (iconv_t)-1;
 static iconv_t u16tou8_cd = (iconv_t)-1;
@@ -14496,6 +14635,18 @@ int unacmaybefold_string(const char* charset,
 	}
 	(*outp)[0] = '\0';
 	*out_lengthp = 0;
+#ifdef BUILDING_RECOLL
+    } else if (!strcasecmp(charset, "UTF-8") || !strcasecmp(charset, "UTF8")) {
+	string out;
+	if (unacmaybefold_string_utf8(in, in_length, out, what) < 0)
+	    return -1;
+	char *cp = (char *)realloc(*outp, out.size() + 1);
+	if (cp == 0)
+	    return -1;
+	memcpy(cp, out.c_str(), out.size() + 1);
+	*outp = cp;
+	*out_lengthp = out.size();
+#endif /* BUILDING_RECOLL */
     } else {
 	char* utf16 = 0;
 	size_t utf16_length = 0;
@@ -14551,6 +14702,8 @@ const char* unac_version(void)
 void unac_set_except_translations(const char *spectrans)
 {
     except_trans.clear();
+    except_trans_utf8.clear();
+    except_trans_ascii = false;
     if (!spectrans || !spectrans[0])
 	return;
 
@@ -14598,6 +14751,16 @@ void unac_set_except_translations(const char *spectrans)
 
 	except_trans[ch] = string((const char *)(out + 2), outsize-2);
 	free(out);
+
+	/* The UTF-8 translation is the input minus the first char */
+	unsigned char lead = (unsigned char)(*it)[0];
+	size_t clen = lead < 0x80 ? 1 : (lead & 0xe0) == 0xc0 ? 2 :
+	    (lead & 0xf0) == 0xe0 ? 3 : 4;
+	if (clen > it->size())
+	    continue;
+	except_trans_utf8[ch] = it->substr(clen);
+	if (ch < 0x80)
+	    except_trans_ascii = true;
     }
 }
 #endif /* BUILDING_RECOLL */
@@ -125,6 +125,16 @@ int fold_string(const char* charset,
  *  can't be an exception character, deal with it...
  */
 void unac_set_except_translations(const char *spectrans);
+
+/*
+ * Native UTF-8 unac/fold, not using iconv and not taking any lock. The
+ * result replaces the contents of <out>, the storage of which is reused.
+ * <what> is 0 for unaccent, 1 for unaccent+fold, 2 for fold only.
+ * Returns 0 on success, -1 with errno set to EILSEQ if the input is not
+ * valid UTF-8.
+ */
+int unacmaybefold_string_utf8(const char* in, size_t in_length,
+                              std::string& out, int what);
 #endif /* BUILDING_RECOLL */
 
 /*
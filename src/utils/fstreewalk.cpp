@@ -21,6 +21,9 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fnmatch.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 #include "safesysstat.h"
 #include <cstring>
 #include <algorithm>
@@ -29,6 +32,12 @@
 #include <vector>
 #include <deque>
 #include <set>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "cstr.h"
 #include "log.h"
@@ -44,6 +53,69 @@ string FsTreeWalker::o_nowalkfn;
 const int FsTreeWalker::FtwTravMask = FtwTravNatural|
     FtwTravBreadth|FtwTravFilesThenDirs|FtwTravBreadthThenDepth;
 
+#ifdef _WIN32
+#define DIRENT _wdirent
+#define DIRHDL _WDIR
+#define OPENDIR _wopendir
+#define CLOSEDIR _wclosedir
+#define READDIR _wreaddir
+#else
+#define DIRENT dirent
+#define DIRHDL DIR
+#define OPENDIR opendir
+#define CLOSEDIR closedir
+#define READDIR readdir
+#endif
+
+// Use the file type from the directory entry, if available, to avoid
+// a stat() for things which we ignore anyway (devices, fifos, sockets)
+static inline bool dirent_ignored(struct DIRENT *ent)
+{
+#if defined(HAVE_STRUCT_DIRENT_D_TYPE) && !defined(_WIN32)
+    switch (ent->d_type) {
+    case DT_CHR:
+    case DT_BLK:
+    case DT_FIFO:
+    case DT_SOCK:
+        return true;
+    default:
+        return false;
+    }
+#else
+    return false;
+#endif
+}
+
+// Stat a directory entry. Use the open directory handle if possible,
+// so that the system does not have to resolve the full path again.
+static inline int dirent_stat(DIRHDL *d, const string& top, const char *dname,
+                              struct stat *stp, bool follow)
+{
+#if defined(HAVE_FSTATAT) && !defined(_WIN32)
+    return fstatat(dirfd(d), dname, stp, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+#else
+    return path_fileprops(path_cat(top, dname), stp, follow);
+#endif
+}
+
+// Test if a subdirectory contains the "nowalk" file.
+static inline bool dirent_nowalk(DIRHDL *d, const string& top,
+                                 const char *dname)
+{
+    if (FsTreeWalker::o_nowalkfn.empty())
+        return false;
+#if defined(HAVE_FSTATAT) && !defined(_WIN32)
+    struct stat st;
+    string rel(dname);
+    rel += "/";
+    rel += FsTreeWalker::o_nowalkfn;
+    return fstatat(dirfd(d), rel.c_str(), &st, 0) == 0;
+#else
+    return path_exists(path_cat(path_cat(top, dname),
+                                FsTreeWalker::o_nowalkfn));
+#endif
+}
+
 #ifndef _WIN32
 // dev/ino means nothing on Windows. It seems that FileId could replace it
 // but we only use this for cycle detection which we just disable.
@@ -57,26 +129,291 @@ public:
 	return dev < r.dev || (dev == r.dev && ino < r.ino);
     }
 };
+
+// Directory read ahead for the parallel walk. When the walker enters
+// a directory, it queues all the subdirectories it is going to
+// visit. Worker threads take the most recently queued ones (the
+// deepest, which the walk will need first), read them and stat their
+// entries. When the walk reaches a directory, it takes the listing
+// if it is ready, waits for it if a worker is busy with it, or reads
+// the directory itself, removing the job from the queue, if no
+// worker got to it yet. Only the walker thread decides what gets
+// queued, so that the callbacks can change the skipped names on the
+// fly as for the serial walk, and so that a symlink cycle can't make
+// the workers run away.
+struct DirEnt {
+    string name;
+    int statret;
+    int staterrno;
+    // Directory contains the "nowalk" file
+    bool nowalk;
+    struct stat st;
+};
+
+struct DirList {
+    enum State {Queued, Running, Done, Cancelled};
+    DirList(const string& d) : dir(d) {}
+    string dir;
+    State state{Queued};
+    bool opened{false};
+    int operrno{0};
+    vector<DirEnt> ents;
+};
+
+class DirPrefetcher {
+public:
+    DirPrefetcher(int nthreads, int opts)
+        : options(opts) {
+        for (int i = 0; i < nthreads; i++) {
+            workers.push_back(std::thread(&DirPrefetcher::work, this));
+        }
+    }
+    ~DirPrefetcher() {
+        {
+            std::unique_lock<std::mutex> locker(mutex);
+            stop = true;
+            workcv.notify_all();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Queue directories for reading. The first in the list will be
+    // read first.
+    void queue(const vector<string>& dirs) {
+        if (dirs.empty())
+            return;
+        std::unique_lock<std::mutex> locker(mutex);
+        for (auto it = dirs.rbegin(); it != dirs.rend(); it++) {
+            if (lists.find(*it) != lists.end())
+                continue;
+            std::shared_ptr<DirList> dl = std::make_shared<DirList>(*it);
+            lists[*it] = dl;
+            todo.push_back(dl);
+        }
+        workcv.notify_all();
+    }
+
+    // Forget about directories which the walk did not use after all.
+    void cancel(const vector<string>& dirs) {
+        if (dirs.empty())
+            return;
+        std::unique_lock<std::mutex> locker(mutex);
+        for (const auto& dir : dirs) {
+            auto it = lists.find(dir);
+            if (it != lists.end()) {
+                if (it->second->state == DirList::Queued)
+                    it->second->state = DirList::Cancelled;
+                lists.erase(it);
+            }
+        }
+    }
+
+    // Get the listing for a directory. 
+    std::shared_ptr<DirList> get(const string& dir) {
+        std::shared_ptr<DirList> dl;
+        std::unique_lock<std::mutex> locker(mutex);
+        auto it = lists.find(dir);
+        if (it == lists.end()) {
+            locker.unlock();
+            dl = std::make_shared<DirList>(dir);
+            readDir(*dl);
+            return dl;
+        }
+        dl = it->second;
+        lists.erase(it);
+        if (dl->state == DirList::Queued) {
+            // No worker got to it, do it ourselves. The job stays
+            // in the queue, but the workers will skip it.
+            dl->state = DirList::Running;
+            locker.unlock();
+            readDir(*dl);
+            return dl;
+        }
+        while (dl->state != DirList::Done) {
+            donecv.wait(locker);
+        }
+        return dl;
+    }
+
+private:
+    int options;
+    std::mutex mutex;
+    std::condition_variable workcv;
+    std::condition_variable donecv;
+    std::deque<std::shared_ptr<DirList> > todo;
+    std::unordered_map<string, std::shared_ptr<DirList> > lists;
+    vector<std::thread> workers;
+    bool stop{false};
+
+    void work() {
+        for (;;) {
+            std::unique_lock<std::mutex> locker(mutex);
+            while (!stop && todo.empty()) {
+                workcv.wait(locker);
+            }
+            if (stop)
+                return;
+            std::shared_ptr<DirList> dl = todo.back();
+            todo.pop_back();
+            if (dl->state != DirList::Queued)
+                continue;
+            dl->state = DirList::Running;
+            locker.unlock();
+            readDir(*dl);
+            locker.lock();
+            dl->state = DirList::Done;
+            donecv.notify_all();
+        }
+    }
+
+    void readDir(DirList& dl) {
+        DIR *d = opendir(dl.dir.c_str());
+        if (d == 0) {
+            dl.operrno = errno;
+            return;
+        }
+        dl.opened = true;
+        struct dirent *ent;
+        while ((ent = ::readdir(d)) != 0) {
+            const char *dname = ent->d_name;
+            if ((options & FsTreeWalker::FtwSkipDotFiles) && dname[0] == '.')
+                continue;
+            if (!strcmp(dname, ".") || !strcmp(dname, "..")) 
+                continue;
+            if (dirent_ignored(ent))
+                continue;
+            dl.ents.push_back(DirEnt());
+            DirEnt& de = dl.ents.back();
+            de.name = dname;
+            de.statret = dirent_stat(d, dl.dir, dname, &de.st,
+                                     options & FsTreeWalker::FtwFollow);
+            de.staterrno = de.statret == -1 ? errno : 0;
+            de.nowalk = de.statret == 0 && S_ISDIR(de.st.st_mode) &&
+                dirent_nowalk(d, dl.dir, dname);
+        }
+        closedir(d);
+    }
+};
 #endif
 
+// Compiled form of a list of fnmatch() patterns. Most skippedNames
+// and skippedPaths entries are either plain strings or simple
+// "*suffix" or "prefix*" patterns. These are looked up in hash sets,
+// and only the other ones still need a fnmatch() call for each
+// tested string. The suffix and prefix forms are only used for
+// names: the '*' matching would depend on FNM_PATHNAME for paths.
+class SkipPatterns {
+public:
+    void compile(const vector<string>& patterns, bool forpaths) {
+        literals.clear();
+        suffixes.clear();
+        suffixlens.clear();
+        prefixes.clear();
+        prefixlens.clear();
+        globs.clear();
+        for (const auto& pat : patterns) {
+            string::size_type pos = pat.find_first_of(cstr_fnmspecchars);
+            if (pos == string::npos) {
+                literals.insert(pat);
+                continue;
+            }
+            if (!forpaths) {
+                if (pos == 0 && pat[0] == '*' &&
+                    pat.find_first_of(cstr_fnmspecchars, 1) == string::npos) {
+                    addfix(pat.substr(1), suffixes, suffixlens);
+                    continue;
+                }
+                if (pos == pat.size() - 1 && pat[pos] == '*') {
+                    addfix(pat.substr(0, pos), prefixes, prefixlens);
+                    continue;
+                }
+            }
+            globs.push_back(pat);
+        }
+    }
+
+    bool match(const string& s, int fnmflags) const {
+        if (literals.find(s) != literals.end())
+            return true;
+        for (auto len : suffixlens) {
+            if (len <= s.size() &&
+                suffixes.find(s.substr(s.size() - len)) != suffixes.end())
+                return true;
+        }
+        for (auto len : prefixlens) {
+            if (len <= s.size() &&
+                prefixes.find(s.substr(0, len)) != prefixes.end())
+                return true;
+        }
+        for (const auto& pat : globs) {
+            if (fnmatch(pat.c_str(), s.c_str(), fnmflags) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Match a path or any of its ancestors (FNM_LEADING_DIR
+    // semantics, the globs are matched with the flag set).
+    bool matchLeading(const string& path, int fnmflags) const {
+        if (!literals.empty()) {
+            if (literals.find(path) != literals.end())
+                return true;
+            for (string::size_type pos = path.find('/');
+                 pos != string::npos; pos = path.find('/', pos + 1)) {
+                if (literals.find(path.substr(0, pos)) != literals.end())
+                    return true;
+            }
+        }
+        for (const auto& pat : globs) {
+            if (fnmatch(pat.c_str(), path.c_str(), fnmflags) == 0)
+                return true;
+        }
+        return false;
+    }
+
+private:
+    std::unordered_set<string> literals;
+    std::unordered_set<string> suffixes;
+    vector<string::size_type> suffixlens;
+    std::unordered_set<string> prefixes;
+    vector<string::size_type> prefixlens;
+    vector<string> globs;
+    
+    static const string cstr_fnmspecchars;
+
+    static void addfix(const string& fix, std::unordered_set<string>& fixes,
+                       vector<string::size_type>& lens) {
+        fixes.insert(fix);
+        if (find(lens.begin(), lens.end(), fix.size()) == lens.end())
+            lens.push_back(fix.size());
+    }
+};
+const string SkipPatterns::cstr_fnmspecchars("*?[\\");
+
 class FsTreeWalker::Internal {
 public:
     Internal(int opts)
-    : options(opts), depthswitch(4), maxdepth(-1), errors(0) {
+    : options(opts), depthswitch(4), maxdepth(-1), nthreads(0), errors(0) {
     }
     int options;
     int depthswitch;
     int maxdepth;
+    int nthreads;
     int basedepth;
     stringstream reason;
     vector<string> skippedNames;
     vector<string> skippedPaths;
+    SkipPatterns skpnames;
+    SkipPatterns skppaths;
     // When doing Breadth or FilesThenDirs traversal, we keep a list
     // of directory paths to be processed, and we do not recurse.
     deque<string> dirs;
     int errors;
 #ifndef _WIN32
     set<DirId> donedirs;
+    std::unique_ptr<DirPrefetcher> prefetcher;
 #endif
     void logsyserr(const char *call, const string &param) {
 	errors++;
@@ -121,6 +458,12 @@ void FsTreeWalker::setMaxDepth(int md)
         data->maxdepth = md;
     }
 }
+void FsTreeWalker::setWalkThreads(int nthreads)
+{
+    if (data) {
+        data->nthreads = nthreads;
+    }
+}
 
 string FsTreeWalker::getReason()
 {
@@ -138,32 +481,35 @@ int FsTreeWalker::getErrCnt()
 bool FsTreeWalker::addSkippedName(const string& pattern)
 {
     if (find(data->skippedNames.begin(), 
-	     data->skippedNames.end(), pattern) == data->skippedNames.end())
+	     data->skippedNames.end(), pattern) == data->skippedNames.end()) {
 	data->skippedNames.push_back(pattern);
+        data->skpnames.compile(data->skippedNames, false);
+    }
     return true;
 }
 bool FsTreeWalker::setSkippedNames(const vector<string> &patterns)
 {
-    data->skippedNames = patterns;
+    // This is called for every directory by the indexer, and the list
+    // rarely changes: only recompile if needed.
+    if (patterns != data->skippedNames) {
+        data->skippedNames = patterns;
+        data->skpnames.compile(data->skippedNames, false);
+    }
     return true;
 }
 bool FsTreeWalker::inSkippedNames(const string& name)
 {
-    for (vector<string>::const_iterator it = data->skippedNames.begin(); 
-	 it != data->skippedNames.end(); it++) {
-	if (fnmatch(it->c_str(), name.c_str(), 0) == 0) {
-	    return true;
-	}
-    }
-    return false;
+    return data->skpnames.match(name, 0);
 }
 
 bool FsTreeWalker::addSkippedPath(const string& ipath)
 {
     string path = (data->options & FtwNoCanon) ? ipath : path_canon(ipath);
     if (find(data->skippedPaths.begin(), 
-	     data->skippedPaths.end(), path) == data->skippedPaths.end())
+	     data->skippedPaths.end(), path) == data->skippedPaths.end()) {
 	data->skippedPaths.push_back(path);
+        data->skppaths.compile(data->skippedPaths, true);
+    }
     return true;
 }
 bool FsTreeWalker::setSkippedPaths(const vector<string> &paths)
@@ -173,6 +519,7 @@ bool FsTreeWalker::setSkippedPaths(const vector<string> &paths)
 	 it != data->skippedPaths.end(); it++)
         if (!(data->options & FtwNoCanon))
             *it = path_canon(*it);
+    data->skppaths.compile(data->skippedPaths, true);
     return true;
 }
 bool FsTreeWalker::inSkippedPaths(const string& path, bool ckparents)
@@ -180,26 +527,22 @@ bool FsTreeWalker::inSkippedPaths(const string& path, bool ckparents)
     int fnmflags = o_useFnmPathname ? FNM_PATHNAME : 0;
 #ifdef FNM_LEADING_DIR
     if (ckparents)
-        fnmflags |= FNM_LEADING_DIR;
-#endif
-
-    for (vector<string>::const_iterator it = data->skippedPaths.begin(); 
-	 it != data->skippedPaths.end(); it++) {
-#ifndef FNM_LEADING_DIR
-        if (ckparents) {
+        return data->skppaths.matchLeading(path, fnmflags | FNM_LEADING_DIR);
+#else
+    if (ckparents) {
+        for (vector<string>::const_iterator it = data->skippedPaths.begin(); 
+             it != data->skippedPaths.end(); it++) {
             string mpath = path;
             while (mpath.length() > 2) {
                 if (fnmatch(it->c_str(), mpath.c_str(), fnmflags) == 0) 
                     return true;
                 mpath = path_getfather(mpath);
             }
-        } else 
-#endif /* FNM_LEADING_DIR */
-        if (fnmatch(it->c_str(), path.c_str(), fnmflags) == 0) {
-            return true;
         }
+        return false;
     }
-    return false;
+#endif /* FNM_LEADING_DIR */
+    return data->skppaths.match(path, fnmflags);
 }
 
 static inline int slashcount(const string& p)
@@ -234,6 +577,15 @@ FsTreeWalker::Status FsTreeWalker::walk(const string& _top,
     // will process files and recursively descend into subdirs in
     // physical order of the current directory.
     if ((data->options & FtwTravMask) == FtwTravNatural) {
+#ifndef _WIN32
+        if (data->nthreads > 1 && !(data->options & FtwNoRecurse)) {
+            data->prefetcher = std::unique_ptr<DirPrefetcher>(
+                new DirPrefetcher(data->nthreads, data->options));
+            Status status = iwalk(top, &st, cb);
+            data->prefetcher.reset();
+            return status;
+        }
+#endif
         return iwalk(top, &st, cb);
     }
 
@@ -308,20 +660,6 @@ FsTreeWalker::Status FsTreeWalker::walk(const string& _top,
     return FtwOk;
 }
 
-#ifdef _WIN32
-#define DIRENT _wdirent
-#define DIRHDL _WDIR
-#define OPENDIR _wopendir
-#define CLOSEDIR _wclosedir
-#define READDIR _wreaddir
-#else
-#define DIRENT dirent
-#define DIRHDL DIR
-#define OPENDIR opendir
-#define CLOSEDIR closedir
-#define READDIR readdir
-#endif
-
 // Note that the 'norecurse' flag is handled as part of the directory read. 
 // This means that we always go into the top 'walk()' parameter if it is a 
 // directory, even if norecurse is set. Bug or Feature ?
@@ -369,6 +707,10 @@ FsTreeWalker::Status FsTreeWalker::iwalk(const string &top,
 	}
 	data->donedirs.insert(dirid);
     }
+
+    if (data->prefetcher) {
+        return piwalk(top, cb);
+    }
 #endif
     SYSPATH(top, systop);
     DIRHDL *d = OPENDIR(systop);
@@ -415,8 +757,10 @@ FsTreeWalker::Status FsTreeWalker::iwalk(const string &top,
 	    if (inSkippedNames(dname))
 		continue;
 	}
+        if (dirent_ignored(ent))
+            continue;
         fn = path_cat(top, dname);
-        int statret =  path_fileprops(fn.c_str(), &st, data->options&FtwFollow);
+        int statret = dirent_stat(d, top, dname, &st, data->options&FtwFollow);
         if (statret == -1) {
             data->logsyserr("stat", fn);
             continue;
@@ -433,7 +777,7 @@ FsTreeWalker::Status FsTreeWalker::iwalk(const string &top,
         }
 
         if (S_ISDIR(st.st_mode)) {
-            if (!o_nowalkfn.empty() && path_exists(path_cat(fn, o_nowalkfn))) {
+            if (dirent_nowalk(d, top, dname)) {
                 continue;
             }
             if (data->options & FtwNoRecurse) {
@@ -477,6 +821,80 @@ FsTreeWalker::Status FsTreeWalker::iwalk(const string &top,
     return status;
 }
 
+#ifndef _WIN32
+// Process the entries for a directory, using the read ahead
+// listing. Natural order only, this is the parallel equivalent of the
+// readdir loop in iwalk().
+FsTreeWalker::Status FsTreeWalker::piwalk(const string &top, 
+                                          FsTreeWalkerCB& cb)
+{
+    std::shared_ptr<DirList> dl = data->prefetcher->get(top);
+    if (!dl->opened) {
+        errno = dl->operrno;
+	data->logsyserr("opendir", top);
+	switch (errno) {
+	case EPERM:
+	case EACCES:
+	case ENOENT:
+            return FtwOk;
+        default:
+            return FtwError;
+        }
+    }
+
+    // Queue the subdirectories that we will enter for reading
+    // ahead. This uses the same tests as the main loop below.
+    vector<string> subdirs;
+    for (const auto& ent : dl->ents) {
+        if (ent.statret == -1 || !S_ISDIR(ent.st.st_mode) || ent.nowalk)
+            continue;
+        if (!data->skippedNames.empty() && inSkippedNames(ent.name))
+            continue;
+        string fn = path_cat(top, ent.name);
+        if (!data->skippedPaths.empty() && inSkippedPaths(fn, false))
+            continue;
+        if (data->maxdepth >= 0 &&
+            slashcount(fn) - data->basedepth >= data->maxdepth)
+            continue;
+        subdirs.push_back(fn);
+    }
+    data->prefetcher->queue(subdirs);
+
+    Status status = FtwOk;
+    for (auto& ent : dl->ents) {
+	if (!data->skippedNames.empty() && inSkippedNames(ent.name))
+            continue;
+        string fn = path_cat(top, ent.name);
+        if (ent.statret == -1) {
+            errno = ent.staterrno;
+            data->logsyserr("stat", fn);
+            continue;
+        }
+        if (!data->skippedPaths.empty() && inSkippedPaths(fn, false))
+            continue;
+
+        if (S_ISDIR(ent.st.st_mode)) {
+            if (ent.nowalk)
+                continue;
+            if ((status = iwalk(fn, &ent.st, cb)) & (FtwStop|FtwError))
+                break;
+            if ((status = cb.processone(top, &ent.st, FtwDirReturn)) 
+                & (FtwStop|FtwError))
+                break;
+        } else if (S_ISREG(ent.st.st_mode) || S_ISLNK(ent.st.st_mode)) {
+            if ((status = cb.processone(fn, &ent.st, FtwRegular)) & 
+                (FtwStop|FtwError))
+                break;
+        }
+    }
+
+    // Drop the listings that we did not use (walk interrupted,
+    // directories seen through another path, etc.)
+    data->prefetcher->cancel(subdirs);
+    return status;
+}
+#endif
+
 
 int64_t fsTreeBytes(const string& topdir)
 {
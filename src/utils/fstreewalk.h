@@ -89,6 +89,12 @@ class FsTreeWalker {
     int getOpts();
     void setDepthSwitch(int);
     void setMaxDepth(int);
+    /** Use threads to read directories ahead of the walk. Only
+     * used with FtwTravNatural when recursing, ignored on Windows.
+     * The callbacks are still made from the caller's thread and in
+     * the same order as for the serial walk. @param nthreads 0 or
+     * 1: no read ahead (default). */
+    void setWalkThreads(int nthreads);
 
     /** 
      * Begin file system walk.
@@ -122,6 +128,7 @@ class FsTreeWalker {
 
  private:
     Status iwalk(const string &dir, struct stat *stp, FsTreeWalkerCB& cb);
+    Status piwalk(const string &dir, FsTreeWalkerCB& cb);
     class Internal; 
    Internal *data;
 };
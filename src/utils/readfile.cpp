@@ -98,6 +98,15 @@ bool file_to_string(const string& fn, string& data, int64_t offs, size_t cnt,
         );
 }
 
+#ifdef READFILE_ENABLE_MD5
+bool file_to_string(const string& fn, string& data, int64_t offs, size_t cnt,
+                    string *md5p, string *reason)
+{
+    FileToString accum(data);
+    return file_scan(fn, &accum, offs, cnt, reason, md5p);
+}
+#endif
+
 bool file_to_string(const string& fn, string& data, string *reason)
 {
     return file_to_string(fn, data, 0, size_t(-1), reason);
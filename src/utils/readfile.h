@@ -101,5 +101,13 @@ bool file_to_string(const std::string& filename, std::string& data,
 bool file_to_string(const std::string& filename, std::string& data,
                     int64_t offs, size_t cnt, std::string *reason = 0);
 
+#ifdef READFILE_ENABLE_MD5
+/** Same as above, also computing the md5 of the data returned (after
+ * decompression), in hexadecimal form. */
+bool file_to_string(const std::string& filename, std::string& data,
+                    int64_t offs, size_t cnt, std::string *md5p,
+                    std::string *reason);
+#endif
+
 
 #endif /* _READFILE_H_INCLUDED_ */
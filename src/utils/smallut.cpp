@@ -756,6 +756,37 @@ string ulltodecstr(uint64_t val)
     return buf;
 }
 
+void putVarint(string& out, uint64_t v)
+{
+    while (v >= 0x80) {
+        out += char((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out += char(v);
+}
+
+bool getVarint(const char*& cp, const char *end, uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; cp < end && shift < 64; shift += 7) {
+        unsigned char c = *cp++;
+        v |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool getVarint(const string& in, string::size_type& pos, uint64_t& v)
+{
+    if (pos > in.size())
+        return false;
+    const char *cp = in.data() + pos;
+    bool ret = getVarint(cp, in.data() + in.size(), v);
+    pos = cp - in.data();
+    return ret;
+}
+
 // Convert byte count into unit (KB/MB...) appropriate for display
 string displayableBytes(int64_t size)
 {
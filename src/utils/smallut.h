@@ -171,6 +171,16 @@ void lltodecstr(int64_t val, std::string& buf);
 std::string lltodecstr(int64_t val);
 std::string ulltodecstr(uint64_t val);
 
+/** Variable length coding of unsigned integers: 7 bits per byte, low
+ * order first, high bit set on all bytes but the last. */
+void putVarint(std::string& out, uint64_t v);
+/** Decode value at cp, not going past end. cp is advanced. Returns
+ * false if the data ends too early */
+bool getVarint(const char*& cp, const char *end, uint64_t& v);
+/** Same, at position pos in string */
+bool getVarint(const std::string& in, std::string::size_type& pos,
+               uint64_t& v);
+
 /** Convert byte count into unit (KB/MB...) appropriate for display */
 std::string displayableBytes(int64_t size);
 
@@ -89,6 +89,17 @@ public:
 	return m_pos;
     }
 
+    /** Advance by cnt characters. The characters after the current
+        one must be single-byte (ascii), which the caller checked. Used
+        for fast processing of ascii runs */
+    void skipascii(std::string::size_type cnt) {
+	if (m_cl == 0 || cnt == 0)
+	    return;
+	m_pos += m_cl + cnt - 1;
+	m_charpos += (unsigned int)cnt;
+	update_cl();
+    }
+
     /** operator* returns the ucs4 value as a machine integer*/
     unsigned int operator*() {
 #ifdef UTF8ITER_CHECK
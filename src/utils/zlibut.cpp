@@ -91,7 +91,8 @@ size_t ZLibUtBuf::getCnt()
     return m->datacnt;
 }
 
-bool inflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf)
+bool inflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf,
+                  const void *dict, unsigned int dictlen)
 {
     LOGDEB0("inflateToBuf: inlen " << inlen << "\n");
 
@@ -131,6 +132,9 @@ bool inflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf)
         if (err == Z_STREAM_END) {
             break;
         }
+        if (err == Z_NEED_DICT && dict) {
+            err = inflateSetDictionary(&d_stream, (const Bytef*)dict, dictlen);
+        }
         if (err != Z_OK) {
             LOGERR("Inflate: error " << err << " msg " <<
                    (d_stream.msg ? d_stream.msg : "") << endl);
@@ -149,8 +153,56 @@ bool inflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf)
 }
 
 
-bool deflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf)
+// Compress with a preset dictionary. We need the stream interface
+// for this.
+static bool deflateDictToBuf(const void* inp, unsigned int inlen,
+                             ZLibUtBuf& buf, const void *dict,
+                             unsigned int dictlen)
+{
+    z_stream c_stream;
+    c_stream.zalloc = (alloc_func)0;
+    c_stream.zfree = (free_func)0;
+    c_stream.opaque = (voidpf)0;
+
+    int err;
+    if ((err = deflateInit(&c_stream, Z_DEFAULT_COMPRESSION)) != Z_OK) {
+        LOGERR("deflateToBuf: deflateInit: err " << err << "\n");
+        return false;
+    }
+    if ((err = deflateSetDictionary(&c_stream, (const Bytef*)dict, dictlen))
+        != Z_OK) {
+        LOGERR("deflateToBuf: deflateSetDictionary: err " << err << "\n");
+        deflateEnd(&c_stream);
+        return false;
+    }
+    uLong len = deflateBound(&c_stream, static_cast<uLong>(inlen));
+    while (buf.m->getAlloc() < int(len)) {
+        if (!buf.m->grow(len)) {
+            LOGERR("deflateToBuf: can't get buffer for " << len << " bytes\n");
+            deflateEnd(&c_stream);
+            return false;
+        }
+    }
+    c_stream.next_in = (Bytef*)inp;
+    c_stream.avail_in = inlen;
+    c_stream.next_out = (Bytef*)buf.getBuf();
+    c_stream.avail_out = buf.m->getAlloc();
+    err = deflate(&c_stream, Z_FINISH);
+    buf.m->datacnt = c_stream.total_out;
+    deflateEnd(&c_stream);
+    if (err != Z_STREAM_END) {
+        LOGERR("deflateToBuf: deflate: err " << err << "\n");
+        return false;
+    }
+    return true;
+}
+
+bool deflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf,
+                  const void *dict, unsigned int dictlen)
 {
+    if (dict && dictlen) {
+        return deflateDictToBuf(inp, inlen, buf, dict, dictlen);
+    }
     uLongf len = compressBound(static_cast<uLong>(inlen));
     // This needs cleanup: because the buffer is reused inside
     // e.g. circache, we want a minimum size in case the 1st doc size,
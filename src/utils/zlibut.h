@@ -15,7 +15,11 @@ public:
     Internal *m;
 };
 
-bool inflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf);
-bool deflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf);
+// The optional dictionary (zlib preset dictionary) must be the same
+// for compression and decompression.
+bool inflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf,
+                  const void *dict = nullptr, unsigned int dictlen = 0);
+bool deflateToBuf(const void* inp, unsigned int inlen, ZLibUtBuf& buf,
+                  const void *dict = nullptr, unsigned int dictlen = 0);
 
 #endif /* _ZLIBUT_H_INCLUDED_ */
@@ -76,6 +76,7 @@ SOURCES += \
 ../../rcldb/expansiondbs.cpp \
 ../../rcldb/rclabstract.cpp \
 ../../rcldb/rclabsfromtext.cpp \
+../../rcldb/rcldatarec.cpp \
 ../../rcldb/rcldb.cpp \
 ../../rcldb/rcldoc.cpp \
 ../../rcldb/rcldups.cpp \
@@ -89,6 +90,8 @@ SOURCES += \
 ../../rcldb/synfamily.cpp \
 ../../rcldb/rclvalues.cpp \
 ../../rcldb/rclvalues.h \
+../../rcldb/rclztext.cpp \
+../../rcldb/rclztext.h \
 ../../unac/unac.cpp \
 ../../utils/appformime.cpp \
 ../../utils/base64.cpp \
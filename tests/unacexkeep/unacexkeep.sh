@@ -0,0 +1,40 @@
+#!/bin/sh
+# unac_except_trans entries with a single character mean: leave this
+# character alone (neither unaccented nor deleted).
+# This file is encoded in UTF-8
+
+topdir=`dirname $0`/..
+. $topdir/shared.sh
+
+initvariables $0
+
+RECOLL_CONFDIR=$topdir/unacexkeep
+export RECOLL_CONFDIR
+
+cat > $RECOLL_CONFDIR/recoll.conf <<EOF1
+loglevel = 6
+logfilename = /tmp/logrcltst
+
+unac_except_trans = ß åå Åå
+
+topdirs = $tstdata/unacexkeep
+EOF1
+
+mkdir -p $tstdata/unacexkeep
+echo "Straße UNACEXKEEP" > $tstdata/unacexkeep/keep.txt
+
+recollindex -z > $mystderr 2>&1
+
+# We need an utf-8 locale for the commands to properly read their arguments
+export LANG=fr_FR.UTF-8
+
+(
+# Should succeed
+recollq 'straße'
+# Should fail: the ß was not deleted
+recollq 'strae'
+)  2>> $mystderr | egrep -v '^Recoll query: ' > $mystdout
+
+diff -w ${myname}.txt $mystdout > $mydiffs 2>&1
+
+checkresult